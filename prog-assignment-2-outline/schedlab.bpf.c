@@ -14,7 +14,11 @@ enum ev_type {
     EV_SWITCH   = 2,
     EV_EXEC     = 3,
     EV_EXIT     = 4,
+    EV_FORK     = 5,
     EV_WAITLONG = 6,  /* wait latency >= threshold */
+    EV_LIFE     = 7,  /* one lifetime record per process exit */
+    EV_MARK     = 8,  /* application phase marker (schedlab_mark uprobe) */
+    EV_REQ      = 9,  /* one request between the --uprobe-begin/-end probes */
 };
 
 struct ev_switch_payload {
@@ -25,13 +29,77 @@ struct ev_switch_payload {
     __s32 prev_cpu, next_cpu;
 };
 
+/* Which threshold fired an EV_WAITLONG */
+enum wait_rule_kind {
+    RULE_GLOBAL = 0,  /* cfg.wait_alert_ns */
+    RULE_PID    = 1,
+    RULE_CGROUP = 2,  /* cgroup v2 id, matched on the task's cgroup or an ancestor */
+    RULE_POLICY = 3,
+    RULE_NICE   = 4,  /* id = nice + 20 */
+};
+
+struct ev_waitlong_payload {
+    __u64 wait_ns;
+    __u64 threshold_ns;
+    __u32 rule_kind;      /* wait_rule_kind */
+    __u32 rule_id;        /* user-assigned, 0 for RULE_GLOBAL */
+    /* CFG_F_STACKS: stack_traces ids, negative = not captured */
+    __s32 kstack, ustack;           /* victim, at its last switch-out */
+    __s32 run_kstack, run_ustack;   /* the task it took the CPU from */
+    __u32 run_pid;
+    __u32 stack_gen;      /* cfg.stack_gen the ids belong to */
+    char  run_comm[16];
+};
+
+/* Where a tracked lifetime started */
+enum life_origin {
+    LIFE_UNKNOWN = 0,  /* already running when we attached */
+    LIFE_FORK    = 1,
+    LIFE_EXEC    = 2,
+};
+
+struct ev_life_payload {
+    __u64 lifetime_ns;    /* fork/exec -> exit, 0 if LIFE_UNKNOWN */
+    __u64 run_ns;
+    __u64 wait_ns;
+    __u64 wakes;
+    __u64 switches;
+    __u32 origin;         /* life_origin */
+    __u32 ppid;           /* parent tgid at fork, 0 otherwise */
+};
+
+struct ev_fork_payload {
+    __u32 parent_pid;
+    __u32 child_pid;
+};
+
+#define MARK_NAME_LEN 32
+
+struct ev_mark_payload {
+    char name[MARK_NAME_LEN];
+};
+
+struct ev_req_payload {
+    __u64 latency_ns;     /* begin -> end */
+    __u64 run_ns;         /* on-CPU inside the request */
+    __u64 wait_ns;        /* runnable but not running */
+    __u64 off_ns;         /* all off-CPU time, blocked or runnable */
+    __u32 switches;       /* times the thread left the CPU */
+    __u32 _pad;
+};
+
 struct event {
     __u64 ts_ns;
     __u32 type;   /* ev_type */
     __u32 pid;    /* primary pid for convenience */
     char  comm[16];
     union {
-        struct ev_switch_payload  sw;
+        struct ev_switch_payload    sw;
+        struct ev_waitlong_payload  wl;
+        struct ev_life_payload      life;
+        struct ev_fork_payload      fork;
+        struct ev_mark_payload      mark;
+        struct ev_req_payload       req;
     } u;
 };
 
@@ -50,13 +118,219 @@ struct {
     __type(value, __u64);
 } wake_ts SEC(".maps");
 
-/* pid -> last time it began running (for run_ns on switch-out) */
+/* Per-CPU run state: whoever this CPU switched to last, and since when.
+ * The task being switched out is by definition curr_pid, so run_ns comes
+ * from here instead of a pid-keyed lookup. Also gives exact busy/idle time
+ * per CPU (pid 0 is the idle task). */
+struct cpu_state {
+    __u32 curr_pid;
+    __u32 _pad;
+    __u64 since_ns;  /* when curr_pid was switched in; 0 = not seen yet */
+    __u64 busy_ns;
+    __u64 idle_ns;
+    __u64 switches;
+    __u32 victim_pid;   /* CFG_F_INTERF: whom curr_pid preempted, 0 = nobody */
+    __u32 _pad2;
+    __u64 victim_cgid;
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, struct cpu_state);
+} cpu_state SEC(".maps");
+
+/* Per-CPU time series: a ring of fixed-width buckets (cfg.bucket_ns wide)
+ * per CPU. Slices are split across the buckets they cover, so user space
+ * can read busy/idle %, switch rate and runqueue depth per CPU without any
+ * switch events being streamed. */
+#define CPU_BUCKETS       256
+#define SERIES_MAX_SPLIT  64   /* backfill at most this many buckets per slice */
+
+struct cpu_bucket {
+    __u64 idx;             /* absolute bucket number (ts / bucket_ns) */
+    __u64 busy_ns;
+    __u64 idle_ns;
+    __u64 switches;
+    __u64 nr_running_sum;  /* rq->nr_running sampled at each switch */
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, CPU_BUCKETS);
+    __type(key, __u32);
+    __type(value, struct cpu_bucket);
+} cpu_buckets SEC(".maps");
+
+extern struct rq runqueues __ksym;
+
+/* log2 latency histograms: bucket i counts values in [2^i, 2^(i+1)) ns,
+ * the last bucket is open-ended (~2.1s and up). */
+#define LAT_BUCKETS 32
+
+/* Heatmap: time x log-latency, double-buffered. The kernel adds into column
+ * cfg.heat_slot; user space flips the slot every interval and drains the
+ * other one, so cost is per event and independent of how often we read. */
+enum heat_metric {
+    HEAT_WAIT   = 0,  /* wake -> switch-in */
+    HEAT_RUN    = 1,  /* run slice */
+    HEAT_OFFCPU = 2,  /* switch-out -> switch-in */
+    HEAT_METRICS,
+};
+
+struct heat_col {
+    __u64 cnt[HEAT_METRICS][LAT_BUCKETS];
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, 2);
+    __type(key, __u32);
+    __type(value, struct heat_col);
+} heat SEC(".maps");
+
+/* Per-key wake->switch latency histograms, bounded by LRU so a box with
+ * thousands of short-lived pids keeps the hot ones. */
+struct lat_hist {
+    __u64 count;
+    __u64 sum_ns;
+    __u64 max_ns;
+    __u64 slots[LAT_BUCKETS];
+};
+
+struct comm_key {
+    char comm[16];
+};
+
+/* comm is taken when the entry is created, so a pid that has exited by
+ * report time still has a name */
+struct pid_lat {
+    struct lat_hist h;
+    char comm[16];
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, 16384);
+    __type(key, __u32);
+    __type(value, struct pid_lat);
+} lat_by_pid SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, 4096);
+    __type(key, struct comm_key);
+    __type(value, struct lat_hist);
+} lat_by_comm SEC(".maps");
+
+/* Per scheduling class x priority: latency, run slices and CPU time, so RT,
+ * fair and SCHED_IDLE work stop landing in one distribution. Indexed by
+ * policy * CLASS_PRIOS + prio + 1; slot 0 is prio -1 (SCHED_DEADLINE). */
+#define CLASS_POLICIES 8    /* SCHED_NORMAL .. SCHED_EXT */
+#define CLASS_PRIOS    141  /* -1 .. MAX_PRIO - 1 */
+
+struct class_stats {
+    __u64 wakes;
+    __u64 slices;
+    __u64 run_ns;
+    __u64 wait_ns;
+    __u64 waits;
+    __u64 wait_slots[LAT_BUCKETS];
+    __u64 run_slots[LAT_BUCKETS];
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, CLASS_POLICIES * CLASS_PRIOS);
+    __type(key, __u32);
+    __type(value, struct class_stats);
+} class_stats SEC(".maps");
+
+/* pid -> when it last left a CPU (off-CPU time on the next switch-in),
+ * and with CFG_F_STACKS/CFG_F_OFFCPU where it was at that point: ids in
+ * offcpu_traces with CFG_F_OFFCPU, else in stack_traces */
+struct off_start {
+    __u64 ts_ns;
+    __s32 kstack, ustack;  /* stack_traces ids, negative = none */
+    __u32 tgid;
+    __u32 blocked;         /* left in a sleep state, not yet booked to offcpu_stacks */
+    __u32 stack_gen;       /* cfg.stack_gen when the stack_traces ids were taken */
+    __u32 _pad;
+};
+
 struct {
     __uint(type, BPF_MAP_TYPE_HASH);
     __uint(max_entries, 131072);
     __type(key, __u32);
+    __type(value, struct off_start);
+} off_start SEC(".maps");
+
+/* Kernel and user stacks for starvation episodes (CFG_F_STACKS). Ids are
+ * taken without BPF_F_REUSE_STACKID, so a stack whose bucket already holds
+ * a different one gets -EEXIST and is counted in stack_misses. Nothing
+ * frees single ids; once misses show up user space bumps cfg.stack_gen,
+ * clears the table and bumps it again. Ids are tagged with the generation
+ * they were taken in and only used while it is current, so an id never
+ * names a stack stored after a clear. */
+#define STACK_DEPTH 127  /* PERF_MAX_STACK_DEPTH */
+
+#ifndef EEXIST
+#define EEXIST 17
+#endif
+
+struct {
+    __uint(type, BPF_MAP_TYPE_STACK_TRACE);
+    __uint(max_entries, 16384);
+    __type(key, __u32);
+    __uint(value_size, STACK_DEPTH * sizeof(__u64));
+} stack_traces SEC(".maps");
+
+/* offcpu-flame's stacks live in their own table, so episode stacks and
+ * blocked-time stacks never compete for buckets. Ids stay in
+ * offcpu_stacks keys until the report, hence no reuse here either. */
+struct {
+    __uint(type, BPF_MAP_TYPE_STACK_TRACE);
+    __uint(max_entries, 16384);
+    __type(key, __u32);
+    __uint(value_size, STACK_DEPTH * sizeof(__u64));
+} offcpu_traces SEC(".maps");
+
+enum stack_miss_kind {
+    STACK_MISS_STACKS = 0,  /* stack_traces */
+    STACK_MISS_OFFCPU = 1,  /* offcpu_traces */
+    STACK_MISS_KINDS  = 2,
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, STACK_MISS_KINDS);
+    __type(key, __u32);
     __type(value, __u64);
-} oncpu_ts SEC(".maps");
+} stack_misses SEC(".maps");
+
+/* Blocked time per (tgid, user stack, kernel stack) for offcpu-flame: the
+ * stacks are the task's at switch-out, the time runs to its wakeup (or
+ * switch-in, if no wakeup was seen). One entry per unique stack, however
+ * often it blocks. */
+struct offcpu_key {
+    __u32 tgid;
+    __s32 kstack, ustack;
+    __u32 _pad;
+};
+
+struct offcpu_val {
+    __u64 ns;
+    __u64 count;
+    char  comm[16];
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __uint(max_entries, 16384);
+    __type(key, struct offcpu_key);
+    __type(value, struct offcpu_val);
+} offcpu_stacks SEC(".maps");
 
 /* Per-PID aggregates (for fairness, counts, etc.) */
 struct agg {
@@ -65,19 +339,305 @@ struct agg {
     __u64 switches;
     __u64 wakes;
     __u64 exec_ts_ns; /* first exec ts we saw for that pid */
+    __u64 weight;     /* se.load.weight at last switch-in (CFG_F_CLASS) */
+    __u32 policy;
+    __s32 prio;
+    __u64 start_ns;   /* fork or exec ts, whichever we saw first */
+    __u32 origin;     /* life_origin */
+    __u32 ppid;
+    __u64 waitlongs;  /* waits over the matching threshold */
+    __u64 cgid;       /* cgroup v2 id at last switch-in (CFG_F_CGID) */
+    __u64 off_home_ns; /* run time on CPUs outside home_node (CFG_F_TOPO) */
+    __u32 home_node;  /* NUMA node + 1, 0 = not run yet (CFG_F_TOPO) */
+    __u32 _pad;
 };
 
+/* LRU so churn from short-lived tasks can never wedge the map; a fork
+ * resets the child's slot, so a reused pid starts from zero. */
 struct {
-    __uint(type, BPF_MAP_TYPE_HASH);
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
     __uint(max_entries, 131072);
     __type(key, __u32);
     __type(value, struct agg);
 } agg_by_pid SEC(".maps");
 
+/* Kernel-side lifetime histograms: [0] = short, [1] = long, split at
+ * cfg.life_cutoff_ns. log2 buckets up to ~18 minutes. */
+#define LIFE_BUCKETS 40
+
+struct life_hist {
+    __u64 count;
+    __u64 sum_ns;
+    __u64 slots[LIFE_BUCKETS];
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, 2);
+    __type(key, __u32);
+    __type(value, struct life_hist);
+} life_hist SEC(".maps");
+
+/* tgid -> run/wait/wakes/switches summed over all its threads
+ * (CFG_F_LIFE), for EV_LIFE; agg_by_pid is per thread. */
+struct life_tot {
+    __u64 run_ns;
+    __u64 wait_ns;
+    __u64 wakes;
+    __u64 switches;
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, 65536);
+    __type(key, __u32);   /* tgid */
+    __type(value, struct life_tot);
+} life_by_tgid SEC(".maps");
+
+/* Request-scoped accounting (--uprobe-begin/--uprobe-end): per thread,
+ * time since the begin probe split into running, runqueue wait and
+ * off-CPU. A thread that leaves the CPU still runnable (preempted) is
+ * waiting for the whole time it is off; a blocked one only from its
+ * wakeup. LRU, so requests that never end age out. */
+struct req_state {
+    __u64 start_ns;
+    __u64 on_ns;       /* last switch-in, 0 while off-CPU */
+    __u64 off_ns;      /* last switch-out, 0 while on-CPU */
+    __u64 run_ns;
+    __u64 wait_ns;
+    __u64 offcpu_ns;
+    __u32 switches;
+    __u32 runnable;    /* switched out preempted or in TASK_RUNNING */
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, 65536);
+    __type(key, __u32);   /* tid */
+    __type(value, struct req_state);
+} req_by_tid SEC(".maps");
+
+/* Per-request distributions, indexed by REQ_H_* */
+enum req_hist_kind {
+    REQ_H_LATENCY = 0,
+    REQ_H_WAIT    = 1,
+    REQ_H_RUN     = 2,
+    REQ_H_OFFCPU  = 3,
+    REQ_HISTS     = 4,
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, REQ_HISTS);
+    __type(key, __u32);
+    __type(value, struct lat_hist);
+} req_hist SEC(".maps");
+
+/* Interference matrix (CFG_F_INTERF): for every involuntary switch (prev
+ * still TASK_RUNNING), count the (victim, preemptor) pair and, when the
+ * preemptor's slice ends, the time it ran. Kept per task and per cgroup
+ * v2 id side by side. */
+enum interf_kind {
+    INTERF_PID    = 0,
+    INTERF_CGROUP = 1,
+};
+
+struct interf_key {
+    __u32 kind;       /* interf_kind */
+    __u32 _pad;
+    __u64 victim;
+    __u64 preemptor;
+};
+
+struct interf_val {
+    __u64 count;
+    __u64 run_ns;     /* preemptor on-CPU right after preempting */
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, 65536);
+    __type(key, struct interf_key);
+    __type(value, struct interf_val);
+} interference SEC(".maps");
+
+/* CPU topology, written once by user space from sysfs before attach.
+ * Ids are only compared for equality; a CPU user space did not fill in
+ * reads as all zeroes. */
+#define MAX_CPUS 1024
+
+struct cpu_topo {
+    __u32 llc;    /* lowest CPU sharing this CPU's last-level cache */
+    __u32 node;   /* NUMA node */
+    __u32 pkg;    /* physical package (socket) */
+    __u32 core;   /* lowest SMT sibling */
+    __s32 sibling;  /* first other SMT sibling, -1 = none */
+    __u32 valid;  /* pushed by user space: present, online, has topology/ */
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, MAX_CPUS);
+    __type(key, __u32);
+    __type(value, struct cpu_topo);
+} cpu_topo SEC(".maps");
+
+/* Per-CPU counters user space folds into core/LLC/node domains
+ * (CFG_F_TOPO), next to cpu_state's busy/idle/switches. Indexed by CPU
+ * rather than per-CPU, since migrations are booked from the CPU that
+ * moves the task, not the one it lands on. */
+struct cpu_dom {
+    struct lat_hist wait;   /* wake -> switch-in on this CPU */
+    __u64 mig_in;           /* tasks migrated to this CPU */
+    __u64 mig_xllc;         /* ... from another LLC on the same node */
+    __u64 mig_xnode;        /* ... from another node */
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, MAX_CPUS);
+    __type(key, __u32);
+    __type(value, struct cpu_dom);
+} cpu_dom SEC(".maps");
+
+/* Wakeup placement (CFG_F_WAKES): where the waker ran vs the CPU the
+ * wakee was queued on, classified by the narrowest domain both share.
+ * Migrations (CFG_F_TOPO) use the same classes. */
+enum wake_class {
+    WAKE_LOCAL   = 0,  /* the waker's own CPU */
+    WAKE_LLC     = 1,  /* another CPU sharing its LLC */
+    WAKE_XLLC    = 2,  /* another LLC on the same NUMA node */
+    WAKE_XNODE   = 3,  /* another NUMA node */
+    WAKE_CLASSES = 4,
+    WAKE_UNKNOWN = WAKE_CLASSES,  /* a CPU without a valid cpu_topo entry */
+};
+
+/* wakee tid -> waker, from sched_waking (which runs in the waker's
+ * context, unlike sched_wakeup after a queued remote wakeup) until the
+ * wakee's switch-in. cls stays WAKE_UNKNOWN until sched_wakeup. */
+struct wake_from {
+    __u32 waker;       /* tid current at sched_waking; may be an interrupted task */
+    __s32 waker_cpu;
+    __s32 cpu;         /* task_cpu(wakee) at sched_wakeup */
+    __u32 cls;         /* wake_class */
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, 131072);
+    __type(key, __u32);
+    __type(value, struct wake_from);
+} wake_from SEC(".maps");
+
+/* wake -> switch-in latency per wake_class */
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, WAKE_CLASSES);
+    __type(key, __u32);
+    __type(value, struct lat_hist);
+} wake_hist SEC(".maps");
+
+/* Per (waker, wakee) tid pair: wakeups and their latency by class */
+struct wake_pair_key {
+    __u32 waker;
+    __u32 wakee;
+};
+
+struct wake_pair_val {
+    __u64 count[WAKE_CLASSES];
+    __u64 wait_ns[WAKE_CLASSES];
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, 65536);
+    __type(key, struct wake_pair_key);
+    __type(value, struct wake_pair_val);
+} wake_pairs SEC(".maps");
+
+/* SMT co-running (CFG_F_SMT). When a slice ends, it overlapped whatever
+ * the sibling CPU is running now from the later of the two switch-ins;
+ * earlier sibling slices were booked when they ended. So every overlap
+ * is counted once, to both tasks and to their pair. */
+struct smt_val {
+    __u64 run_ns;     /* run time on CPUs that have a sibling */
+    __u64 busy_ns;    /* ... while the sibling ran a task */
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, 65536);
+    __type(key, __u32);
+    __type(value, struct smt_val);
+} smt_by_pid SEC(".maps");
+
+struct smt_pair_key {
+    __u32 a, b;       /* a < b */
+};
+
+struct smt_pair_val {
+    __u64 ns;
+    __u64 count;      /* overlapping slice pairs */
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, 65536);
+    __type(key, struct smt_pair_key);
+    __type(value, struct smt_pair_val);
+} smt_pairs SEC(".maps");
+
+/* Starvation thresholds by pid / cgroup / policy / nice. Most specific
+ * match wins; cfg.wait_alert_ns is the optional fallback. */
+struct wait_rule_key {
+    __u32 kind;  /* wait_rule_kind */
+    __u32 _pad;
+    __u64 id;
+};
+
+struct wait_rule {
+    __u64 threshold_ns;
+    __u32 rule_id;
+    __u32 _pad;
+};
+
+#define RULE_CGROUP_DEPTH 8  /* ancestors checked for cgroup rules */
+
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __uint(max_entries, 1024);
+    __type(key, struct wait_rule_key);
+    __type(value, struct wait_rule);
+} wait_rules SEC(".maps");
+
 /* Config knobs */
+#define CFG_F_NO_EVENTS   (1u << 0)  /* aggregate-only mode: skip the ring buffer */
+#define CFG_F_CPU_SERIES  (1u << 1)  /* maintain cpu_buckets */
+#define CFG_F_HEATMAP     (1u << 2)  /* maintain heat, metrics per heat_mask */
+#define CFG_F_LAT_PID     (1u << 3)  /* maintain lat_by_pid */
+#define CFG_F_LAT_COMM    (1u << 4)  /* maintain lat_by_comm */
+#define CFG_F_CLASS       (1u << 5)  /* maintain class_stats + agg weight */
+#define CFG_F_NO_GLOBAL   (1u << 6)  /* no wait_alert_ns fallback when rules miss */
+#define CFG_F_LIFE        (1u << 7)  /* EV_LIFE + life_hist, even with NO_EVENTS */
+#define CFG_F_CGID        (1u << 8)  /* record agg.cgid at switch-in */
+#define CFG_F_REQ         (1u << 9)  /* req_by_tid accounting at every switch */
+#define CFG_F_STACKS      (1u << 10) /* off_start stacks, attached to EV_WAITLONG */
+#define CFG_F_OFFCPU      (1u << 11) /* maintain offcpu_stacks */
+#define CFG_F_INTERF      (1u << 12) /* maintain interference + cpu_state.victim_* */
+#define CFG_F_WAKES       (1u << 13) /* maintain wake_from, wake_hist, wake_pairs */
+#define CFG_F_TOPO        (1u << 14) /* maintain cpu_dom + agg home_node/off_home_ns */
+#define CFG_F_SMT         (1u << 15) /* maintain smt_by_pid, smt_pairs */
+
 struct cfg {
     __u64 wait_alert_ns;     /* EV_WAITLONG threshold; 0=disabled */
     __u32 sample_filter_pid; /* 0=off; if set, only emit this pid's events */
+    __u32 flags;             /* CFG_F_* */
+    __u64 bucket_ns;         /* cpu_buckets width */
+    __u32 heat_slot;         /* heat column currently being filled (0/1) */
+    __u32 heat_mask;         /* 1 << HEAT_* */
+    __u32 rule_kinds;        /* 1 << RULE_* present in wait_rules */
+    __u32 stack_gen;         /* stack_traces generation, see stack_traces */
+    __u64 life_cutoff_ns;    /* short/long split for life_hist */
 };
 
 struct {
@@ -107,6 +667,168 @@ static __always_inline bool pass_filter(__u32 pid)
     return true;
 }
 
+static __always_inline bool want_events(void)
+{
+    struct cfg c;
+    return cfg_load(&c) || !(c.flags & CFG_F_NO_EVENTS);
+}
+
+/* Bucket slot for absolute bucket idx, recycled if it held an older one. */
+static __always_inline struct cpu_bucket *bucket_get(__u64 idx)
+{
+    __u32 slot = idx % CPU_BUCKETS;
+    struct cpu_bucket *b = bpf_map_lookup_elem(&cpu_buckets, &slot);
+    if (b && b->idx != idx) {
+        __builtin_memset(b, 0, sizeof(*b));
+        b->idx = idx;
+    }
+    return b;
+}
+
+/* Spread the slice [since, now) over the buckets it covers, newest first,
+ * so the buckets user space has not read yet are always exact. */
+static __always_inline void series_account(__u64 since, __u64 now, bool idle,
+                                           __u64 bucket_ns)
+{
+    __u64 t = now, idx, lo;
+    struct cpu_bucket *b;
+
+    for (int i = 0; i < SERIES_MAX_SPLIT && t > since; i++) {
+        idx = (t - 1) / bucket_ns;
+        lo  = idx * bucket_ns;
+        if (lo < since)
+            lo = since;
+        b = bucket_get(idx);
+        if (!b)
+            break;
+        if (idle)
+            b->idle_ns += t - lo;
+        else
+            b->busy_ns += t - lo;
+        t = lo;
+    }
+}
+
+static __always_inline __u32 log2_u64(__u64 v)
+{
+    __u32 r = 0;
+
+    if (v >> 32) { v >>= 32; r += 32; }
+    if (v >> 16) { v >>= 16; r += 16; }
+    if (v >> 8)  { v >>= 8;  r += 8;  }
+    if (v >> 4)  { v >>= 4;  r += 4;  }
+    if (v >> 2)  { v >>= 2;  r += 2;  }
+    if (v >> 1)  { r += 1; }
+    return r;
+}
+
+static __always_inline __u32 lat_bucket(__u64 ns)
+{
+    __u32 b = log2_u64(ns);
+    return b < LAT_BUCKETS ? b : LAT_BUCKETS - 1;
+}
+
+static __always_inline __u32 life_bucket(__u64 ns)
+{
+    __u32 b = log2_u64(ns);
+    return b < LIFE_BUCKETS ? b : LIFE_BUCKETS - 1;
+}
+
+static __always_inline void heat_add(const struct cfg *c, __u32 metric, __u64 ns)
+{
+    __u32 slot = c->heat_slot & 1;
+    struct heat_col *h;
+
+    if (!(c->heat_mask & (1u << metric)) || metric >= HEAT_METRICS)
+        return;
+    h = bpf_map_lookup_elem(&heat, &slot);
+    if (h)
+        h->cnt[metric][lat_bucket(ns)]++;
+}
+
+/* Lookup-or-create for lat_by_comm. */
+static __always_inline struct lat_hist *hist_touch(void *map, const void *key)
+{
+    struct lat_hist *h = bpf_map_lookup_elem(map, key);
+    if (!h) {
+        struct lat_hist zero = {};
+        bpf_map_update_elem(map, key, &zero, BPF_NOEXIST);
+        h = bpf_map_lookup_elem(map, key);
+    }
+    return h;
+}
+
+/* comm keys are shared by threads on several CPUs, hence the atomics */
+static __always_inline void hist_add(struct lat_hist *h, __u64 ns)
+{
+    __sync_fetch_and_add(&h->count, 1);
+    __sync_fetch_and_add(&h->sum_ns, ns);
+    __sync_fetch_and_add(&h->slots[lat_bucket(ns)], 1);
+    if (ns > h->max_ns)
+        h->max_ns = ns;
+}
+
+static __always_inline struct class_stats *class_of(struct task_struct *t,
+                                                    __u32 *policy, __s32 *prio)
+{
+    __u32 k;
+
+    *policy = BPF_CORE_READ(t, policy);
+    *prio   = BPF_CORE_READ(t, prio);
+    if (*policy >= CLASS_POLICIES || *prio < -1 || *prio >= CLASS_PRIOS - 1)
+        return NULL;
+    k = *policy * CLASS_PRIOS + (__u32)(*prio + 1);
+    return bpf_map_lookup_elem(&class_stats, &k);
+}
+
+static __always_inline struct wait_rule *rule_find(__u32 kind, __u64 id)
+{
+    struct wait_rule_key k = { .kind = kind, .id = id };
+    return bpf_map_lookup_elem(&wait_rules, &k);
+}
+
+/* Threshold for t: pid, then cgroup (own, then ancestors), then policy,
+ * then nice. Returns NULL when no rule matches. */
+static __always_inline struct wait_rule *rule_match(const struct cfg *c,
+                                                    struct task_struct *t,
+                                                    __u32 pid, __u32 *kind)
+{
+    struct wait_rule *r;
+    struct kernfs_node *kn;
+    __u32 policy;
+    __s32 nice;
+
+    if (c->rule_kinds & (1u << RULE_PID)) {
+        *kind = RULE_PID;
+        if ((r = rule_find(RULE_PID, pid)))
+            return r;
+    }
+    if (c->rule_kinds & (1u << RULE_CGROUP)) {
+        *kind = RULE_CGROUP;
+        kn = BPF_CORE_READ(t, cgroups, dfl_cgrp, kn);
+        for (int i = 0; i < RULE_CGROUP_DEPTH && kn; i++) {
+            if ((r = rule_find(RULE_CGROUP, BPF_CORE_READ(kn, id))))
+                return r;
+            kn = BPF_CORE_READ(kn, parent);
+        }
+    }
+    if (c->rule_kinds & ((1u << RULE_POLICY) | (1u << RULE_NICE))) {
+        policy = BPF_CORE_READ(t, policy);
+        if (c->rule_kinds & (1u << RULE_POLICY)) {
+            *kind = RULE_POLICY;
+            if ((r = rule_find(RULE_POLICY, policy)))
+                return r;
+        }
+        if (c->rule_kinds & (1u << RULE_NICE)) {
+            *kind = RULE_NICE;
+            nice = BPF_CORE_READ(t, static_prio) - 120;
+            if (nice >= -20 && nice <= 19 && (r = rule_find(RULE_NICE, nice + 20)))
+                return r;
+        }
+    }
+    return NULL;
+}
+
 /* Ensure per-pid agg exists, return pointer for in-place updates. */
 static __always_inline struct agg *agg_touch(__u32 pid)
 {
@@ -119,30 +841,299 @@ static __always_inline struct agg *agg_touch(__u32 pid)
     return a;
 }
 
+/* threads of one process switch on several CPUs, hence the atomics */
+static __always_inline void life_add(__u32 tgid, __u64 run_ns, __u64 wait_ns, __u64 wakes,
+                                     __u64 switches)
+{
+    struct life_tot *v = bpf_map_lookup_elem(&life_by_tgid, &tgid);
+
+    if (!v) {
+        struct life_tot zero = {};
+        bpf_map_update_elem(&life_by_tgid, &tgid, &zero, BPF_NOEXIST);
+        v = bpf_map_lookup_elem(&life_by_tgid, &tgid);
+        if (!v)
+            return;
+    }
+    __sync_fetch_and_add(&v->run_ns, run_ns);
+    __sync_fetch_and_add(&v->wait_ns, wait_ns);
+    __sync_fetch_and_add(&v->wakes, wakes);
+    __sync_fetch_and_add(&v->switches, switches);
+}
+
+static __always_inline __u64 task_cgid(struct task_struct *t)
+{
+    return BPF_CORE_READ(t, cgroups, dfl_cgrp, kn, id);
+}
+
+static __always_inline void interf_add(__u32 kind, __u64 victim, __u64 preemptor,
+                                       __u64 count, __u64 run_ns)
+{
+    struct interf_key k = { .kind = kind, .victim = victim, .preemptor = preemptor };
+    struct interf_val *v = bpf_map_lookup_elem(&interference, &k);
+
+    if (!v) {
+        struct interf_val zero = {};
+        bpf_map_update_elem(&interference, &k, &zero, BPF_NOEXIST);
+        v = bpf_map_lookup_elem(&interference, &k);
+        if (!v)
+            return;
+    }
+    __sync_fetch_and_add(&v->count, count);
+    __sync_fetch_and_add(&v->run_ns, run_ns);
+}
+
+/* task_cpu(): since 5.16 thread_info.cpu on every arch; before that the
+ * field was in task_struct on most, which the ___cpu flavor covers */
+struct task_struct___cpu {
+    unsigned int cpu;
+} __attribute__((preserve_access_index));
+
+static __always_inline __s32 task_cpu_of(struct task_struct *t)
+{
+    if (bpf_core_field_exists(t->thread_info.cpu))
+        return BPF_CORE_READ(t, thread_info.cpu);
+    return BPF_CORE_READ((struct task_struct___cpu *)t, cpu);
+}
+
+static __always_inline __u32 wake_class(__s32 from, __s32 to)
+{
+    __u32 a = from, b = to;
+    struct cpu_topo *ta, *tb;
+
+    if (from == to)
+        return WAKE_LOCAL;
+    ta = bpf_map_lookup_elem(&cpu_topo, &a);
+    tb = bpf_map_lookup_elem(&cpu_topo, &b);
+    if (!ta || !tb || !ta->valid || !tb->valid)
+        return WAKE_UNKNOWN;
+    if (ta->node != tb->node)
+        return WAKE_XNODE;
+    if (ta->llc != tb->llc)
+        return WAKE_XLLC;
+    return WAKE_LLC;
+}
+
+/* Home node: the NUMA-balancing preferred node if there is one, else
+ * the node the task first ran on while we watched (where first-touch
+ * allocations went). */
+static __always_inline void home_account(struct agg *a, struct task_struct *t, __u32 cpu,
+                                         __u64 run_ns)
+{
+    struct cpu_topo *tp = bpf_map_lookup_elem(&cpu_topo, &cpu);
+    __s32 pref = -1;
+
+    if (!tp || !tp->valid)
+        return;
+    if (bpf_core_field_exists(t->numa_preferred_nid))
+        pref = BPF_CORE_READ(t, numa_preferred_nid);
+    if (pref >= 0)
+        a->home_node = pref + 1;
+    else if (!a->home_node)
+        a->home_node = tp->node + 1;
+    if (a->home_node != tp->node + 1)
+        a->off_home_ns += run_ns;
+}
+
+/* At switch-in: fold a classified wakeup into wake_hist and wake_pairs. */
+static __always_inline void wake_done(__u32 pid, __u64 wait_ns)
+{
+    struct wake_from *wf = bpf_map_lookup_elem(&wake_from, &pid);
+    struct wake_pair_key k;
+    struct wake_pair_val *v;
+    struct lat_hist *h;
+    __u32 cls;
+
+    if (!wf)
+        return;
+    cls = wf->cls;
+    k.waker = wf->waker;
+    k.wakee = pid;
+    bpf_map_delete_elem(&wake_from, &pid);
+    if (cls >= WAKE_CLASSES)
+        return;
+    h = bpf_map_lookup_elem(&wake_hist, &cls);
+    if (h)
+        hist_add(h, wait_ns);
+    if (!k.waker)
+        return;
+    v = bpf_map_lookup_elem(&wake_pairs, &k);
+    if (!v) {
+        struct wake_pair_val zero = {};
+        bpf_map_update_elem(&wake_pairs, &k, &zero, BPF_NOEXIST);
+        v = bpf_map_lookup_elem(&wake_pairs, &k);
+        if (!v)
+            return;
+    }
+    __sync_fetch_and_add(&v->count[cls], 1);
+    __sync_fetch_and_add(&v->wait_ns[cls], wait_ns);
+}
+
+/* Stack id in map, or negative; bucket collisions are counted per kind. */
+static __always_inline __s32 stack_id(void *ctx, void *map, __u32 kind, __u64 flags)
+{
+    long id = bpf_get_stackid(ctx, map, flags);
+    __u64 *m;
+
+    if (id == -EEXIST && (m = bpf_map_lookup_elem(&stack_misses, &kind)))
+        (*m)++;
+    return id;
+}
+
+/* Book a blocked stretch from off_start to offcpu_stacks, once. */
+static __always_inline void offcpu_add(struct off_start *off, __u64 now, struct task_struct *t)
+{
+    struct offcpu_key k = { .tgid = off->tgid, .kstack = off->kstack, .ustack = off->ustack };
+    struct offcpu_val *v;
+
+    off->blocked = 0;
+    v = bpf_map_lookup_elem(&offcpu_stacks, &k);
+    if (!v) {
+        struct offcpu_val zero = {};
+        bpf_core_read_str(zero.comm, sizeof(zero.comm), &t->comm);
+        bpf_map_update_elem(&offcpu_stacks, &k, &zero, BPF_NOEXIST);
+        v = bpf_map_lookup_elem(&offcpu_stacks, &k);
+        if (!v)
+            return;
+    }
+    __sync_fetch_and_add(&v->ns, now - off->ts_ns);
+    __sync_fetch_and_add(&v->count, 1);
+}
+
+static __always_inline void smt_pid_add(__u32 pid, __u64 run_ns, __u64 busy_ns)
+{
+    struct smt_val *v = bpf_map_lookup_elem(&smt_by_pid, &pid);
+
+    if (!v) {
+        struct smt_val zero = {};
+        bpf_map_update_elem(&smt_by_pid, &pid, &zero, BPF_NOEXIST);
+        v = bpf_map_lookup_elem(&smt_by_pid, &pid);
+        if (!v)
+            return;
+    }
+    __sync_fetch_and_add(&v->run_ns, run_ns);
+    __sync_fetch_and_add(&v->busy_ns, busy_ns);
+}
+
+/* pid ran [start, now) on cpu; book its overlap with the sibling's
+ * current task. The sibling's cpu_state is read without a lock, so a
+ * switch racing with this one can be missed or counted twice. */
+static __always_inline void smt_account(const struct cfg *c, __u32 cpu, __u32 pid,
+                                        __u64 start, __u64 now)
+{
+    struct cpu_topo *tp = bpf_map_lookup_elem(&cpu_topo, &cpu);
+    struct smt_pair_key k;
+    struct smt_pair_val *v;
+    struct cpu_state *sib;
+    __u32 zero = 0, spid = 0, f = c->sample_filter_pid;
+    __u64 from, ns = 0;
+
+    if (!tp || !tp->valid || tp->sibling < 0)
+        return;
+    sib = bpf_map_lookup_percpu_elem(&cpu_state, &zero, tp->sibling);
+    if (sib) {
+        spid = sib->curr_pid;
+        from = sib->since_ns;
+        if (spid && from && from < now)
+            ns = now - (from > start ? from : start);
+    }
+    if (!f || f == pid)
+        smt_pid_add(pid, now - start, ns);
+    if (!ns || (f && f != pid && f != spid))
+        return;
+    if (!f || f == spid)
+        smt_pid_add(spid, 0, ns);
+
+    k.a = pid < spid ? pid : spid;
+    k.b = pid < spid ? spid : pid;
+    v = bpf_map_lookup_elem(&smt_pairs, &k);
+    if (!v) {
+        struct smt_pair_val zero_v = {};
+        bpf_map_update_elem(&smt_pairs, &k, &zero_v, BPF_NOEXIST);
+        v = bpf_map_lookup_elem(&smt_pairs, &k);
+        if (!v)
+            return;
+    }
+    __sync_fetch_and_add(&v->ns, ns);
+    __sync_fetch_and_add(&v->count, 1);
+}
+
 /* ---------------- tp_btf handlers (CO-RE) ---------------- */
 
+/* Only records who is waking whom, and from where; on_wakeup_btf adds
+ * the target CPU once the wakee has one. */
+SEC("tp_btf/sched_waking")
+int BPF_PROG(on_waking_btf, struct task_struct *p)
+{
+    struct wake_from wf = {};
+    __u32 pid;
+    struct cfg c;
+
+    if (cfg_load(&c) || !(c.flags & CFG_F_WAKES))
+        return 0;
+    pid = BPF_CORE_READ(p, pid);
+    if (c.sample_filter_pid && c.sample_filter_pid != pid)
+        return 0;
+
+    wf.waker     = (__u32)bpf_get_current_pid_tgid();
+    wf.waker_cpu = bpf_get_smp_processor_id();
+    wf.cpu       = -1;
+    wf.cls       = WAKE_UNKNOWN;
+    bpf_map_update_elem(&wake_from, &pid, &wf, BPF_ANY);
+    return 0;
+}
+
 SEC("tp_btf/sched_wakeup")
 int BPF_PROG(on_wakeup_btf, struct task_struct *p, int success)
 {
     __u64 now;
-    __u32 pid;
+    __u32 pid, policy;
+    __s32 prio;
     struct agg *a;
+    struct class_stats *cs;
+    struct off_start *off;
+    struct wake_from *wf;
     struct event *e;
+    struct cfg c;
 
     (void)success;
 
+    if (cfg_load(&c))
+        return 0;
+
     now = bpf_ktime_get_ns();
     pid = BPF_CORE_READ(p, pid);
 
-    if (!pass_filter(pid))
+    if (c.sample_filter_pid && c.sample_filter_pid != pid)
         return 0;
 
     bpf_map_update_elem(&wake_ts, &pid, &now, BPF_ANY);
 
+    if ((c.flags & CFG_F_WAKES) && (wf = bpf_map_lookup_elem(&wake_from, &pid))) {
+        wf->cpu = task_cpu_of(p);
+        wf->cls = wake_class(wf->waker_cpu, wf->cpu);
+        if (wf->cls == WAKE_UNKNOWN)
+            bpf_map_delete_elem(&wake_from, &pid);
+    }
+
+    /* blocked time ends here; the runqueue wait after it is not off-CPU
+     * in the flame graph sense */
+    if ((c.flags & CFG_F_OFFCPU) && (off = bpf_map_lookup_elem(&off_start, &pid)) && off->blocked)
+        offcpu_add(off, now, p);
+
     a = agg_touch(pid);
     if (a)
         a->wakes++;
+    if (c.flags & CFG_F_LIFE)
+        life_add(BPF_CORE_READ(p, tgid), 0, 0, 1, 0);
 
+    if (c.flags & CFG_F_CLASS) {
+        cs = class_of(p, &policy, &prio);
+        if (cs)
+            __sync_fetch_and_add(&cs->wakes, 1);
+    }
+
+    if (c.flags & CFG_F_NO_EVENTS)
+        return 0;
     e = bpf_ringbuf_reserve(&rb, sizeof(*e), 0);
     if (!e)
         return 0;
@@ -159,47 +1150,239 @@ SEC("tp_btf/sched_switch")
 int BPF_PROG(on_switch_btf, bool preempt, struct task_struct *prev,
              struct task_struct *next, unsigned int prev_state)
 {
-    __u64 now, run_ns, wait_ns;
-    __u32 prev_pid, next_pid;
-    __u64 *on_ptr, *w_ptr;
+    __u64 now, slice, run_ns, wait_ns;
+    __u32 prev_pid, next_pid, zero = 0, next_policy = 0, prev_policy;
+    __s32 next_prio = 0, prev_prio;
+    bool waited = false, over = false;
+    __u64 thr = 0;
+    __u32 kind = RULE_GLOBAL, rule_id = 0;
+    struct wait_rule *r = NULL;
+    struct class_stats *cs;
+    __s32 cpu;
+    __u64 *w_ptr;
+    struct lat_hist *lh;
+    struct comm_key ck;
+    struct off_start *off, off_now = { .kstack = -1, .ustack = -1 };
+    __s32 vk = -1, vu = -1;
+    __u32 vic_pid = 0;
+    __u64 vic_cgid = 0;
+    bool off_heat;
+    struct cpu_state *st;
+    struct cpu_bucket *b;
+    struct rq *rq;
     struct agg *ap, *an;
+    struct req_state *rs;
+    struct cpu_dom *dom;
     struct event *e;
     struct cfg c;
 
-    (void)preempt; (void)prev_state;
+    if (cfg_load(&c))
+        return 0;
 
     now = bpf_ktime_get_ns();
+    cpu = bpf_get_smp_processor_id();
     prev_pid = BPF_CORE_READ(prev, pid);
     next_pid = BPF_CORE_READ(next, pid);
 
-    if (!pass_filter(next_pid) && !pass_filter(prev_pid))
-        return 0;
+    /* CPU accounting sees every switch, filtered or not */
+    slice = 0;
+    st = bpf_map_lookup_elem(&cpu_state, &zero);
+    if (st) {
+        if (st->since_ns) {
+            slice = now - st->since_ns;
+            if (prev_pid)
+                st->busy_ns += slice;
+            else
+                st->idle_ns += slice;
+            if ((c.flags & CFG_F_CPU_SERIES) && c.bucket_ns)
+                series_account(st->since_ns, now, !prev_pid, c.bucket_ns);
+        }
+        st->curr_pid = next_pid;
+        st->since_ns = now;
+        st->switches++;
+        vic_pid = st->victim_pid;
+        vic_cgid = st->victim_cgid;
+        st->victim_pid = 0;
+        if ((c.flags & CFG_F_INTERF) && prev_pid && next_pid &&
+            (preempt || prev_state == 0)) {
+            st->victim_pid = prev_pid;
+            st->victim_cgid = task_cgid(prev);
+        }
+    }
 
-    run_ns = 0;
-    wait_ns = 0;
+    /* before the filter: the sibling's task may be the one filtered for */
+    if ((c.flags & CFG_F_SMT) && prev_pid && slice)
+        smt_account(&c, cpu, prev_pid, now - slice, now);
 
-    if (prev_pid) {
-        on_ptr = bpf_map_lookup_elem(&oncpu_ts, &prev_pid);
-        if (on_ptr)
-            run_ns = now - *on_ptr;
+    if ((c.flags & CFG_F_CPU_SERIES) && c.bucket_ns) {
+        b = bucket_get(now / c.bucket_ns);
+        rq = bpf_per_cpu_ptr(&runqueues, cpu);
+        if (b) {
+            b->switches++;
+            if (rq)
+                b->nr_running_sum += BPF_CORE_READ(rq, nr_running);
+        }
     }
 
+    if (c.sample_filter_pid && c.sample_filter_pid != next_pid &&
+        c.sample_filter_pid != prev_pid)
+        return 0;
+
+    run_ns = prev_pid ? slice : 0;
+    wait_ns = 0;
+
     if (next_pid) {
         w_ptr = bpf_map_lookup_elem(&wake_ts, &next_pid);
         if (w_ptr) {
             wait_ns = now - *w_ptr;
+            waited = true;
             bpf_map_delete_elem(&wake_ts, &next_pid);
+            if (c.flags & CFG_F_HEATMAP)
+                heat_add(&c, HEAT_WAIT, wait_ns);
+            if (c.flags & CFG_F_LAT_PID) {
+                struct pid_lat *pl = bpf_map_lookup_elem(&lat_by_pid, &next_pid);
+                if (!pl) {
+                    struct pid_lat zero = {};
+                    bpf_core_read_str(zero.comm, sizeof(zero.comm), &next->comm);
+                    bpf_map_update_elem(&lat_by_pid, &next_pid, &zero, BPF_NOEXIST);
+                    pl = bpf_map_lookup_elem(&lat_by_pid, &next_pid);
+                }
+                if (pl)
+                    hist_add(&pl->h, wait_ns);
+            }
+            if (c.flags & CFG_F_LAT_COMM) {
+                __builtin_memset(&ck, 0, sizeof(ck));
+                bpf_core_read_str(ck.comm, sizeof(ck.comm), &next->comm);
+                lh = hist_touch(&lat_by_comm, &ck);
+                if (lh)
+                    hist_add(lh, wait_ns);
+            }
+            if (c.flags & CFG_F_WAKES)
+                wake_done(next_pid, wait_ns);
+            if ((c.flags & CFG_F_TOPO) && (dom = bpf_map_lookup_elem(&cpu_dom, &cpu)))
+                hist_add(&dom->wait, wait_ns);
+        }
+    }
+
+    if ((c.flags & CFG_F_HEATMAP) && run_ns)
+        heat_add(&c, HEAT_RUN, run_ns);
+
+    if (c.flags & CFG_F_CLASS) {
+        if (prev_pid && run_ns) {
+            cs = class_of(prev, &prev_policy, &prev_prio);
+            if (cs) {
+                __sync_fetch_and_add(&cs->slices, 1);
+                __sync_fetch_and_add(&cs->run_ns, run_ns);
+                __sync_fetch_and_add(&cs->run_slots[lat_bucket(run_ns)], 1);
+            }
+        }
+        if (next_pid) {
+            cs = class_of(next, &next_policy, &next_prio);
+            if (cs && waited) {
+                __sync_fetch_and_add(&cs->waits, 1);
+                __sync_fetch_and_add(&cs->wait_ns, wait_ns);
+                __sync_fetch_and_add(&cs->wait_slots[lat_bucket(wait_ns)], 1);
+            }
+        }
+    }
+
+    /* threshold check runs before the NO_EVENTS cut so aggregate-only
+     * consumers (top) still see agg.waitlongs */
+    if (next_pid && waited) {
+        if (c.rule_kinds)
+            r = rule_match(&c, next, next_pid, &kind);
+        if (r) {
+            thr = r->threshold_ns;
+            rule_id = r->rule_id;
+        } else if (!(c.flags & CFG_F_NO_GLOBAL)) {
+            thr = c.wait_alert_ns;
+            kind = RULE_GLOBAL;
         }
+        over = thr && wait_ns >= thr;
     }
 
-    if (next_pid)
-        bpf_map_update_elem(&oncpu_ts, &next_pid, &now, BPF_ANY);
+    /* Off-CPU stretches, for the heatmap's offcpu metric and, with
+     * CFG_F_STACKS, the stacks an EV_WAITLONG carries. prev is still
+     * current here, so bpf_get_stackid() sees prev's stacks. */
+    off_heat = (c.flags & CFG_F_HEATMAP) && (c.heat_mask & (1u << HEAT_OFFCPU));
+    if (off_heat || (c.flags & (CFG_F_STACKS | CFG_F_OFFCPU))) {
+        off_now.ts_ns = now;
+        off_now.kstack = off_now.ustack = -1;
+        off_now.tgid = BPF_CORE_READ(prev, tgid);
+        /* a task preempted between set_current_state() and schedule()
+         * has a sleep state but is still on the runqueue */
+        off_now.blocked = (c.flags & CFG_F_OFFCPU) && !preempt && prev_state != 0;
+        if (prev_pid && off_now.blocked) {
+            off_now.kstack = stack_id(ctx, &offcpu_traces, STACK_MISS_OFFCPU, 0);
+            off_now.ustack = stack_id(ctx, &offcpu_traces, STACK_MISS_OFFCPU, BPF_F_USER_STACK);
+        } else if (prev_pid && (c.flags & CFG_F_STACKS) && !(c.flags & CFG_F_OFFCPU)) {
+            off_now.kstack = stack_id(ctx, &stack_traces, STACK_MISS_STACKS, 0);
+            off_now.ustack = stack_id(ctx, &stack_traces, STACK_MISS_STACKS, BPF_F_USER_STACK);
+            off_now.stack_gen = c.stack_gen;
+        }
+        if (next_pid) {
+            off = bpf_map_lookup_elem(&off_start, &next_pid);
+            if (off) {
+                if (off_heat)
+                    heat_add(&c, HEAT_OFFCPU, now - off->ts_ns);
+                if (off->blocked)
+                    offcpu_add(off, now, next);
+                if (off->stack_gen == c.stack_gen) {
+                    vk = off->kstack;
+                    vu = off->ustack;
+                }
+                bpf_map_delete_elem(&off_start, &next_pid);
+            }
+        }
+        if (prev_pid)
+            bpf_map_update_elem(&off_start, &prev_pid, &off_now, BPF_ANY);
+    }
+
+    if (c.flags & CFG_F_INTERF) {
+        /* the slice that just ended was a preemptor's */
+        if (vic_pid && prev_pid) {
+            interf_add(INTERF_PID, vic_pid, prev_pid, 0, run_ns);
+            interf_add(INTERF_CGROUP, vic_cgid, task_cgid(prev), 0, run_ns);
+        }
+        if (st && st->victim_pid) {
+            interf_add(INTERF_PID, prev_pid, next_pid, 1, 0);
+            interf_add(INTERF_CGROUP, st->victim_cgid, task_cgid(next), 1, 0);
+        }
+    }
+
+    if (c.flags & CFG_F_REQ) {
+        if (prev_pid && (rs = bpf_map_lookup_elem(&req_by_tid, &prev_pid))) {
+            if (rs->on_ns)
+                rs->run_ns += now - rs->on_ns;
+            rs->on_ns = 0;
+            rs->off_ns = now;
+            /* preempted (even with a sleep state already set) or yielded */
+            rs->runnable = preempt || prev_state == 0;
+            rs->switches++;
+        }
+        if (next_pid && (rs = bpf_map_lookup_elem(&req_by_tid, &next_pid))) {
+            if (rs->off_ns) {
+                rs->offcpu_ns += now - rs->off_ns;
+                rs->wait_ns += rs->runnable ? now - rs->off_ns : wait_ns;
+            }
+            rs->off_ns = 0;
+            rs->on_ns = now;
+        }
+    }
 
+    if (c.flags & CFG_F_LIFE) {
+        if (prev_pid)
+            life_add(BPF_CORE_READ(prev, tgid), run_ns, 0, 0, 1);
+        if (next_pid)
+            life_add(BPF_CORE_READ(next, tgid), 0, wait_ns, 0, 1);
+    }
     if (prev_pid) {
         ap = agg_touch(prev_pid);
         if (ap) {
             ap->total_run_ns += run_ns;
             ap->switches++;
+            if ((c.flags & CFG_F_TOPO) && run_ns)
+                home_account(ap, prev, cpu, run_ns);
         }
     }
     if (next_pid) {
@@ -207,9 +1390,21 @@ int BPF_PROG(on_switch_btf, bool preempt, struct task_struct *prev,
         if (an) {
             an->total_wait_ns += wait_ns;
             an->switches++;
+            if (over)
+                an->waitlongs++;
+            if (c.flags & CFG_F_CGID)
+                an->cgid = task_cgid(next);
+            if (c.flags & CFG_F_CLASS) {
+                an->policy = next_policy;
+                an->prio   = next_prio;
+                an->weight = BPF_CORE_READ(next, se.load.weight);
+            }
         }
     }
 
+    if (c.flags & CFG_F_NO_EVENTS)
+        return 0;
+
     e = bpf_ringbuf_reserve(&rb, sizeof(*e), 0);
     if (e) {
         e->ts_ns = now;
@@ -223,27 +1418,64 @@ int BPF_PROG(on_switch_btf, bool preempt, struct task_struct *prev,
         bpf_core_read_str(e->u.sw.next_comm, sizeof(e->u.sw.next_comm), &next->comm);
         e->u.sw.run_ns   = run_ns;
         e->u.sw.wait_ns  = wait_ns;
-        e->u.sw.prev_cpu = 0;
-        e->u.sw.next_cpu = 0;
+        e->u.sw.prev_cpu = cpu;
+        e->u.sw.next_cpu = cpu;
 
         bpf_ringbuf_submit(e, 0);
     }
 
-    if (next_pid) {
-        if (cfg_load(&c) == 0 && c.wait_alert_ns && wait_ns >= c.wait_alert_ns) {
-            struct event *wE = bpf_ringbuf_reserve(&rb, sizeof(*wE), 0);
-            if (wE) {
-                wE->ts_ns = now;
-                wE->type  = EV_WAITLONG;
-                wE->pid   = next_pid;
-                bpf_core_read_str(wE->comm, sizeof(wE->comm), &next->comm);
-                bpf_ringbuf_submit(wE, 0);
-            }
+    if (over) {
+        struct event *wE = bpf_ringbuf_reserve(&rb, sizeof(*wE), 0);
+        if (wE) {
+            wE->ts_ns = now;
+            wE->type  = EV_WAITLONG;
+            wE->pid   = next_pid;
+            bpf_core_read_str(wE->comm, sizeof(wE->comm), &next->comm);
+            wE->u.wl.wait_ns      = wait_ns;
+            wE->u.wl.threshold_ns = thr;
+            wE->u.wl.rule_kind    = kind;
+            wE->u.wl.rule_id      = rule_id;
+            wE->u.wl.kstack       = vk;
+            wE->u.wl.ustack       = vu;
+            wE->u.wl.run_kstack   = off_now.kstack;
+            wE->u.wl.run_ustack   = off_now.ustack;
+            wE->u.wl.stack_gen    = c.stack_gen;
+            wE->u.wl.run_pid      = prev_pid;
+            bpf_core_read_str(wE->u.wl.run_comm, sizeof(wE->u.wl.run_comm), &prev->comm);
+            bpf_ringbuf_submit(wE, 0);
         }
     }
     return 0;
 }
 
+/* TP_PROTO(struct task_struct *p, int dest_cpu); p is still on its old CPU */
+SEC("tp_btf/sched_migrate_task")
+int BPF_PROG(on_migrate_btf, struct task_struct *p, int dest_cpu)
+{
+    __u32 dest = dest_cpu, cls;
+    __s32 orig;
+    struct cpu_dom *dom;
+    struct cfg c;
+
+    if (cfg_load(&c) || !(c.flags & CFG_F_TOPO))
+        return 0;
+    if (c.sample_filter_pid && c.sample_filter_pid != BPF_CORE_READ(p, pid))
+        return 0;
+    orig = task_cpu_of(p);
+    if (orig == dest_cpu || !(dom = bpf_map_lookup_elem(&cpu_dom, &dest)))
+        return 0;
+
+    cls = wake_class(orig, dest_cpu);
+    if (cls == WAKE_UNKNOWN)
+        return 0;
+    __sync_fetch_and_add(&dom->mig_in, 1);
+    if (cls == WAKE_XLLC)
+        __sync_fetch_and_add(&dom->mig_xllc, 1);
+    else if (cls == WAKE_XNODE)
+        __sync_fetch_and_add(&dom->mig_xnode, 1);
+    return 0;
+}
+
 SEC("tp_btf/sched_process_exec")
 int BPF_PROG(on_exec_btf, struct task_struct *p, pid_t old_pid, struct linux_binprm *bprm)
 {
@@ -263,7 +1495,13 @@ int BPF_PROG(on_exec_btf, struct task_struct *p, pid_t old_pid, struct linux_bin
     a = agg_touch(pid);
     if (a && a->exec_ts_ns == 0)
         a->exec_ts_ns = now;
+    if (a && a->start_ns == 0) {
+        a->start_ns = now;
+        a->origin   = LIFE_EXEC;
+    }
 
+    if (!want_events())
+        return 0;
     e = bpf_ringbuf_reserve(&rb, sizeof(*e), 0);
     if (!e)
         return 0;
@@ -277,32 +1515,131 @@ int BPF_PROG(on_exec_btf, struct task_struct *p, pid_t old_pid, struct linux_bin
     return 0;
 }
 
+SEC("tp_btf/sched_process_fork")
+int BPF_PROG(on_fork_btf, struct task_struct *parent, struct task_struct *child)
+{
+    __u64 now;
+    __u32 ppid, pid;
+    struct agg fresh = {};
+    struct event *e;
+    struct cfg c;
+
+    if (cfg_load(&c))
+        return 0;
+
+    pid  = BPF_CORE_READ(child, pid);
+    ppid = BPF_CORE_READ(parent, tgid);
+    if (pid != BPF_CORE_READ(child, tgid))
+        return 0;   /* new thread, not a new process */
+    if (c.sample_filter_pid && c.sample_filter_pid != pid && c.sample_filter_pid != ppid)
+        return 0;
+
+    now = bpf_ktime_get_ns();
+    fresh.start_ns = now;
+    fresh.origin   = LIFE_FORK;
+    fresh.ppid     = ppid;
+    bpf_map_update_elem(&agg_by_pid, &pid, &fresh, BPF_ANY);
+
+    if (c.flags & CFG_F_NO_EVENTS)
+        return 0;
+    e = bpf_ringbuf_reserve(&rb, sizeof(*e), 0);
+    if (!e)
+        return 0;
+    e->ts_ns = now;
+    e->type  = EV_FORK;
+    e->pid   = pid;
+    bpf_core_read_str(e->comm, sizeof(e->comm), &child->comm);
+    e->u.fork.parent_pid = ppid;
+    e->u.fork.child_pid  = pid;
+    bpf_ringbuf_submit(e, 0);
+    return 0;
+}
+
+/* Fold an exiting process into life_hist and emit its EV_LIFE record. */
+static __always_inline void life_record(const struct cfg *c, __u32 pid, __u64 now)
+{
+    struct agg *a = bpf_map_lookup_elem(&agg_by_pid, &pid);
+    struct life_tot *t = bpf_map_lookup_elem(&life_by_tgid, &pid);
+    struct life_tot tot = {};
+    struct life_hist *h;
+    struct event *e;
+    __u64 life = 0;
+    __u32 k;
+
+    if (t) {
+        tot = *t;
+        bpf_map_delete_elem(&life_by_tgid, &pid);
+    }
+    if (!a)
+        return;
+    if (a->start_ns && now > a->start_ns) {
+        life = now - a->start_ns;
+        k = life >= c->life_cutoff_ns;
+        h = bpf_map_lookup_elem(&life_hist, &k);
+        if (h) {
+            __sync_fetch_and_add(&h->count, 1);
+            __sync_fetch_and_add(&h->sum_ns, life);
+            __sync_fetch_and_add(&h->slots[life_bucket(life)], 1);
+        }
+    }
+
+    e = bpf_ringbuf_reserve(&rb, sizeof(*e), 0);
+    if (!e)
+        return;
+    e->ts_ns = now;
+    e->type  = EV_LIFE;
+    e->pid   = pid;
+    bpf_get_current_comm(e->comm, sizeof(e->comm));
+    e->u.life.lifetime_ns = life;
+    e->u.life.run_ns      = tot.run_ns;
+    e->u.life.wait_ns     = tot.wait_ns;
+    e->u.life.wakes       = tot.wakes;
+    e->u.life.switches    = tot.switches;
+    e->u.life.origin      = life ? a->origin : LIFE_UNKNOWN;
+    e->u.life.ppid        = a->ppid;
+    bpf_ringbuf_submit(e, 0);
+}
+
 SEC("tp_btf/sched_process_exit")
 int BPF_PROG(on_exit_btf, struct task_struct *p)
 {
-    __u64 id;
+    __u64 id, now;
     __u32 pid, tid;
     struct event *e;
+    struct cfg c;
 
     (void)p;
 
+    if (cfg_load(&c))
+        return 0;
+
     id  = bpf_get_current_pid_tgid();
     pid = id >> 32;
     tid = (__u32)id;
 
+    /* per-thread state is keyed by tid, so every exiting thread drops
+     * its own; the rest is per process */
+    bpf_map_delete_elem(&wake_ts, &tid);
+    bpf_map_delete_elem(&off_start, &tid);
+    bpf_map_delete_elem(&wake_from, &tid);
+
     if (pid != tid)
         return 0;
-    if (!pass_filter(pid))
+    if (c.sample_filter_pid && c.sample_filter_pid != pid)
         return 0;
 
-    bpf_map_delete_elem(&wake_ts, &pid);
-    bpf_map_delete_elem(&oncpu_ts, &pid);
+    now = bpf_ktime_get_ns();
+
+    if (c.flags & CFG_F_LIFE)
+        life_record(&c, pid, now);
 
+    if (c.flags & CFG_F_NO_EVENTS)
+        return 0;
     e = bpf_ringbuf_reserve(&rb, sizeof(*e), 0);
     if (!e)
         return 0;
 
-    e->ts_ns = bpf_ktime_get_ns();
+    e->ts_ns = now;
     e->type  = EV_EXIT;
     e->pid   = pid;
     bpf_get_current_comm(e->comm, sizeof(e->comm));
@@ -310,3 +1647,92 @@ int BPF_PROG(on_exit_btf, struct task_struct *p)
     bpf_ringbuf_submit(e, 0);
     return 0;
 }
+
+/* Phase markers: user space attaches this to schedlab_mark() in
+ * libschedmark.so (--mark-lib), so there is no auto-attach target here.
+ * Marks are emitted even with CFG_F_NO_EVENTS; aggregate-only modes split
+ * their reports on them too. */
+SEC("uprobe")
+int BPF_KPROBE(on_mark, const char *name)
+{
+    struct event *e;
+
+    e = bpf_ringbuf_reserve(&rb, sizeof(*e), 0);
+    if (!e)
+        return 0;
+
+    e->ts_ns = bpf_ktime_get_ns();
+    e->type  = EV_MARK;
+    e->pid   = bpf_get_current_pid_tgid() >> 32;
+    bpf_get_current_comm(e->comm, sizeof(e->comm));
+    if (bpf_probe_read_user_str(e->u.mark.name, sizeof(e->u.mark.name), name) < 0)
+        e->u.mark.name[0] = '\0';
+
+    bpf_ringbuf_submit(e, 0);
+    return 0;
+}
+
+/* Request begin/end: user space attaches these to the --uprobe-begin and
+ * --uprobe-end symbols. Both fire on the thread doing the work, which is
+ * on-CPU at that moment. */
+SEC("uprobe")
+int BPF_KPROBE(on_req_begin)
+{
+    struct req_state rs = {};
+    __u32 tid = (__u32)bpf_get_current_pid_tgid();
+
+    if (!pass_filter(tid))
+        return 0;
+    rs.start_ns = rs.on_ns = bpf_ktime_get_ns();
+    bpf_map_update_elem(&req_by_tid, &tid, &rs, BPF_ANY);
+    return 0;
+}
+
+static __always_inline void req_hist_add(__u32 kind, __u64 ns)
+{
+    struct lat_hist *h = bpf_map_lookup_elem(&req_hist, &kind);
+    if (h)
+        hist_add(h, ns);
+}
+
+SEC("uprobe")
+int BPF_KPROBE(on_req_end)
+{
+    __u32 tid = (__u32)bpf_get_current_pid_tgid();
+    struct req_state *rs, r;
+    struct event *e;
+    struct cfg c;
+    __u64 now;
+
+    rs = bpf_map_lookup_elem(&req_by_tid, &tid);
+    if (!rs)
+        return 0;
+    now = bpf_ktime_get_ns();
+    r = *rs;
+    bpf_map_delete_elem(&req_by_tid, &tid);
+    if (r.on_ns)
+        r.run_ns += now - r.on_ns;
+
+    req_hist_add(REQ_H_LATENCY, now - r.start_ns);
+    req_hist_add(REQ_H_WAIT, r.wait_ns);
+    req_hist_add(REQ_H_RUN, r.run_ns);
+    req_hist_add(REQ_H_OFFCPU, r.offcpu_ns);
+
+    if (cfg_load(&c) || (c.flags & CFG_F_NO_EVENTS))
+        return 0;
+    e = bpf_ringbuf_reserve(&rb, sizeof(*e), 0);
+    if (!e)
+        return 0;
+    e->ts_ns = now;
+    e->type  = EV_REQ;
+    e->pid   = tid;
+    bpf_get_current_comm(e->comm, sizeof(e->comm));
+    e->u.req.latency_ns = now - r.start_ns;
+    e->u.req.run_ns     = r.run_ns;
+    e->u.req.wait_ns    = r.wait_ns;
+    e->u.req.off_ns     = r.offcpu_ns;
+    e->u.req.switches   = r.switches;
+    e->u.req._pad       = 0;
+    bpf_ringbuf_submit(e, 0);
+    return 0;
+}
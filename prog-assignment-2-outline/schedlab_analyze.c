@@ -0,0 +1,1055 @@
+// schedlab/schedlab_analyze.c
+// SPDX-License-Identifier: MIT
+//
+// `schedlab analyze FILE`: offline summaries of the CSVs schedlab writes,
+// the same tables TaskTwo.py .. TaskSeven.py produce, without pandas.
+// The file is mmap'ed and split at line boundaries into one chunk per
+// thread; each thread builds a partial summary that is merged at the end.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <math.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "schedlab_analyze.h"
+#include "schedlab_capture.h"
+
+static const char *fmt_names[] = {
+    "unknown", "latency", "fairness", "ctx", "timeline", "shortlong", "starvation",
+    "capture"
+};
+
+const char *csv_fmt_name(enum csv_fmt f) {
+    return (unsigned)f < sizeof(fmt_names)/sizeof(fmt_names[0]) ? fmt_names[f] : "unknown";
+}
+
+/* ---- Histogram --------------------------------------------------------- */
+static unsigned hist_index(uint64_t v) {
+    if (v < 2 * HIST_SUB) return (unsigned)v;
+    unsigned e = 63 - __builtin_clzll(v);          /* >= HIST_SUB_BITS + 1 */
+    unsigned shift = e - HIST_SUB_BITS;
+    return (shift + 1) * HIST_SUB + (unsigned)((v >> shift) - HIST_SUB);
+}
+
+uint64_t hist_value(unsigned idx) {
+    if (idx < 2 * HIST_SUB) return idx;
+    unsigned shift = idx / HIST_SUB - 1;
+    uint64_t lo = (uint64_t)(idx % HIST_SUB + HIST_SUB) << shift;
+    return lo + ((1ULL << shift) >> 1);              /* bucket midpoint */
+}
+
+void hist_add(struct hist *h, uint64_t v) {
+    if (!h->count || v < h->min) h->min = v;
+    if (v > h->max) h->max = v;
+    h->count++;
+    h->sum += v;
+    h->b[hist_index(v)]++;
+}
+
+void hist_merge(struct hist *d, const struct hist *s) {
+    if (!s->count) return;
+    if (!d->count || s->min < d->min) d->min = s->min;
+    if (s->max > d->max) d->max = s->max;
+    d->count += s->count;
+    d->sum   += s->sum;
+    for (unsigned i = 0; i < HIST_NBUCKETS; i++) d->b[i] += s->b[i];
+}
+
+uint64_t hist_quantile(const struct hist *h, double q) {
+    if (!h->count) return 0;
+    uint64_t rank = (uint64_t)(q * (double)(h->count - 1)) + 1, cum = 0;
+    for (unsigned i = 0; i < HIST_NBUCKETS; i++) {
+        cum += h->b[i];
+        if (cum >= rank) {
+            uint64_t v = hist_value(i);
+            return v < h->min ? h->min : v > h->max ? h->max : v;
+        }
+    }
+    return h->max;
+}
+
+/* ---- u64map ------------------------------------------------------------ */
+int u64map_init(struct u64map *m, size_t vsz) {
+    m->vsz = vsz;
+    m->cap = 1024;
+    m->n   = 0;
+    m->keys = calloc(m->cap, sizeof(*m->keys));
+    m->vals = calloc(m->cap, vsz);
+    return (m->keys && m->vals) ? 0 : -1;
+}
+
+void u64map_free(struct u64map *m) {
+    free(m->keys);
+    free(m->vals);
+    memset(m, 0, sizeof(*m));
+}
+
+static size_t u64map_slot(const struct u64map *m, uint64_t key) {
+    uint64_t h = (key + 1) * 0x9E3779B97F4A7C15ULL;
+    size_t i = (size_t)(h >> 20) & (m->cap - 1);
+    while (m->keys[i] && m->keys[i] != key + 1)
+        i = (i + 1) & (m->cap - 1);
+    return i;
+}
+
+static int u64map_grow(struct u64map *m) {
+    struct u64map n = { .vsz = m->vsz, .cap = m->cap * 2 };
+    n.keys = calloc(n.cap, sizeof(*n.keys));
+    n.vals = calloc(n.cap, n.vsz);
+    if (!n.keys || !n.vals) { free(n.keys); free(n.vals); return -1; }
+    for (size_t i = 0; i < m->cap; i++) {
+        if (!m->keys[i]) continue;
+        size_t j = u64map_slot(&n, m->keys[i] - 1);
+        n.keys[j] = m->keys[i];
+        memcpy(n.vals + j * n.vsz, m->vals + i * m->vsz, m->vsz);
+    }
+    n.n = m->n;
+    free(m->keys);
+    free(m->vals);
+    *m = n;
+    return 0;
+}
+
+void *u64map_find(const struct u64map *m, uint64_t key) {
+    size_t i = u64map_slot(m, key);
+    return m->keys[i] ? m->vals + i * m->vsz : NULL;
+}
+
+void *u64map_get(struct u64map *m, uint64_t key) {
+    if ((m->n + 1) * 4 > m->cap * 3 && u64map_grow(m)) return NULL;
+    size_t i = u64map_slot(m, key);
+    if (!m->keys[i]) {
+        m->keys[i] = key + 1;
+        m->n++;
+    }
+    return m->vals + i * m->vsz;
+}
+
+/* ---- Summary ----------------------------------------------------------- */
+int summary_init(struct summary *s) {
+    memset(s, 0, sizeof(*s));
+    if (u64map_init(&s->pids, sizeof(struct pid_stat))) return -1;
+    if (u64map_init(&s->secs, sizeof(uint64_t))) { u64map_free(&s->pids); return -1; }
+    return 0;
+}
+
+void summary_free(struct summary *s) {
+    u64map_free(&s->pids);
+    u64map_free(&s->secs);
+}
+
+double summary_span_s(const struct summary *s) {
+    return s->ts_max > s->ts_min ? (s->ts_max - s->ts_min) / 1e9 : 0.0;
+}
+
+static void summary_merge(struct summary *d, const struct summary *s) {
+    d->rows     += s->rows;
+    d->bad_rows += s->bad_rows;
+    if (s->ts_max) {
+        if (!d->ts_max || s->ts_min < d->ts_min) d->ts_min = s->ts_min;
+        if (s->ts_max > d->ts_max) d->ts_max = s->ts_max;
+    }
+    hist_merge(&d->lat, &s->lat);
+    hist_merge(&d->run, &s->run);
+    for (size_t i = 0; i < s->pids.cap; i++) {
+        if (!s->pids.keys[i]) continue;
+        const struct pid_stat *a = (const void *)(s->pids.vals + i * s->pids.vsz);
+        struct pid_stat *b = u64map_get(&d->pids, s->pids.keys[i] - 1);
+        if (!b) continue;
+        /* fairness rows are running totals: keep the largest */
+        if (a->run_ms  > b->run_ms)  b->run_ms  = a->run_ms;
+        if (a->wait_ms > b->wait_ms) b->wait_ms = a->wait_ms;
+        if (d->fmt == FMT_FAIRNESS) { if (a->switches > b->switches) b->switches = a->switches; }
+        else                        b->switches += a->switches;
+        b->wakes  += a->wakes;
+        b->alerts += a->alerts;
+        b->lat_n  += a->lat_n;  b->lat_ns += a->lat_ns;
+        b->run_n  += a->run_n;  b->run_ns += a->run_ns;
+        b->run_sq += a->run_sq;
+    }
+    for (size_t i = 0; i < s->secs.cap; i++) {
+        if (!s->secs.keys[i]) continue;
+        uint64_t *c = u64map_get(&d->secs, s->secs.keys[i] - 1);
+        if (c) *c += *(const uint64_t *)(s->secs.vals + i * s->secs.vsz);
+    }
+    for (int g = 0; g < 2; g++) {
+        d->life[g].n        += s->life[g].n;
+        d->life[g].wakes    += s->life[g].wakes;
+        d->life[g].switches += s->life[g].switches;
+        d->life[g].life_ms  += s->life[g].life_ms;
+        d->life[g].switches_sq += s->life[g].switches_sq;
+        d->life[g].life_sq     += s->life[g].life_sq;
+    }
+    for (int i = 0; i < 8; i++) d->ev[i] += s->ev[i];
+}
+
+/* ---- Field parsing ------------------------------------------------------
+ * Cursor-based; each parser consumes one field and its trailing comma.
+ * Empty fields parse as 0 and return 1 so callers can tell them apart.
+ */
+struct cur { const char *p, *end; };
+
+static int f_u64(struct cur *c, uint64_t *v) {
+    uint64_t x = 0;
+    const char *s = c->p;
+    while (c->p < c->end && (unsigned)(*c->p - '0') < 10)
+        x = x * 10 + (uint64_t)(*c->p++ - '0');
+    int empty = c->p == s;
+    if (c->p < c->end && *c->p != ',' && *c->p != '\n' && *c->p != '\r') return -1;
+    if (c->p < c->end && *c->p == ',') c->p++;
+    *v = x;
+    return empty;
+}
+
+static int f_double(struct cur *c, double *v) {
+    uint64_t ip = 0, fp = 0, scale = 1;
+    const char *s = c->p;
+    int neg = 0;
+    if (c->p < c->end && *c->p == '-') { neg = 1; c->p++; }
+    while (c->p < c->end && (unsigned)(*c->p - '0') < 10)
+        ip = ip * 10 + (uint64_t)(*c->p++ - '0');
+    if (c->p < c->end && *c->p == '.') {
+        c->p++;
+        while (c->p < c->end && (unsigned)(*c->p - '0') < 10) {
+            if (scale < 1000000000000ULL) { fp = fp * 10 + (uint64_t)(*c->p - '0'); scale *= 10; }
+            c->p++;
+        }
+    }
+    int empty = c->p == s;
+    if (c->p < c->end && *c->p != ',' && *c->p != '\n' && *c->p != '\r') return -1;
+    if (c->p < c->end && *c->p == ',') c->p++;
+    *v = (neg ? -1.0 : 1.0) * ((double)ip + (double)fp / (double)scale);
+    return empty;
+}
+
+static const char *f_str(struct cur *c, size_t *len) {
+    const char *s = c->p;
+    while (c->p < c->end && *c->p != ',' && *c->p != '\n' && *c->p != '\r') c->p++;
+    *len = (size_t)(c->p - s);
+    if (c->p < c->end && *c->p == ',') c->p++;
+    return s;
+}
+
+static void note_ts(struct summary *s, uint64_t ts) {
+    if (!s->ts_max || ts < s->ts_min) s->ts_min = ts;
+    if (ts > s->ts_max) s->ts_max = ts;
+    uint64_t *c = u64map_get(&s->secs, ts / 1000000000ULL);
+    if (c) (*c)++;
+}
+
+static int parse_row(struct summary *s, struct cur *c, double short_ms) {
+    uint64_t ts, pid, a, b;
+    double   d1, d2;
+    struct pid_stat *ps;
+    size_t len;
+    const char *str;
+
+    switch (s->fmt) {
+    case FMT_LATENCY:
+        if (f_u64(c, &ts) || f_u64(c, &pid) || f_u64(c, &a)) return -1;
+        note_ts(s, ts);
+        hist_add(&s->lat, a);
+        if ((ps = u64map_get(&s->pids, pid))) { ps->lat_n++; ps->lat_ns += a; }
+        return 0;
+
+    case FMT_FAIRNESS:
+        if (f_u64(c, &pid) || f_double(c, &d1) || f_double(c, &d2) || f_u64(c, &a)) return -1;
+        if ((ps = u64map_get(&s->pids, pid))) {
+            if (d1 > ps->run_ms)  ps->run_ms  = d1;
+            if (d2 > ps->wait_ms) ps->wait_ms = d2;
+            if (a > ps->switches) ps->switches = a;
+        }
+        return 0;
+
+    case FMT_CTX:
+        if (f_u64(c, &ts) || f_u64(c, &pid) || f_u64(c, &b) || f_u64(c, &a)) return -1;
+        note_ts(s, ts);
+        hist_add(&s->run, a);
+        if ((ps = u64map_get(&s->pids, pid))) { ps->run_n++; ps->run_ns += a; ps->run_sq += (double)a * a; }
+        if ((ps = u64map_get(&s->pids, b)))   ps->switches++;
+        return 0;
+
+    case FMT_TIMELINE: {
+        if (f_u64(c, &ts) || f_u64(c, &pid)) return -1;
+        str = f_str(c, &len);
+        int ew = f_u64(c, &a), er = f_u64(c, &b);
+        if (ew < 0 || er < 0) return -1;
+        note_ts(s, ts);
+        if (!(ps = u64map_get(&s->pids, pid))) return -1;
+        if (len == 4 && !memcmp(str, "WAKE", 4))        { s->ev[0]++; ps->wakes++; }
+        else if (len == 6 && !memcmp(str, "SWITCH", 6)) {
+            s->ev[1]++;
+            ps->switches++;
+            if (a) { hist_add(&s->lat, a); ps->lat_n++; ps->lat_ns += a; }
+            if (b) hist_add(&s->run, b);
+        }
+        else if (len == 4 && !memcmp(str, "EXEC", 4))   s->ev[2]++;
+        else if (len == 4 && !memcmp(str, "EXIT", 4))   s->ev[3]++;
+        else if (len == 4 && !memcmp(str, "FORK", 4))   s->ev[4]++;
+        else if (len == 4 && !memcmp(str, "MARK", 4))   ;   /* phase marker */
+        else if (len == 3 && !memcmp(str, "REQ", 3))    ;   /* per-request totals */
+        else return -1;
+        return 0;
+    }
+
+    case FMT_SHORTLONG: {
+        if (f_u64(c, &pid) || f_double(c, &d1) || f_u64(c, &a) || f_u64(c, &b)) return -1;
+        struct life_group *g = &s->life[d1 >= short_ms];
+        g->n++;
+        g->wakes += (double)a;
+        g->switches += (double)b;
+        g->life_ms += d1;
+        g->switches_sq += (double)b * b;
+        g->life_sq += d1 * d1;
+        return 0;
+    }
+
+    case FMT_STARVATION:
+        if (f_u64(c, &ts) || f_u64(c, &pid)) return -1;
+        f_str(c, &len);
+        note_ts(s, ts);
+        if ((ps = u64map_get(&s->pids, pid))) ps->alerts++;
+        if (f_u64(c, &a) == 0) hist_add(&s->lat, a);   /* wait_ns, newer files only */
+        return 0;
+
+    default:
+        return -1;
+    }
+}
+
+static enum csv_fmt detect_fmt(const char *hdr, size_t len) {
+    static const struct { const char *h; enum csv_fmt f; int prefix; } tab[] = {
+        { "ts_ns,pid,latency_ns",               FMT_LATENCY,    0 },
+        { "pid,run_ms,wait_ms,switches",        FMT_FAIRNESS,   0 },
+        { "ts_ns,prev_pid,next_pid,run_ns",     FMT_CTX,        0 },
+        { "ts_ns,pid,event,wait_ns,run_prev_ns", FMT_TIMELINE,  0 },
+        { "pid,lifetime_ms,wakes,switches",     FMT_SHORTLONG,  1 },
+        { "ts_ns,pid,event",                    FMT_STARVATION, 1 },
+    };
+    while (len && (hdr[len-1] == '\r' || hdr[len-1] == '\n')) len--;
+    for (size_t i = 0; i < sizeof(tab)/sizeof(tab[0]); i++) {
+        size_t hl = strlen(tab[i].h);
+        if (len == hl && !memcmp(hdr, tab[i].h, hl)) return tab[i].f;
+        if (tab[i].prefix && len > hl && hdr[hl] == ',' && !memcmp(hdr, tab[i].h, hl))
+            return tab[i].f;
+    }
+    return FMT_UNKNOWN;
+}
+
+/* ---- Parallel chunk parsing -------------------------------------------- */
+struct chunk {
+    const char     *begin, *end;
+    const struct cap_file *cf;     /* capture input: blocks [b0, b1) */
+    uint64_t        b0, b1;
+    struct cap_buf *buf;
+    double          short_ms;
+    struct summary  s;
+    int             err;
+};
+
+/* Capture rows map onto the timeline summary, plus run time per prev pid. */
+static void cap_chunk_run(struct chunk *ch) {
+    struct summary *s = &ch->s;
+    struct cap_cols c;
+
+    for (uint64_t bi = ch->b0; bi < ch->b1; bi++) {
+        if (cap_block(ch->cf, bi, &c, ch->buf)) { s->bad_rows += ch->cf->dir[bi].nrows; continue; }
+        for (uint32_t i = 0; i < c.n; i++) {
+            struct pid_stat *ps = u64map_get(&s->pids, c.pid[i]);
+            note_ts(s, c.ts[i]);
+            s->rows++;
+            if (!ps) continue;
+            switch (c.type[i]) {
+            case 1: s->ev[0]++; ps->wakes++; break;     /* EV_WAKE */
+            case 2:                                     /* EV_SWITCH */
+                s->ev[1]++;
+                ps->switches++;
+                if (c.wait[i]) { hist_add(&s->lat, c.wait[i]); ps->lat_n++; ps->lat_ns += c.wait[i]; }
+                if (c.run[i]) {
+                    hist_add(&s->run, c.run[i]);
+                    if ((ps = u64map_get(&s->pids, c.aux[i]))) {
+                        ps->run_n++;
+                        ps->run_ns += c.run[i];
+                        ps->run_sq += (double)c.run[i] * c.run[i];
+                    }
+                }
+                break;
+            case 3: s->ev[2]++; break;
+            case 4: s->ev[3]++; break;
+            case 5: s->ev[4]++; break;
+            case 6: s->ev[5]++; ps->alerts++; break;
+            default: break;
+            }
+        }
+    }
+}
+
+static void *chunk_run(void *arg) {
+    struct chunk *ch = arg;
+    struct cur c = { ch->begin, ch->end };
+
+    if (ch->cf) { cap_chunk_run(ch); return NULL; }
+
+    while (c.p < c.end) {
+        const char *nl = memchr(c.p, '\n', (size_t)(c.end - c.p));
+        const char *eol = nl ? nl : c.end;
+        struct cur line = { c.p, eol };
+        if (line.p < line.end && line.end[-1] == '\r') line.end--;
+        if (line.p < line.end) {
+            if (parse_row(&ch->s, &line, ch->short_ms) == 0) ch->s.rows++;
+            else                                              ch->s.bad_rows++;
+        }
+        c.p = nl ? nl + 1 : c.end;
+    }
+    return NULL;
+}
+
+#define MIN_CHUNK (4u << 20)   /* don't bother threading below 4MB per chunk */
+
+static int want_threads(const struct analyze_opts *o, size_t units, size_t min_units) {
+    int nt = o->threads > 0 ? o->threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (nt < 1) nt = 1;
+    if ((size_t)nt > units / min_units + 1) nt = (int)(units / min_units + 1);
+    return nt;
+}
+
+/* Run chunks 1..nt-1 on threads and chunk 0 here, then merge in order. */
+static void run_chunks(struct chunk *ch, pthread_t *tid, int nt, struct summary *out) {
+    for (int i = 1; i < nt; i++)
+        if (pthread_create(&tid[i], NULL, chunk_run, &ch[i])) { ch[i].err = 1; chunk_run(&ch[i]); }
+    chunk_run(&ch[0]);
+    for (int i = 1; i < nt; i++)
+        if (!ch[i].err) pthread_join(tid[i], NULL);
+    for (int i = 0; i < nt; i++)
+        summary_merge(out, &ch[i].s);
+}
+
+static int analyze_capture(const char *path, const struct analyze_opts *o, struct summary *out) {
+    struct cap_file cf;
+    struct chunk *ch = NULL;
+    pthread_t *tid = NULL;
+    int nt = 0, ret = -1;
+
+    if (summary_init(out)) return -1;
+    out->fmt = FMT_CAPTURE;
+    if (cap_map(path, &cf)) return -1;
+    madvise((void *)cf.base, cf.size, MADV_SEQUENTIAL);
+
+    nt  = want_threads(o, cf.nblocks, 64);
+    ch  = calloc((size_t)nt, sizeof(*ch));
+    tid = calloc((size_t)nt, sizeof(*tid));
+    if (!ch || !tid) goto out;
+    for (int i = 0; i < nt; i++) {
+        ch[i].cf = &cf;
+        ch[i].b0 = cf.nblocks * (uint64_t)i / (uint64_t)nt;
+        ch[i].b1 = cf.nblocks * (uint64_t)(i + 1) / (uint64_t)nt;
+        if ((cf.flags & CAP_F_DELTA) && !(ch[i].buf = calloc(1, sizeof(*ch[i].buf)))) goto out;
+        if (summary_init(&ch[i].s)) goto out;
+        ch[i].s.fmt = out->fmt;
+    }
+    run_chunks(ch, tid, nt, out);
+    ret = 0;
+out:
+    if (ch) for (int i = 0; i < nt; i++) { summary_free(&ch[i].s); cap_buf_free(ch[i].buf); }
+    free(ch);
+    free(tid);
+    cap_unmap(&cf);
+    return ret;
+}
+
+int analyze_file(const char *path, const struct analyze_opts *o, struct summary *out) {
+    if (cap_is_capture(path))
+        return analyze_capture(path, o, out);
+
+    int fd = open(path, O_RDONLY), ret = -1;
+    struct stat st;
+    const char *base = MAP_FAILED;
+    struct chunk *ch = NULL;
+    pthread_t *tid = NULL;
+    int nt = 0;
+
+    if (summary_init(out)) { if (fd >= 0) close(fd); return -1; }
+    if (fd < 0 || fstat(fd, &st)) { perror(path); goto out; }
+    if (st.st_size == 0) { fprintf(stderr, "%s: empty file\n", path); goto out; }
+
+    base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (base == MAP_FAILED) { perror("mmap"); goto out; }
+    madvise((void *)base, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+    const char *end = base + st.st_size;
+    const char *nl = memchr(base, '\n', (size_t)st.st_size);
+    const char *body = nl ? nl + 1 : end;
+    out->fmt = detect_fmt(base, (size_t)((nl ? nl : end) - base));
+    if (out->fmt == FMT_UNKNOWN) {
+        fprintf(stderr, "%s: unrecognised header (not a schedlab CSV?)\n", path);
+        goto out;
+    }
+
+    size_t body_len = (size_t)(end - body);
+    nt = want_threads(o, body_len, MIN_CHUNK);
+
+    ch  = calloc((size_t)nt, sizeof(*ch));
+    tid = calloc((size_t)nt, sizeof(*tid));
+    if (!ch || !tid) goto out;
+
+    /* cut at line boundaries */
+    const char *p = body;
+    for (int i = 0; i < nt; i++) {
+        const char *e = i == nt - 1 ? end : body + body_len * (size_t)(i + 1) / (size_t)nt;
+        if (e < p) e = p;
+        if (e < end) {
+            const char *n = memchr(e, '\n', (size_t)(end - e));
+            e = n ? n + 1 : end;
+        }
+        ch[i].begin = p;
+        ch[i].end = e;
+        ch[i].short_ms = o->short_ms;
+        if (summary_init(&ch[i].s)) goto out;
+        ch[i].s.fmt = out->fmt;
+        p = e;
+    }
+
+    run_chunks(ch, tid, nt, out);
+    ret = 0;
+
+out:
+    if (ch) for (int i = 0; i < nt; i++) summary_free(&ch[i].s);
+    free(ch);
+    free(tid);
+    if (base != MAP_FAILED) munmap((void *)base, (size_t)st.st_size);
+    if (fd >= 0) close(fd);
+    return ret;
+}
+
+/* ---- Report ------------------------------------------------------------ */
+struct pid_row { uint64_t pid; const struct pid_stat *st; double key, key2; };
+
+static int cmp_pid_row(const void *a, const void *b) {
+    const struct pid_row *x = a, *y = b;
+    if (x->key != y->key) return x->key < y->key ? 1 : -1;
+    if (x->key2 != y->key2) return x->key2 < y->key2 ? 1 : -1;
+    return (x->pid > y->pid) - (x->pid < y->pid);
+}
+
+/* Rank pids by a per-format key, descending. Caller frees. */
+static struct pid_row *rank_pids(const struct summary *s, size_t *n_out) {
+    struct pid_row *rows = calloc(s->pids.n ? s->pids.n : 1, sizeof(*rows));
+    size_t n = 0;
+    if (!rows) { *n_out = 0; return NULL; }
+    for (size_t i = 0; i < s->pids.cap; i++) {
+        if (!s->pids.keys[i]) continue;
+        const struct pid_stat *st = (const void *)(s->pids.vals + i * s->pids.vsz);
+        struct pid_row r = { .pid = s->pids.keys[i] - 1, .st = st };
+        switch (s->fmt) {
+        case FMT_FAIRNESS:   r.key = st->run_ms + st->wait_ms; r.key2 = (double)st->switches; break;
+        case FMT_CTX:
+        case FMT_CAPTURE:    r.key = (double)st->run_ns; r.key2 = (double)st->switches; break;
+        case FMT_TIMELINE:   r.key = (double)st->switches; r.key2 = (double)st->wakes; break;
+        case FMT_LATENCY:    r.key = st->lat_n ? (double)st->lat_ns / st->lat_n : 0; r.key2 = (double)st->lat_n; break;
+        case FMT_STARVATION: r.key = (double)st->alerts; break;
+        default: break;
+        }
+        rows[n++] = r;
+    }
+    qsort(rows, n, sizeof(*rows), cmp_pid_row);
+    *n_out = n;
+    return rows;
+}
+
+static void print_pcts(FILE *f, const char *name, const struct hist *h) {
+    if (!h->count) { fprintf(f, "%-12s (no samples)\n", name); return; }
+    fprintf(f, "%-12s n=%" PRIu64 " p50=%.6f p90=%.6f p99=%.6f max=%.6f mean=%.6f (ms)\n",
+        name, h->count,
+        hist_quantile(h, 0.50) / 1e6, hist_quantile(h, 0.90) / 1e6,
+        hist_quantile(h, 0.99) / 1e6, h->max / 1e6, (double)h->sum / h->count / 1e6);
+}
+
+static uint64_t peak_per_sec(const struct summary *s) {
+    uint64_t peak = 0;
+    for (size_t i = 0; i < s->secs.cap; i++)
+        if (s->secs.keys[i]) {
+            uint64_t c = *(const uint64_t *)(s->secs.vals + i * s->secs.vsz);
+            if (c > peak) peak = c;
+        }
+    return peak;
+}
+
+void summary_print(const struct summary *s, const struct analyze_opts *o, FILE *f) {
+    double span = summary_span_s(s);
+    size_t n = 0;
+    struct pid_row *rows;
+
+    fprintf(f, "format=%s rows=%" PRIu64 " bad_rows=%" PRIu64, csv_fmt_name(s->fmt), s->rows, s->bad_rows);
+    if (s->ts_max) fprintf(f, " span_s=%.3f", span);
+    fputc('\n', f);
+
+    switch (s->fmt) {
+    case FMT_LATENCY:
+        print_pcts(f, "latency", &s->lat);
+        break;
+
+    case FMT_CTX:
+        fprintf(f, "switches=%" PRIu64 " switches_per_sec=%.1f peak_per_sec=%" PRIu64 "\n",
+            s->rows, span > 0 ? s->rows / span : 0.0, peak_per_sec(s));
+        print_pcts(f, "run_slice", &s->run);
+        break;
+
+    case FMT_TIMELINE:
+    case FMT_CAPTURE:
+        fprintf(f, "events WAKE=%" PRIu64 " SWITCH=%" PRIu64 " EXEC=%" PRIu64 " EXIT=%" PRIu64
+            " FORK=%" PRIu64 " WAITLONG=%" PRIu64 " pids=%zu\n",
+            s->ev[0], s->ev[1], s->ev[2], s->ev[3], s->ev[4], s->ev[5], s->pids.n);
+        print_pcts(f, "wait", &s->lat);
+        print_pcts(f, "run_prev", &s->run);
+        break;
+
+    case FMT_SHORTLONG:
+        fprintf(f, "%-16s %8s %10s %13s %16s\n", "group", "count", "avg_wakes", "avg_switches", "avg_lifetime_ms");
+        for (int g = 0; g < 2; g++) {
+            const struct life_group *lg = &s->life[g];
+            char name[32];
+            snprintf(name, sizeof(name), g ? "long (>=%gms)" : "short (<%gms)", o->short_ms);
+            if (lg->n)
+                fprintf(f, "%-16s %8" PRIu64 " %10.2f %13.2f %16.3f\n", name, lg->n,
+                    lg->wakes / lg->n, lg->switches / lg->n, lg->life_ms / lg->n);
+            else
+                fprintf(f, "%-16s %8d %10s %13s %16s\n", name, 0, "-", "-", "-");
+        }
+        return;
+
+    case FMT_STARVATION:
+        fprintf(f, "alerts=%" PRIu64 " pids=%zu\n", s->rows, s->pids.n);
+        if (s->lat.count) print_pcts(f, "alert_wait", &s->lat);
+        break;
+
+    default:
+        break;
+    }
+
+    rows = rank_pids(s, &n);
+    if (!rows) return;
+    switch (s->fmt) {
+    case FMT_FAIRNESS:
+        fprintf(f, "%-8s %14s %14s %10s %9s\n", "pid", "run_ms", "wait_ms", "switches", "cpu_share");
+        for (size_t i = 0; i < n && (int)i < o->top_n; i++) {
+            const struct pid_stat *p = rows[i].st;
+            double tot = p->run_ms + p->wait_ms;
+            fprintf(f, "%-8" PRIu64 " %14.3f %14.3f %10" PRIu64 " %9.4f\n", rows[i].pid,
+                p->run_ms, p->wait_ms, p->switches, tot > 0 ? p->run_ms / tot : 0.0);
+        }
+        break;
+    case FMT_CTX:
+        fprintf(f, "%-8s %14s %10s %10s %12s\n", "pid", "run_ms", "slices", "switch_in", "switch_in/s");
+        for (size_t i = 0; i < n && (int)i < o->top_n; i++) {
+            const struct pid_stat *p = rows[i].st;
+            fprintf(f, "%-8" PRIu64 " %14.3f %10" PRIu64 " %10" PRIu64 " %12.1f\n", rows[i].pid,
+                p->run_ns / 1e6, p->run_n, p->switches, span > 0 ? p->switches / span : 0.0);
+        }
+        break;
+    case FMT_CAPTURE:
+        fprintf(f, "%-8s %14s %10s %10s %14s %12s\n", "pid", "run_ms", "switch_in", "wakes", "wait_ms", "avg_wait_ms");
+        for (size_t i = 0; i < n && (int)i < o->top_n; i++) {
+            const struct pid_stat *p = rows[i].st;
+            fprintf(f, "%-8" PRIu64 " %14.3f %10" PRIu64 " %10" PRIu64 " %14.3f %12.6f\n", rows[i].pid,
+                p->run_ns / 1e6, p->switches, p->wakes, p->lat_ns / 1e6,
+                p->lat_n ? p->lat_ns / 1e6 / p->lat_n : 0.0);
+        }
+        break;
+    case FMT_TIMELINE:
+        fprintf(f, "%-8s %10s %10s %14s %12s\n", "pid", "switches", "wakes", "wait_ms", "avg_wait_ms");
+        for (size_t i = 0; i < n && (int)i < o->top_n; i++) {
+            const struct pid_stat *p = rows[i].st;
+            fprintf(f, "%-8" PRIu64 " %10" PRIu64 " %10" PRIu64 " %14.3f %12.6f\n", rows[i].pid,
+                p->switches, p->wakes, p->lat_ns / 1e6, p->lat_n ? p->lat_ns / 1e6 / p->lat_n : 0.0);
+        }
+        break;
+    case FMT_LATENCY:
+        fprintf(f, "%-8s %10s %12s\n", "pid", "samples", "mean_ms");
+        for (size_t i = 0; i < n && (int)i < o->top_n; i++) {
+            const struct pid_stat *p = rows[i].st;
+            fprintf(f, "%-8" PRIu64 " %10" PRIu64 " %12.6f\n", rows[i].pid, p->lat_n,
+                p->lat_n ? p->lat_ns / 1e6 / p->lat_n : 0.0);
+        }
+        break;
+    case FMT_STARVATION:
+        fprintf(f, "%-8s %12s\n", "pid", "alert_count");
+        for (size_t i = 0; i < n && (int)i < o->top_n; i++)
+            fprintf(f, "%-8" PRIu64 " %12" PRIu64 "\n", rows[i].pid, rows[i].st->alerts);
+        break;
+    default:
+        break;
+    }
+    free(rows);
+}
+
+/* ---- CLI --------------------------------------------------------------- */
+static void analyze_usage(void) {
+    fprintf(stderr,
+        "Usage: schedlab analyze [--threads N] [--top N] [--short-ms S] FILE...\n"
+        "  FILE is a schedlab CSV (format detected from the header) or a --capture file.\n");
+}
+
+int analyze_main(int argc, char **argv) {
+    struct analyze_opts o = { .threads = 0, .short_ms = 200.0, .top_n = 10 };
+    int i, rc = 0;
+
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (!strcmp(argv[i], "--threads") && i+1 < argc) o.threads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--top") && i+1 < argc) o.top_n = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--short-ms") && i+1 < argc) o.short_ms = atof(argv[++i]);
+        else { analyze_usage(); return 1; }
+    }
+    if (i == argc) { analyze_usage(); return 1; }
+
+    for (; i < argc; i++) {
+        struct summary s;
+        if (analyze_file(argv[i], &o, &s)) { summary_free(&s); rc = 1; continue; }
+        printf("== %s\n", argv[i]);
+        summary_print(&s, &o, stdout);
+        summary_free(&s);
+    }
+    return rc;
+}
+
+/* ---- A/B diff ------------------------------------------------------------
+ * Confidence intervals come from a Poisson bootstrap over histogram buckets:
+ * each resample redraws every non-empty bucket count as Poisson(count),
+ * which approximates resampling the raw rows with replacement without
+ * touching the input again, so the cost is independent of capture size.
+ * Counts, rates, per-PID shares and shortlong means are not histograms;
+ * their intervals are normal ones from the Poisson (compound Poisson for
+ * sums of slices) or sample variance, kept as running sums of squares.
+ */
+struct bin { uint64_t v, c; };
+
+struct binset { struct bin *b; size_t n; };
+
+static int binset_from(struct binset *bs, const struct hist *h) {
+    bs->n = 0;
+    bs->b = malloc(HIST_NBUCKETS * sizeof(*bs->b));
+    if (!bs->b) return -1;
+    for (unsigned i = 0; i < HIST_NBUCKETS; i++)
+        if (h->b[i]) {
+            uint64_t v = hist_value(i);
+            bs->b[bs->n++] = (struct bin){ v < h->min ? h->min : v > h->max ? h->max : v, h->b[i] };
+        }
+    return 0;
+}
+
+static uint64_t rng_next(uint64_t *s) {
+    *s ^= *s >> 12; *s ^= *s << 25; *s ^= *s >> 27;
+    return *s * 0x2545F4914F6CDD1DULL;
+}
+
+static double rng_unit(uint64_t *s) {
+    return ((rng_next(s) >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+}
+
+static uint64_t rng_poisson(uint64_t *s, uint64_t mean) {
+    if (mean < 30) {                     /* Knuth */
+        double l = exp(-(double)mean), p = 1.0;
+        uint64_t k = 0;
+        do { k++; p *= rng_unit(s); } while (p > l);
+        return k - 1;
+    }
+    /* normal approximation; Box-Muller */
+    double z = sqrt(-2.0 * log(rng_unit(s))) * cos(6.283185307179586 * rng_unit(s));
+    double x = (double)mean + sqrt((double)mean) * z + 0.5;
+    return x > 0 ? (uint64_t)x : 0;
+}
+
+#define DIFF_NQ 4   /* p50, p90, p99, mean */
+static const double diff_q[3] = { 0.50, 0.90, 0.99 };
+static const char  *diff_qname[DIFF_NQ] = { "p50", "p90", "p99", "mean" };
+
+/* Quantiles and mean of bins with counts c[] (NULL = the original counts). */
+static void bins_stats(const struct binset *bs, const uint64_t *c, double out[DIFF_NQ]) {
+    uint64_t tot = 0;
+    double sum = 0;
+    for (size_t i = 0; i < bs->n; i++) {
+        uint64_t k = c ? c[i] : bs->b[i].c;
+        tot += k;
+        sum += (double)k * (double)bs->b[i].v;
+    }
+    for (int q = 0; q < DIFF_NQ; q++) out[q] = 0;
+    if (!tot) return;
+    out[3] = sum / tot;
+    uint64_t cum = 0;
+    int q = 0;
+    for (size_t i = 0; i < bs->n && q < 3; i++) {
+        cum += c ? c[i] : bs->b[i].c;
+        while (q < 3 && cum >= (uint64_t)(diff_q[q] * (double)(tot - 1)) + 1)
+            out[q++] = (double)bs->b[i].v;
+    }
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void diff_row(FILE *f, const char *name, double a, double b,
+                     double lo, double hi, int have_ci, const char *unit) {
+    double d = b - a;
+    int sig = have_ci && (lo > 0 || hi < 0);
+    fprintf(f, "%-22s %14.6f %14.6f %+14.6f ", name, a, b, d);
+    if (have_ci) fprintf(f, "[%+.6f, %+.6f] ", lo, hi);
+    else         fprintf(f, "%*s ", 28, "-");
+    if (a != 0) fprintf(f, "%+8.1f%% ", 100.0 * d / a);
+    else        fprintf(f, "%9s ", "-");
+    fprintf(f, "%s%s\n", unit, sig ? "  *" : "");
+}
+
+/* Bootstrap the difference B - A of p50/p90/p99/mean for one histogram. */
+static int diff_hist(FILE *f, const char *what, const struct hist *ha, const struct hist *hb,
+                     const struct diff_opts *o, uint64_t *rng) {
+    struct binset A, B;
+    double sa[DIFF_NQ], sb[DIFF_NQ], *d = NULL;
+    uint64_t *ca = NULL, *cb = NULL;
+    int R = o->resamples, ret = -1;
+
+    if (!ha->count || !hb->count) {
+        fprintf(f, "%-22s (no samples in %s)\n", what, ha->count ? "B" : "A");
+        return 0;
+    }
+    if (binset_from(&A, ha)) return -1;
+    if (binset_from(&B, hb)) { free(A.b); return -1; }
+    ca = malloc((A.n + 1) * sizeof(*ca));
+    cb = malloc((B.n + 1) * sizeof(*cb));
+    d  = malloc((size_t)(R > 0 ? R : 1) * DIFF_NQ * sizeof(*d));
+    if (!ca || !cb || !d) goto out;
+
+    bins_stats(&A, NULL, sa);
+    bins_stats(&B, NULL, sb);
+    for (int r = 0; r < R; r++) {
+        double ra[DIFF_NQ], rb[DIFF_NQ];
+        for (size_t i = 0; i < A.n; i++) ca[i] = rng_poisson(rng, A.b[i].c);
+        for (size_t i = 0; i < B.n; i++) cb[i] = rng_poisson(rng, B.b[i].c);
+        bins_stats(&A, ca, ra);
+        bins_stats(&B, cb, rb);
+        for (int q = 0; q < DIFF_NQ; q++) d[q * R + r] = (rb[q] - ra[q]) / 1e6;
+    }
+    for (int q = 0; q < DIFF_NQ; q++) {
+        char name[40];
+        double lo = 0, hi = 0;
+        if (R > 0) {
+            qsort(d + q * R, (size_t)R, sizeof(*d), cmp_double);
+            lo = d[q * R + (int)(o->alpha / 2 * (R - 1))];
+            hi = d[q * R + (int)((1 - o->alpha / 2) * (R - 1) + 0.5)];
+        }
+        snprintf(name, sizeof(name), "%s %s", what, diff_qname[q]);
+        diff_row(f, name, sa[q] / 1e6, sb[q] / 1e6, lo, hi, R > 0, "ms");
+    }
+    ret = 0;
+out:
+    free(A.b); free(B.b); free(ca); free(cb); free(d);
+    return ret;
+}
+
+/* Rate of n events over t seconds; significance from the Poisson variance. */
+static void diff_rate(FILE *f, const char *name, uint64_t na, double ta,
+                      uint64_t nb, double tb, double z) {
+    if (ta <= 0 || tb <= 0) return;
+    double ra = na / ta, rb = nb / tb;
+    double se = sqrt(na / (ta * ta) + nb / (tb * tb));
+    diff_row(f, name, ra, rb, rb - ra - z * se, rb - ra + z * se, 1, "/s");
+}
+
+/* B - A with a normal interval of half-width z * sqrt(var_a + var_b). */
+static void diff_norm(FILE *f, const char *name, double a, double b, double var_a,
+                      double var_b, double z, const char *unit) {
+    double h = z * sqrt(var_a + var_b);
+    diff_row(f, name, a, b, b - a - h, b - a + h, 1, unit);
+}
+
+/* Variance of the mean of n values with sum s and sum of squares sq. */
+static double mean_var(uint64_t n, double s, double sq) {
+    if (n < 2) return 0;
+    double v = (sq - s * s / n) / (n - 1);
+    return v > 0 ? v / n : 0;
+}
+
+/* Per-PID value used for CPU share: fairness uses run/(run+wait) as in
+ * TaskThree; ctx uses the PID's fraction of all recorded run time. *var
+ * is its delta-method variance: ctx treats run time as a compound Poisson
+ * sum of slices (variance = sum of squares, run_sq_tot over all PIDs);
+ * fairness only has totals, so run and wait each count as `switches`
+ * equal slices. */
+static double pid_share(const struct summary *s, const struct pid_stat *p, double run_tot,
+                        double run_sq_tot, double *var) {
+    *var = 0;
+    if (s->fmt == FMT_FAIRNESS) {
+        double r = p->run_ms, w = p->wait_ms, t = r + w;
+        if (t > 0 && p->switches) *var = 2 * r * r * w * w / ((double)p->switches * t * t * t * t);
+        return t > 0 ? r / t : 0;
+    }
+    if (run_tot <= 0) return 0;
+    double x = p->run_ns, t2 = run_tot * run_tot;
+    *var = (run_tot - x) * (run_tot - x) / (t2 * t2) * p->run_sq +
+           x * x / (t2 * t2) * (run_sq_tot - p->run_sq);
+    return x / run_tot;
+}
+
+static void diff_pids(FILE *f, const struct summary *a, const struct summary *b,
+                      const struct diff_opts *o, double z) {
+    size_t na, nb, shown = 0;
+    struct pid_row *ra = rank_pids(a, &na), *rb = rank_pids(b, &nb);
+    double ta = summary_span_s(a), tb = summary_span_s(b), runa = 0, runb = 0, sqa = 0, sqb = 0;
+    int by_rank = o->by_rank;
+
+    if (!ra || !rb) goto out;
+    for (size_t i = 0; i < na; i++) { runa += ra[i].st->run_ns; sqa += ra[i].st->run_sq; }
+    for (size_t i = 0; i < nb; i++) { runb += rb[i].st->run_ns; sqb += rb[i].st->run_sq; }
+    if (!by_rank) {
+        size_t common = 0;
+        for (size_t i = 0; i < na && (int)i < o->a.top_n; i++)
+            common += u64map_find(&b->pids, ra[i].pid) != NULL;
+        if (!common) {
+            fprintf(f, "(no PIDs in common; pairing by rank)\n");
+            by_rank = 1;
+        }
+    }
+
+    fprintf(f, "\n%-22s %14s %14s %15s\n", by_rank ? "rank: A pid/B pid" : "pid", "A", "B", "B-A");
+    for (size_t i = 0; i < na && (int)shown < o->a.top_n; i++) {
+        const struct pid_stat *pa = ra[i].st, *pb;
+        char name[64];
+        if (by_rank) {
+            if (i >= nb) break;
+            pb = rb[i].st;
+            snprintf(name, sizeof(name), "#%zu %" PRIu64 "/%" PRIu64, i + 1, ra[i].pid, rb[i].pid);
+        } else {
+            if (!(pb = u64map_find(&b->pids, ra[i].pid))) continue;
+            snprintf(name, sizeof(name), "%" PRIu64, ra[i].pid);
+        }
+        shown++;
+        char lab[96];
+        snprintf(lab, sizeof(lab), "%s share", name);
+        if (a->fmt != FMT_TIMELINE) {
+            double va, vb, sa = pid_share(a, pa, runa, sqa, &va), sb = pid_share(b, pb, runb, sqb, &vb);
+            diff_norm(f, lab, sa, sb, va, vb, z, "");
+        }
+        snprintf(lab, sizeof(lab), "%s sw", name);
+        if (a->fmt == FMT_FAIRNESS)
+            diff_norm(f, lab, (double)pa->switches, (double)pb->switches,
+                      (double)pa->switches, (double)pb->switches, z, "");
+        else
+            diff_rate(f, lab, pa->switches, ta, pb->switches, tb, z);
+    }
+out:
+    free(ra);
+    free(rb);
+}
+
+/* Inverse of the standard normal CDF, good to ~1e-3 for the usual alphas. */
+static double z_of(double p) {
+    double t = sqrt(-2.0 * log(p < 0.5 ? p : 1 - p));
+    double z = t - (2.515517 + 0.802853 * t + 0.010328 * t * t) /
+                   (1 + 1.432788 * t + 0.189269 * t * t + 0.001308 * t * t * t);
+    return p < 0.5 ? -z : z;
+}
+
+int summary_diff(const struct summary *a, const struct summary *b,
+                 const struct diff_opts *o, FILE *f) {
+    uint64_t rng = o->seed ? o->seed : 0x9E3779B97F4A7C15ULL;
+    double z = z_of(1 - o->alpha / 2);
+
+    fprintf(f, "format=%s  A: rows=%" PRIu64 " span_s=%.3f  B: rows=%" PRIu64 " span_s=%.3f\n",
+        csv_fmt_name(a->fmt), a->rows, summary_span_s(a), b->rows, summary_span_s(b));
+    fprintf(f, "%-22s %14s %14s %14s %-28s %9s\n", "metric", "A", "B", "B-A",
+        "  CI", "change");
+
+    switch (a->fmt) {
+    case FMT_LATENCY:
+        if (diff_hist(f, "latency", &a->lat, &b->lat, o, &rng)) return -1;
+        break;
+    case FMT_CTX:
+        diff_rate(f, "switches", a->rows, summary_span_s(a), b->rows, summary_span_s(b), z);
+        if (diff_hist(f, "run_slice", &a->run, &b->run, o, &rng)) return -1;
+        break;
+    case FMT_TIMELINE:
+    case FMT_CAPTURE:
+        diff_rate(f, "switches", a->ev[1], summary_span_s(a), b->ev[1], summary_span_s(b), z);
+        diff_rate(f, "wakes", a->ev[0], summary_span_s(a), b->ev[0], summary_span_s(b), z);
+        if (diff_hist(f, "wait", &a->lat, &b->lat, o, &rng)) return -1;
+        if (diff_hist(f, "run_prev", &a->run, &b->run, o, &rng)) return -1;
+        break;
+    case FMT_STARVATION:
+        diff_rate(f, "alerts", a->rows, summary_span_s(a), b->rows, summary_span_s(b), z);
+        if (a->lat.count && b->lat.count && diff_hist(f, "alert_wait", &a->lat, &b->lat, o, &rng))
+            return -1;
+        break;
+    case FMT_SHORTLONG:
+        for (int g = 0; g < 2; g++) {
+            const struct life_group *x = &a->life[g], *y = &b->life[g];
+            const char *gn = g ? "long" : "short";
+            char name[40];
+            snprintf(name, sizeof(name), "%s count", gn);
+            diff_norm(f, name, (double)x->n, (double)y->n, (double)x->n, (double)y->n, z, "");
+            snprintf(name, sizeof(name), "%s avg_switches", gn);
+            diff_norm(f, name, x->n ? x->switches / x->n : 0, y->n ? y->switches / y->n : 0,
+                      mean_var(x->n, x->switches, x->switches_sq),
+                      mean_var(y->n, y->switches, y->switches_sq), z, "");
+            snprintf(name, sizeof(name), "%s avg_life", gn);
+            diff_norm(f, name, x->n ? x->life_ms / x->n : 0, y->n ? y->life_ms / y->n : 0,
+                      mean_var(x->n, x->life_ms, x->life_sq),
+                      mean_var(y->n, y->life_ms, y->life_sq), z, "ms");
+        }
+        fprintf(f, "(* = %.0f%% interval excludes zero)\n", 100 * (1 - o->alpha));
+        return 0;
+    default:
+        break;
+    }
+    if (a->fmt == FMT_FAIRNESS || a->fmt == FMT_CTX || a->fmt == FMT_TIMELINE ||
+        a->fmt == FMT_CAPTURE)
+        diff_pids(f, a, b, o, z);
+    fprintf(f, "(* = %.0f%% interval excludes zero; %d resamples)\n", 100 * (1 - o->alpha), o->resamples);
+    return 0;
+}
+
+static void diff_usage(void) {
+    fprintf(stderr,
+        "Usage: schedlab diff [--threads N] [--top N] [--short-ms S] [--resamples R]\n"
+        "                     [--alpha A] [--seed S] [--by-rank] A.csv B.csv\n");
+}
+
+int diff_main(int argc, char **argv) {
+    struct diff_opts o = {
+        .a = { .threads = 0, .short_ms = 200.0, .top_n = 10 },
+        .resamples = 1000, .alpha = 0.05,
+    };
+    struct summary a, b;
+    int i, rc = 1;
+
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (!strcmp(argv[i], "--threads") && i+1 < argc) o.a.threads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--top") && i+1 < argc) o.a.top_n = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--short-ms") && i+1 < argc) o.a.short_ms = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--resamples") && i+1 < argc) o.resamples = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--alpha") && i+1 < argc) o.alpha = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--seed") && i+1 < argc) o.seed = strtoull(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "--by-rank")) o.by_rank = 1;
+        else { diff_usage(); return 1; }
+    }
+    if (argc - i != 2 || o.resamples < 0 || !(o.alpha > 0 && o.alpha < 1)) { diff_usage(); return 1; }
+
+    if (analyze_file(argv[i], &o.a, &a)) { summary_free(&a); return 1; }
+    if (analyze_file(argv[i+1], &o.a, &b)) goto out;   /* b is initialised even on failure */
+    if (a.fmt != b.fmt) {
+        fprintf(stderr, "diff: %s is %s but %s is %s\n",
+            argv[i], csv_fmt_name(a.fmt), argv[i+1], csv_fmt_name(b.fmt));
+        goto out;
+    }
+    printf("A=%s  B=%s\n", argv[i], argv[i+1]);
+    rc = summary_diff(&a, &b, &o, stdout) ? 1 : 0;
+out:
+    summary_free(&b);
+    summary_free(&a);
+    return rc;
+}
@@ -0,0 +1,110 @@
+// schedlab/schedlab_analyze.h
+// SPDX-License-Identifier: MIT
+#ifndef SCHEDLAB_ANALYZE_H
+#define SCHEDLAB_ANALYZE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/* ---- CSV formats written by schedlab_user.c (detected from header) ---- */
+enum csv_fmt {
+    FMT_UNKNOWN = 0,
+    FMT_LATENCY,     // ts_ns,pid,latency_ns
+    FMT_FAIRNESS,    // pid,run_ms,wait_ms,switches   (running totals)
+    FMT_CTX,         // ts_ns,prev_pid,next_pid,run_ns
+    FMT_TIMELINE,    // ts_ns,pid,event,wait_ns,run_prev_ns
+    FMT_SHORTLONG,   // pid,lifetime_ms,wakes,switches[,...]
+    FMT_STARVATION,  // ts_ns,pid,event[,wait_ns,rule]
+    FMT_CAPTURE,     // binary --capture file (schedlab_capture.h)
+};
+
+const char *csv_fmt_name(enum csv_fmt f);
+
+/* ---- Log-linear histogram ----------------------------------------------
+ * Values below 2*HIST_SUB are exact; above that each power of two is split
+ * into HIST_SUB sub-buckets, so quantiles are within 1/HIST_SUB (~0.8%).
+ */
+#define HIST_SUB_BITS  7
+#define HIST_SUB       (1u << HIST_SUB_BITS)
+#define HIST_NBUCKETS  ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+struct hist {
+    uint64_t count, sum, min, max;
+    uint64_t b[HIST_NBUCKETS];
+};
+
+void     hist_add(struct hist *h, uint64_t v);
+void     hist_merge(struct hist *dst, const struct hist *src);
+uint64_t hist_value(unsigned idx);            /* representative value of bucket idx */
+uint64_t hist_quantile(const struct hist *h, double q);
+
+/* ---- u64-keyed open-addressing table with fixed-size values ----------- */
+struct u64map {
+    uint64_t *keys;   /* key + 1; 0 = empty slot */
+    char     *vals;
+    size_t    vsz, cap, n;
+};
+
+int   u64map_init(struct u64map *m, size_t vsz);
+void *u64map_get(struct u64map *m, uint64_t key);   /* insert zeroed if missing */
+void *u64map_find(const struct u64map *m, uint64_t key);
+void  u64map_free(struct u64map *m);
+
+/* ---- Summary of one capture -------------------------------------------- */
+struct pid_stat {
+    double   run_ms, wait_ms;     /* fairness: final running totals (max) */
+    uint64_t switches;            /* fairness: final total; ctx/timeline: switch-ins */
+    uint64_t wakes;
+    uint64_t alerts;              /* starvation */
+    uint64_t lat_n, lat_ns;       /* latency/timeline wait samples */
+    uint64_t run_n, run_ns;       /* ctx/capture: slices as prev */
+    double   run_sq;              /* ctx/capture: sum of squared slices (ns^2), for share CIs */
+};
+
+struct life_group {
+    uint64_t n;
+    double   wakes, switches, life_ms;   /* sums */
+    double   switches_sq, life_sq;       /* sums of squares, for CIs on the means */
+};
+
+struct summary {
+    enum csv_fmt      fmt;
+    uint64_t          rows, bad_rows;
+    uint64_t          ts_min, ts_max;      /* for formats with ts_ns */
+    struct hist       lat;                 /* latency_ns / wait_ns */
+    struct hist       run;                 /* run_ns / run_prev_ns */
+    struct u64map     pids;                /* pid -> struct pid_stat */
+    struct u64map     secs;                /* ts second -> uint64_t rows */
+    struct life_group life[2];             /* shortlong: [0] short, [1] long */
+    uint64_t          ev[8];               /* WAKE/SWITCH/EXEC/EXIT/FORK/WAITLONG */
+};
+
+struct analyze_opts {
+    int    threads;     /* 0 = online CPUs */
+    double short_ms;    /* shortlong cutoff */
+    int    top_n;
+};
+
+int    summary_init(struct summary *s);
+void   summary_free(struct summary *s);
+int    analyze_file(const char *path, const struct analyze_opts *o, struct summary *out);
+double summary_span_s(const struct summary *s);
+void   summary_print(const struct summary *s, const struct analyze_opts *o, FILE *f);
+
+/* ---- A/B comparison --------------------------------------------------- */
+struct diff_opts {
+    struct analyze_opts a;
+    int      resamples;   /* bootstrap resamples; 0 = point estimates only */
+    uint64_t seed;
+    double   alpha;       /* two-sided; 0.05 = 95% intervals */
+    int      by_rank;     /* pair PIDs by rank instead of by pid */
+};
+
+int summary_diff(const struct summary *a, const struct summary *b,
+                 const struct diff_opts *o, FILE *f);
+
+int analyze_main(int argc, char **argv);
+int diff_main(int argc, char **argv);
+
+#endif /* SCHEDLAB_ANALYZE_H */
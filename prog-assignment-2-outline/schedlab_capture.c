@@ -0,0 +1,652 @@
+// schedlab/schedlab_capture.c
+// SPDX-License-Identifier: MIT
+//
+// Columnar event capture: the writer buffers CAP_BLOCK_ROWS events per
+// column and appends one block at a time; cap_close() adds the block
+// directory (ts range per block) and a PID -> block index so `schedlab
+// query` only touches the blocks that can match. With --capture-enc
+// delta/zstd the columns are packed (see schedlab_capture.h) to cut the
+// size of long-retention traces.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "schedlab_capture.h"
+
+/* Must match enum ev_type in schedlab.bpf.c */
+static const char *cap_type_names[] = {
+    "?", "wake", "switch", "exec", "exit", "fork", "wait_alert", "life", "mark", "req"
+};
+
+const char *cap_type_name(uint8_t type) {
+    return type < sizeof(cap_type_names)/sizeof(cap_type_names[0]) ? cap_type_names[type] : "?";
+}
+
+#define ALIGN8(x) (((x) + 7) & ~(size_t)7)
+
+static size_t cap_payload_bytes(uint32_t n) {
+    return ALIGN8((size_t)n * (3 * sizeof(uint64_t) + 3 * sizeof(uint32_t) + 1));
+}
+
+/* worst case packed size: 10-byte varints for u64, 5 for u32 */
+#define CAP_PACK_MAX  (5 + 2 * CAP_BLOCK_ROWS * 5 + CAP_BLOCK_ROWS * (10 + 1 + 5 + 5 + 5 + 10 + 10))
+
+int cap_parse_enc(const char *s, enum cap_enc *out) {
+    if (!strcmp(s, "raw"))   { *out = CAP_ENC_RAW;   return 0; }
+    if (!strcmp(s, "delta")) { *out = CAP_ENC_DELTA; return 0; }
+    if (!strcmp(s, "zstd")) {
+#ifdef HAVE_ZSTD
+        *out = CAP_ENC_ZSTD;
+        return 0;
+#else
+        fprintf(stderr, "capture: built without zstd (HAVE_ZSTD)\n");
+        return -1;
+#endif
+    }
+    return -1;
+}
+
+/* ---- Varints ---------------------------------------------------------- */
+static inline uint8_t *put_varint(uint8_t *p, uint64_t v) {
+    while (v >= 0x80) { *p++ = (uint8_t)v | 0x80; v >>= 7; }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+static inline uint64_t zigzag(int64_t v)    { return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63); }
+static inline int64_t  unzigzag(uint64_t v) { return (int64_t)(v >> 1) ^ -(int64_t)(v & 1); }
+
+/* Returns the byte after the varint, or NULL on a truncated/overlong one. */
+static inline const uint8_t *get_varint(const uint8_t *p, const uint8_t *end, uint64_t *v) {
+    if (end - p >= 10) {                 /* common case: no bounds checks */
+        uint64_t x = 0;
+        for (int sh = 0; sh < 70; sh += 7) {
+            uint8_t b = *p++;
+            x |= (uint64_t)(b & 0x7f) << sh;
+            if (!(b & 0x80)) { *v = x; return p; }
+        }
+        return NULL;
+    }
+    uint64_t x = 0;
+    for (int sh = 0; p < end && sh < 70; sh += 7) {
+        uint8_t b = *p++;
+        x |= (uint64_t)(b & 0x7f) << sh;
+        if (!(b & 0x80)) { *v = x; return p; }
+    }
+    return NULL;
+}
+
+static uint32_t dict_find(const uint32_t *d, uint32_t n, uint32_t pid) {
+    uint32_t lo = 0, hi = n;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (d[mid] < pid) lo = mid + 1;
+        else              hi = mid;
+    }
+    return lo;
+}
+
+/* ---- Writer ------------------------------------------------------------ */
+struct cap_ref { uint32_t pid, block; };
+
+struct cap_writer {
+    FILE     *f;
+    uint64_t  off;
+    enum cap_enc enc;
+    uint8_t  *pack;                  /* CAP_PACK_MAX */
+    char     *z;
+    size_t    zcap;
+    uint32_t  n;
+    int       failed;                /* a block write failed; later rows are refused */
+    uint64_t  ts[CAP_BLOCK_ROWS], run[CAP_BLOCK_ROWS], wait[CAP_BLOCK_ROWS];
+    uint32_t  pid[CAP_BLOCK_ROWS], aux[CAP_BLOCK_ROWS];
+    int32_t   cpu[CAP_BLOCK_ROWS];
+    uint8_t   type[CAP_BLOCK_ROWS];
+    uint32_t  scratch[2 * CAP_BLOCK_ROWS];
+
+    struct cap_blk_ent *dir;
+    size_t              ndir, dir_cap;
+    struct cap_ref     *refs;
+    size_t              nrefs, refs_cap;
+    uint64_t            rows;
+};
+
+static int wr(struct cap_writer *w, const void *p, size_t len) {
+    if (len && fwrite(p, 1, len, w->f) != len) return -1;
+    w->off += len;
+    return 0;
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static int cmp_ref(const void *a, const void *b) {
+    const struct cap_ref *x = a, *y = b;
+    if (x->pid != y->pid) return x->pid < y->pid ? -1 : 1;
+    return (x->block > y->block) - (x->block < y->block);
+}
+
+/* Pack the buffered block into w->pack; dict holds its k sorted pids. */
+static size_t cap_pack(struct cap_writer *w, uint64_t ts_min, const uint32_t *dict, uint32_t k) {
+    uint8_t *p = w->pack;
+    uint32_t n = w->n;
+    uint64_t prev = ts_min;
+
+    p = put_varint(p, k);
+    for (uint32_t i = 0; i < k; i++)
+        p = put_varint(p, i ? dict[i] - dict[i-1] : dict[0]);
+    for (uint32_t i = 0; i < n; i++) {
+        p = put_varint(p, zigzag((int64_t)(w->ts[i] - prev)));
+        prev = w->ts[i];
+    }
+    memcpy(p, w->type, n);
+    p += n;
+    for (uint32_t i = 0; i < n; i++) p = put_varint(p, dict_find(dict, k, w->pid[i]));
+    for (uint32_t i = 0; i < n; i++) p = put_varint(p, dict_find(dict, k, w->aux[i]));
+    for (uint32_t i = 0; i < n; i++) p = put_varint(p, zigzag(w->cpu[i]));
+    for (uint32_t i = 0; i < n; i++) p = put_varint(p, w->run[i]);
+    for (uint32_t i = 0; i < n; i++) p = put_varint(p, w->wait[i]);
+    return (size_t)(p - w->pack);
+}
+
+static int cap_flush_block(struct cap_writer *w) {
+    uint32_t n = w->n;
+    static const char zero[8];
+
+    if (!n) return 0;
+    if (w->ndir == w->dir_cap) {
+        size_t cap = w->dir_cap ? w->dir_cap * 2 : 256;
+        void *p = realloc(w->dir, cap * sizeof(*w->dir));
+        if (!p) return -1;
+        w->dir = p;
+        w->dir_cap = cap;
+    }
+
+    struct cap_blk_hdr h = { .nrows = n, .ts_min = w->ts[0], .ts_max = w->ts[0] };
+    for (uint32_t i = 1; i < n; i++) {
+        if (w->ts[i] < h.ts_min) h.ts_min = w->ts[i];
+        if (w->ts[i] > h.ts_max) h.ts_max = w->ts[i];
+    }
+
+    /* distinct pids touched by this block, sorted; 0 is kept for the
+     * dictionary but not indexed */
+    uint32_t k = 0, nd = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        w->scratch[k++] = w->pid[i];
+        w->scratch[k++] = w->aux[i];
+    }
+    qsort(w->scratch, k, sizeof(*w->scratch), cmp_u32);
+    for (uint32_t i = 0; i < k; i++)
+        if (!nd || w->scratch[i] != w->scratch[nd-1]) w->scratch[nd++] = w->scratch[i];
+
+    const void *payload = NULL;
+    size_t len = 0;
+    if (w->enc == CAP_ENC_RAW) {
+        h.bytes = (uint32_t)cap_payload_bytes(n);
+    } else {
+        len = cap_pack(w, h.ts_min, w->scratch, nd);
+        payload = w->pack;
+#ifdef HAVE_ZSTD
+        if (w->enc == CAP_ENC_ZSTD) {
+            size_t need = sizeof(uint32_t) + ZSTD_compressBound(len);
+            if (need > w->zcap) {
+                char *z = realloc(w->z, need);
+                if (!z) return -1;
+                w->z = z;
+                w->zcap = need;
+            }
+            uint32_t plen = (uint32_t)len;
+            size_t zl = ZSTD_compress(w->z + sizeof(plen), w->zcap - sizeof(plen), w->pack, len, 3);
+            if (ZSTD_isError(zl)) {
+                fprintf(stderr, "capture: zstd: %s\n", ZSTD_getErrorName(zl));
+                return -1;
+            }
+            memcpy(w->z, &plen, sizeof(plen));
+            payload = w->z;
+            len = sizeof(plen) + zl;
+        }
+#endif
+        h.bytes = (uint32_t)len;
+    }
+    w->dir[w->ndir] = (struct cap_blk_ent){ .off = w->off, .ts_min = h.ts_min,
+                                            .ts_max = h.ts_max, .nrows = n, .bytes = h.bytes };
+
+    if (wr(w, &h, sizeof(h))) return -1;
+    if (payload) {
+        if (wr(w, payload, len) || wr(w, zero, ALIGN8(len) - len)) return -1;
+    } else {
+        size_t raw = (size_t)n * (3 * sizeof(uint64_t) + 3 * sizeof(uint32_t) + 1);
+        if (wr(w, w->ts, n * sizeof(*w->ts)) || wr(w, w->run, n * sizeof(*w->run)) ||
+            wr(w, w->wait, n * sizeof(*w->wait)) || wr(w, w->pid, n * sizeof(*w->pid)) ||
+            wr(w, w->aux, n * sizeof(*w->aux)) || wr(w, w->cpu, n * sizeof(*w->cpu)) ||
+            wr(w, w->type, n) || wr(w, zero, h.bytes - raw))
+            return -1;
+    }
+
+    for (uint32_t i = 0; i < nd; i++) {
+        if (!w->scratch[i]) continue;
+        if (w->nrefs == w->refs_cap) {
+            size_t cap = w->refs_cap ? w->refs_cap * 2 : 4096;
+            void *p = realloc(w->refs, cap * sizeof(*w->refs));
+            if (!p) return -1;
+            w->refs = p;
+            w->refs_cap = cap;
+        }
+        w->refs[w->nrefs++] = (struct cap_ref){ w->scratch[i], (uint32_t)w->ndir };
+    }
+
+    w->ndir++;
+    w->n = 0;
+    return 0;
+}
+
+/* A failed flush leaves the block half written, so the writer stops there:
+ * further appends and the final flush do nothing and cap_close reports it. */
+static int cap_flush(struct cap_writer *w) {
+    if (w->failed) return -1;
+    if (cap_flush_block(w)) {
+        w->failed = 1;
+        return -1;
+    }
+    return 0;
+}
+
+struct cap_writer *cap_open(const char *path, enum cap_enc enc) {
+    struct cap_writer *w = calloc(1, sizeof(*w));
+    struct cap_hdr h = { .version = CAP_VERSION, .block_rows = CAP_BLOCK_ROWS };
+
+    if (!w) return NULL;
+    memcpy(h.magic, CAP_MAGIC, sizeof(h.magic));
+    w->enc = enc;
+    if (enc != CAP_ENC_RAW) {
+        h.flags = CAP_F_DELTA | (enc == CAP_ENC_ZSTD ? CAP_F_ZSTD : 0);
+        if (!(w->pack = malloc(CAP_PACK_MAX))) { free(w); return NULL; }
+    }
+    w->f = fopen(path, "wb");
+    if (!w->f || wr(w, &h, sizeof(h))) {
+        fprintf(stderr, "capture: %s: %s\n", path, strerror(errno));
+        if (w->f) fclose(w->f);
+        free(w->pack);
+        free(w);
+        return NULL;
+    }
+    return w;
+}
+
+int cap_append(struct cap_writer *w, const struct cap_row *r) {
+    if (w->failed || w->n >= CAP_BLOCK_ROWS) return -1;
+    uint32_t i = w->n++;
+    w->ts[i]   = r->ts_ns;
+    w->run[i]  = r->run_ns;
+    w->wait[i] = r->wait_ns;
+    w->pid[i]  = r->pid;
+    w->aux[i]  = r->aux;
+    w->cpu[i]  = r->cpu;
+    w->type[i] = r->type;
+    w->rows++;
+    return w->n == CAP_BLOCK_ROWS ? cap_flush(w) : 0;
+}
+
+uint64_t cap_bytes(const struct cap_writer *w) {
+    return w->off;
+}
+
+int cap_close(struct cap_writer *w) {
+    struct cap_trailer t = { 0 };
+    int ret = -1;
+
+    if (!w) return 0;
+    if (cap_flush(w)) goto out;
+
+    qsort(w->refs, w->nrefs, sizeof(*w->refs), cmp_ref);
+
+    t.dir_off = w->off;
+    t.nblocks = w->ndir;
+    if (wr(w, w->dir, w->ndir * sizeof(*w->dir))) goto out;
+
+    t.pidx_off = w->off;
+    for (size_t i = 0; i < w->nrefs; ) {
+        size_t j = i;
+        while (j < w->nrefs && w->refs[j].pid == w->refs[i].pid) j++;
+        struct cap_pid_ent pe = { .pid = w->refs[i].pid, .nblocks = (uint32_t)(j - i), .first = i };
+        if (wr(w, &pe, sizeof(pe))) goto out;
+        t.npids++;
+        i = j;
+    }
+
+    t.blist_off = w->off;
+    t.nrefs = w->nrefs;
+    for (size_t i = 0; i < w->nrefs; i++)
+        if (wr(w, &w->refs[i].block, sizeof(uint32_t))) goto out;
+    if (w->off & 7) {
+        static const char zero[8];
+        if (wr(w, zero, 8 - (w->off & 7))) goto out;
+    }
+
+    t.rows = w->rows;
+    memcpy(t.magic, CAP_TRAILER, sizeof(t.magic));
+    if (wr(w, &t, sizeof(t))) goto out;
+    ret = 0;
+out:
+    if (fclose(w->f)) ret = -1;
+    if (ret) fprintf(stderr, "capture: write failed: %s\n", strerror(errno));
+    free(w->dir);
+    free(w->refs);
+    free(w->pack);
+    free(w->z);
+    free(w);
+    return ret;
+}
+
+/* ---- Reader ------------------------------------------------------------ */
+int cap_is_capture(const char *path) {
+    char m[8];
+    int fd = open(path, O_RDONLY), ok;
+    if (fd < 0) return 0;
+    ok = read(fd, m, sizeof(m)) == (ssize_t)sizeof(m) && !memcmp(m, CAP_MAGIC, sizeof(m));
+    close(fd);
+    return ok;
+}
+
+/* No trailer (writer was killed): rebuild the directory by walking blocks. */
+static int cap_walk(struct cap_file *cf) {
+    size_t off = sizeof(struct cap_hdr), cap = 0;
+
+    while (off + sizeof(struct cap_blk_hdr) <= cf->size) {
+        const struct cap_blk_hdr *h = (const void *)(cf->base + off);
+        if (!h->nrows || h->nrows > CAP_BLOCK_ROWS || !h->bytes || h->ts_min > h->ts_max ||
+            (!(cf->flags & CAP_F_DELTA) && h->bytes != cap_payload_bytes(h->nrows)) ||
+            off + sizeof(*h) + h->bytes > cf->size)
+            break;
+        if (cf->nblocks == cap) {
+            cap = cap ? cap * 2 : 256;
+            void *p = realloc(cf->own_dir, cap * sizeof(*cf->own_dir));
+            if (!p) return -1;
+            cf->own_dir = p;
+        }
+        cf->own_dir[cf->nblocks++] = (struct cap_blk_ent){ .off = off, .ts_min = h->ts_min,
+            .ts_max = h->ts_max, .nrows = h->nrows, .bytes = h->bytes };
+        cf->rows += h->nrows;
+        off += sizeof(*h) + ALIGN8(h->bytes);
+    }
+    cf->dir = cf->own_dir;
+    return 0;
+}
+
+int cap_map(const char *path, struct cap_file *cf) {
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+
+    memset(cf, 0, sizeof(*cf));
+    if (fd < 0 || fstat(fd, &st)) { perror(path); if (fd >= 0) close(fd); return -1; }
+    if ((size_t)st.st_size < sizeof(struct cap_hdr)) {
+        fprintf(stderr, "%s: not a capture\n", path);
+        close(fd);
+        return -1;
+    }
+    cf->size = (size_t)st.st_size;
+    cf->base = mmap(NULL, cf->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (cf->base == MAP_FAILED) { perror("mmap"); cf->base = NULL; return -1; }
+
+    const struct cap_hdr *h = (const void *)cf->base;
+    if (memcmp(h->magic, CAP_MAGIC, sizeof(h->magic)) || !h->version || h->version > CAP_VERSION) {
+        fprintf(stderr, "%s: not a capture (or newer than version %d)\n", path, CAP_VERSION);
+        cap_unmap(cf);
+        return -1;
+    }
+    cf->flags = h->version >= 2 ? h->flags : 0;
+#ifndef HAVE_ZSTD
+    if (cf->flags & CAP_F_ZSTD) {
+        fprintf(stderr, "%s: zstd capture, but built without HAVE_ZSTD\n", path);
+        cap_unmap(cf);
+        return -1;
+    }
+#endif
+
+    const struct cap_trailer *t = (const void *)(cf->base + cf->size - sizeof(*t));
+    if (cf->size >= sizeof(*h) + sizeof(*t) && !memcmp(t->magic, CAP_TRAILER, sizeof(t->magic)) &&
+        t->dir_off + t->nblocks * sizeof(struct cap_blk_ent) <= cf->size &&
+        t->pidx_off + t->npids * sizeof(struct cap_pid_ent) <= cf->size &&
+        t->blist_off + t->nrefs * sizeof(uint32_t) <= cf->size) {
+        cf->dir     = (const void *)(cf->base + t->dir_off);
+        cf->nblocks = t->nblocks;
+        cf->pidx    = (const void *)(cf->base + t->pidx_off);
+        cf->npids   = t->npids;
+        cf->blist   = (const void *)(cf->base + t->blist_off);
+        cf->nrefs   = t->nrefs;
+        cf->rows    = t->rows;
+    } else {
+        fprintf(stderr, "%s: no index (capture not closed cleanly); scanning blocks\n", path);
+        if (cap_walk(cf)) { cap_unmap(cf); return -1; }
+    }
+    madvise((void *)cf->base, cf->size, MADV_RANDOM);
+    return 0;
+}
+
+void cap_unmap(struct cap_file *cf) {
+    if (cf->base) munmap((void *)cf->base, cf->size);
+    free(cf->own_dir);
+    memset(cf, 0, sizeof(*cf));
+}
+
+void cap_buf_free(struct cap_buf *b) {
+    if (!b) return;
+    free(b->z);
+    free(b);
+}
+
+static int cap_unpack(const uint8_t *p, const uint8_t *end, uint32_t n,
+                      uint64_t ts_min, struct cap_buf *b) {
+    uint64_t v, k, prev = ts_min;
+
+    if (!(p = get_varint(p, end, &k)) || k > 2 * CAP_BLOCK_ROWS) return -1;
+    for (uint64_t i = 0; i < k; i++) {
+        if (!(p = get_varint(p, end, &v))) return -1;
+        b->dict[i] = (uint32_t)(i ? b->dict[i-1] + v : v);
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        if (!(p = get_varint(p, end, &v))) return -1;
+        prev += (uint64_t)unzigzag(v);
+        b->ts[i] = prev;
+    }
+    if ((size_t)(end - p) < n) return -1;
+    memcpy(b->type, p, n);
+    p += n;
+    for (uint32_t i = 0; i < n; i++) {
+        if (!(p = get_varint(p, end, &v)) || v >= k) return -1;
+        b->pid[i] = b->dict[v];
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        if (!(p = get_varint(p, end, &v)) || v >= k) return -1;
+        b->aux[i] = b->dict[v];
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        if (!(p = get_varint(p, end, &v))) return -1;
+        b->cpu[i] = (int32_t)unzigzag(v);
+    }
+    for (uint32_t i = 0; i < n; i++)
+        if (!(p = get_varint(p, end, &b->run[i]))) return -1;
+    for (uint32_t i = 0; i < n; i++)
+        if (!(p = get_varint(p, end, &b->wait[i]))) return -1;
+    return 0;
+}
+
+int cap_block(const struct cap_file *cf, uint64_t bi, struct cap_cols *c, struct cap_buf *buf) {
+    if (bi >= cf->nblocks) return -1;
+    const struct cap_blk_ent *e = &cf->dir[bi];
+    if (e->off + sizeof(struct cap_blk_hdr) + e->bytes > cf->size || e->nrows > CAP_BLOCK_ROWS)
+        return -1;
+
+    const char *p = cf->base + e->off + sizeof(struct cap_blk_hdr);
+    uint32_t n = e->nrows;
+    c->n = n;
+
+    if (cf->flags & CAP_F_DELTA) {
+        const uint8_t *q = (const uint8_t *)p, *end = q + e->bytes;
+#ifdef HAVE_ZSTD
+        if (cf->flags & CAP_F_ZSTD) {
+            uint32_t plen;
+            if (e->bytes < sizeof(plen)) return -1;
+            memcpy(&plen, p, sizeof(plen));
+            if (plen > CAP_PACK_MAX) return -1;
+            if (plen > buf->zcap) {
+                char *z = realloc(buf->z, plen);
+                if (!z) return -1;
+                buf->z = z;
+                buf->zcap = plen;
+            }
+            size_t got = ZSTD_decompress(buf->z, plen, p + sizeof(plen), e->bytes - sizeof(plen));
+            if (ZSTD_isError(got) || got != plen) return -1;
+            q = (const uint8_t *)buf->z;
+            end = q + plen;
+        }
+#endif
+        if (cap_unpack(q, end, n, e->ts_min, buf)) return -1;
+        c->ts = buf->ts;  c->run = buf->run;  c->wait = buf->wait;
+        c->pid = buf->pid;  c->aux = buf->aux;  c->cpu = buf->cpu;  c->type = buf->type;
+        return 0;
+    }
+
+    if (e->bytes != cap_payload_bytes(n)) return -1;
+    c->ts   = (const void *)p;  p += n * sizeof(uint64_t);
+    c->run  = (const void *)p;  p += n * sizeof(uint64_t);
+    c->wait = (const void *)p;  p += n * sizeof(uint64_t);
+    c->pid  = (const void *)p;  p += n * sizeof(uint32_t);
+    c->aux  = (const void *)p;  p += n * sizeof(uint32_t);
+    c->cpu  = (const void *)p;  p += n * sizeof(int32_t);
+    c->type = (const void *)p;
+    return 0;
+}
+
+static long cap_scan_block(const struct cap_file *cf, uint64_t bi, uint32_t pid,
+                           uint64_t t1, uint64_t t2, cap_row_fn fn, void *ctx,
+                           struct cap_buf *buf) {
+    const struct cap_blk_ent *e = &cf->dir[bi];
+    struct cap_cols c;
+
+    if (e->ts_max < t1 || e->ts_min > t2) return 0;
+    if (cap_block(cf, bi, &c, buf)) return -1;
+    for (uint32_t i = 0; i < c.n; i++) {
+        if (c.ts[i] < t1 || c.ts[i] > t2) continue;
+        if (pid && c.pid[i] != pid && c.aux[i] != pid) continue;
+        struct cap_row r = { c.ts[i], c.run[i], c.wait[i], c.pid[i], c.aux[i], c.cpu[i], c.type[i] };
+        if (fn(&r, ctx)) return -1;
+    }
+    return 1;
+}
+
+long cap_query(const struct cap_file *cf, uint32_t pid, uint64_t t1, uint64_t t2,
+               cap_row_fn fn, void *ctx) {
+    struct cap_buf *buf = NULL;
+    long nread = 0, r;
+
+    if ((cf->flags & CAP_F_DELTA) && !(buf = calloc(1, sizeof(*buf)))) return -1;
+
+    if (pid && cf->pidx) {
+        uint64_t lo = 0, hi = cf->npids;
+        while (lo < hi) {
+            uint64_t mid = (lo + hi) / 2;
+            if (cf->pidx[mid].pid < pid) lo = mid + 1;
+            else                         hi = mid;
+        }
+        if (lo == cf->npids || cf->pidx[lo].pid != pid) goto out;
+        const struct cap_pid_ent *pe = &cf->pidx[lo];
+        if (pe->first + pe->nblocks > cf->nrefs) { nread = -1; goto out; }
+        for (uint64_t k = 0; k < pe->nblocks; k++) {
+            uint64_t bi = cf->blist[pe->first + k];
+            if ((r = cap_scan_block(cf, bi, pid, t1, t2, fn, ctx, buf)) < 0) { nread = -1; goto out; }
+            nread += r;
+        }
+        goto out;
+    }
+    for (uint64_t bi = 0; bi < cf->nblocks; bi++) {
+        if ((r = cap_scan_block(cf, bi, pid, t1, t2, fn, ctx, buf)) < 0) { nread = -1; goto out; }
+        nread += r;
+    }
+out:
+    cap_buf_free(buf);
+    return nread;
+}
+
+/* ---- CLI --------------------------------------------------------------- */
+struct query_ctx { uint64_t matched; int count_only; };
+
+static int query_print(const struct cap_row *r, void *arg) {
+    struct query_ctx *q = arg;
+    q->matched++;
+    if (!q->count_only)
+        printf("%" PRIu64 ",%s,%u,%u,%d,%" PRIu64 ",%" PRIu64 "\n", r->ts_ns,
+            cap_type_name(r->type), r->pid, r->aux, r->cpu, r->run_ns, r->wait_ns);
+    return 0;
+}
+
+/* "123456789" is an absolute ts_ns; "2.5s" is seconds after the first event. */
+static int parse_ts(const char *s, uint64_t base, uint64_t *out) {
+    char *end;
+    double v = strtod(s, &end);
+    if (end == s || v < 0) return -1;
+    if (*end == 's' && !end[1]) { *out = base + (uint64_t)(v * 1e9); return 0; }
+    if (*end) return -1;
+    *out = strtoull(s, NULL, 10);
+    return 0;
+}
+
+static void query_usage(void) {
+    fprintf(stderr,
+        "Usage: schedlab query [--pid N] [--from T] [--to T] [--count] FILE.cap\n"
+        "  T is an absolute ts_ns, or e.g. 2.5s for seconds after the first event.\n");
+}
+
+int query_main(int argc, char **argv) {
+    const char *from = NULL, *to = NULL;
+    struct query_ctx q = { 0 };
+    struct cap_file cf;
+    uint32_t pid = 0;
+    uint64_t t1 = 0, t2 = UINT64_MAX, t0 = 0;
+    long nread;
+    int i;
+
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (!strcmp(argv[i], "--pid") && i+1 < argc) pid = (uint32_t)atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--from") && i+1 < argc) from = argv[++i];
+        else if (!strcmp(argv[i], "--to") && i+1 < argc) to = argv[++i];
+        else if (!strcmp(argv[i], "--count")) q.count_only = 1;
+        else { query_usage(); return 1; }
+    }
+    if (argc - i != 1) { query_usage(); return 1; }
+    if (cap_map(argv[i], &cf)) return 1;
+
+    if (cf.nblocks) {
+        t0 = cf.dir[0].ts_min;
+        for (uint64_t b = 1; b < cf.nblocks; b++)
+            if (cf.dir[b].ts_min < t0) t0 = cf.dir[b].ts_min;
+    }
+    if ((from && parse_ts(from, t0, &t1)) || (to && parse_ts(to, t0, &t2))) {
+        query_usage();
+        cap_unmap(&cf);
+        return 1;
+    }
+
+    if (!q.count_only) printf("ts_ns,event,pid,aux,cpu,run_ns,wait_ns\n");
+    nread = cap_query(&cf, pid, t1, t2, query_print, &q);
+    if (nread < 0)
+        fprintf(stderr, "query: corrupt block in %s\n", argv[i]);
+    else
+        fprintf(stderr, "rows=%" PRIu64 " blocks_read=%ld/%" PRIu64 "\n", q.matched, nread, cf.nblocks);
+    if (q.count_only) printf("%" PRIu64 "\n", q.matched);
+    cap_unmap(&cf);
+    return nread < 0;
+}
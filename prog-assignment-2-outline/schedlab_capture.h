@@ -0,0 +1,143 @@
+// schedlab/schedlab_capture.h
+// SPDX-License-Identifier: MIT
+#ifndef SCHEDLAB_CAPTURE_H
+#define SCHEDLAB_CAPTURE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/* ---- Columnar capture (--capture FILE) ----------------------------------
+ * File layout:
+ *   struct cap_hdr
+ *   block*          struct cap_blk_hdr + columns, 8-byte aligned
+ *   footer          block directory, PID index, PID->block lists
+ *   struct cap_trailer
+ * Columns in a block, each nrows long: ts, run, wait (u64), pid, aux (u32),
+ * cpu (s32), type (u8). `aux` is the other PID of the event: prev_pid for
+ * SWITCH, parent for FORK, ppid for LIFE. Both pid and aux are indexed.
+ *
+ * With CAP_F_DELTA (version 2) the payload is packed instead:
+ *   varint ndict, varint dict[] (sorted, delta coded)     pid dictionary
+ *   zigzag varint ts deltas, starting from ts_min
+ *   type[n] bytes
+ *   varint dict index for pid[], then aux[]
+ *   zigzag varint cpu[], varint run[], varint wait[]
+ * and with CAP_F_ZSTD that is stored as u32 packed length + one zstd frame.
+ * `bytes` is the exact stored length; blocks start 8-byte aligned.
+ */
+#define CAP_MAGIC       "SCHEDCAP"
+#define CAP_TRAILER     "CAPINDEX"
+#define CAP_VERSION     2
+#define CAP_BLOCK_ROWS  4096
+
+#define CAP_F_DELTA     (1u << 0)
+#define CAP_F_ZSTD      (1u << 1)
+
+enum cap_enc { CAP_ENC_RAW = 0, CAP_ENC_DELTA, CAP_ENC_ZSTD };
+
+struct cap_hdr {
+    char     magic[8];
+    uint32_t version;
+    uint32_t block_rows;
+    uint64_t flags;      /* CAP_F_* */
+};
+
+struct cap_blk_hdr {
+    uint32_t nrows;
+    uint32_t bytes;      /* payload after this header */
+    uint64_t ts_min, ts_max;
+};
+
+struct cap_blk_ent {
+    uint64_t off;        /* of struct cap_blk_hdr */
+    uint64_t ts_min, ts_max;
+    uint32_t nrows;
+    uint32_t bytes;
+};
+
+struct cap_pid_ent {
+    uint32_t pid;
+    uint32_t nblocks;
+    uint64_t first;      /* index into the block list */
+};
+
+struct cap_trailer {
+    uint64_t dir_off, nblocks;
+    uint64_t pidx_off, npids;
+    uint64_t blist_off, nrefs;
+    uint64_t rows;
+    char     magic[8];
+};
+
+/* One decoded event. */
+struct cap_row {
+    uint64_t ts_ns, run_ns, wait_ns;
+    uint32_t pid, aux;
+    int32_t  cpu;
+    uint8_t  type;       /* EV_* */
+};
+
+/* ---- Writer ---- */
+struct cap_writer;
+
+struct cap_writer *cap_open(const char *path, enum cap_enc enc);
+int  cap_parse_enc(const char *s, enum cap_enc *out);
+int  cap_append(struct cap_writer *w, const struct cap_row *r);
+int  cap_close(struct cap_writer *w);     /* flushes and writes the index */
+uint64_t cap_bytes(const struct cap_writer *w);   /* written so far, for rotation */
+
+/* ---- Reader ---- */
+struct cap_cols {
+    uint32_t        n;
+    const uint64_t *ts, *run, *wait;
+    const uint32_t *pid, *aux;
+    const int32_t  *cpu;
+    const uint8_t  *type;
+};
+
+/* Decode space for one block; one per reading thread. */
+struct cap_buf {
+    uint64_t ts[CAP_BLOCK_ROWS], run[CAP_BLOCK_ROWS], wait[CAP_BLOCK_ROWS];
+    uint32_t pid[CAP_BLOCK_ROWS], aux[CAP_BLOCK_ROWS];
+    int32_t  cpu[CAP_BLOCK_ROWS];
+    uint8_t  type[CAP_BLOCK_ROWS];
+    uint32_t dict[2 * CAP_BLOCK_ROWS];
+    char    *z;          /* zstd output */
+    size_t   zcap;
+};
+
+void cap_buf_free(struct cap_buf *b);
+
+struct cap_file {
+    const char               *base;
+    size_t                    size;
+    uint64_t                  flags;   /* CAP_F_* from the header */
+    const struct cap_blk_ent *dir;
+    uint64_t                  nblocks;
+    const struct cap_pid_ent *pidx;    /* NULL if the capture was not closed */
+    uint64_t                  npids;
+    const uint32_t           *blist;
+    uint64_t                  nrefs;
+    uint64_t                  rows;
+    struct cap_blk_ent       *own_dir; /* rebuilt directory for unclosed files */
+};
+
+int  cap_is_capture(const char *path);
+int  cap_map(const char *path, struct cap_file *cf);
+void cap_unmap(struct cap_file *cf);
+/* Column pointers for block bi: into the mapping for raw captures,
+ * otherwise into buf after decoding. */
+int  cap_block(const struct cap_file *cf, uint64_t bi, struct cap_cols *c, struct cap_buf *buf);
+
+/* Calls fn for each row with ts in [t1, t2] touching pid (pid or aux),
+ * or every row if pid == 0. Only blocks that may match are read.
+ * Returns the number of blocks read, or -1. */
+typedef int (*cap_row_fn)(const struct cap_row *r, void *ctx);
+long cap_query(const struct cap_file *cf, uint32_t pid, uint64_t t1, uint64_t t2,
+               cap_row_fn fn, void *ctx);
+
+const char *cap_type_name(uint8_t type);
+int query_main(int argc, char **argv);
+
+#endif /* SCHEDLAB_CAPTURE_H */
@@ -0,0 +1,315 @@
+// schedlab/schedlab_sym.c
+// SPDX-License-Identifier: MIT
+//
+// Cached kallsyms/ELF symbolizer for the stack ids schedlab collects
+// (--stacks, offcpu-flame). Everything is loaded lazily and kept for the
+// life of the cache: kallsyms once, each ELF file once, each PID's maps
+// until sym_forget.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <elf.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "schedlab_sym.h"
+#include "schedlab_analyze.h"   /* u64map */
+
+struct sym_ent {
+    uint64_t addr, size;
+    uint32_t name;            /* offset into the owner's name pool */
+};
+
+struct sym_tab {
+    struct sym_ent *e;
+    size_t          n, cap;
+    char           *names;
+    size_t          nlen, ncap;
+};
+
+#define SYM_LOADS 8
+
+struct sym_load {
+    uint64_t off, vaddr, size;   /* executable PT_LOAD: file range -> link-time address */
+};
+
+struct sym_elf {
+    dev_t          dev;
+    ino_t          ino;
+    char          *base;      /* "[file]" label */
+    struct sym_tab tab;
+    struct sym_load load[SYM_LOADS];
+    int            nload;
+};
+
+struct sym_vma {
+    uint64_t start, end, pgoff;
+    int      elf;             /* index into cache->elfs, -1 = not an ELF we could read */
+};
+
+struct sym_proc {
+    struct sym_vma *v;
+    size_t          n;
+    int             loaded;
+};
+
+struct sym_cache {
+    struct sym_tab  ksyms;
+    int             ksyms_loaded;
+    struct sym_elf *elfs;
+    size_t          nelfs, cap;
+    struct u64map   procs;    /* pid -> struct sym_proc */
+};
+
+/* ---- Symbol tables ------------------------------------------------------ */
+static int tab_add(struct sym_tab *t, uint64_t addr, uint64_t size, const char *name) {
+    size_t len = strlen(name) + 1;
+
+    if (t->n == t->cap) {
+        size_t cap = t->cap ? 2 * t->cap : 1024;
+        struct sym_ent *e = realloc(t->e, cap * sizeof(*e));
+        if (!e) return -1;
+        t->e = e;
+        t->cap = cap;
+    }
+    if (t->nlen + len > t->ncap) {
+        size_t cap = t->ncap ? 2 * t->ncap : 16384;
+        while (cap < t->nlen + len) cap *= 2;
+        char *p = realloc(t->names, cap);
+        if (!p) return -1;
+        t->names = p;
+        t->ncap = cap;
+    }
+    memcpy(t->names + t->nlen, name, len);
+    t->e[t->n++] = (struct sym_ent){ .addr = addr, .size = size, .name = (uint32_t)t->nlen };
+    t->nlen += len;
+    return 0;
+}
+
+static int cmp_sym(const void *a, const void *b) {
+    const struct sym_ent *x = a, *y = b;
+    return (x->addr > y->addr) - (x->addr < y->addr);
+}
+
+/* Last symbol at or below addr; size 0 (kallsyms) means "up to the next one". */
+static const char *tab_find(const struct sym_tab *t, uint64_t addr) {
+    size_t lo = 0, hi = t->n;
+
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (t->e[mid].addr <= addr) lo = mid + 1;
+        else                        hi = mid;
+    }
+    if (!lo) return NULL;
+    const struct sym_ent *s = &t->e[lo - 1];
+    if (s->size && addr >= s->addr + s->size) return NULL;
+    return t->names + s->name;
+}
+
+static void tab_free(struct sym_tab *t) {
+    free(t->e);
+    free(t->names);
+    memset(t, 0, sizeof(*t));
+}
+
+/* ---- Kernel ------------------------------------------------------------- */
+static void ksyms_load(struct sym_cache *c) {
+    char line[512], name[256], type;
+    unsigned long long addr;
+    int nonzero = 0;
+    FILE *f;
+
+    c->ksyms_loaded = 1;
+    if (!(f = fopen("/proc/kallsyms", "r"))) return;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "%llx %c %255s", &addr, &type, name) != 3) continue;
+        if (type != 't' && type != 'T' && type != 'w' && type != 'W') continue;
+        nonzero |= addr != 0;
+        if (tab_add(&c->ksyms, addr, 0, name)) break;
+    }
+    fclose(f);
+    if (!nonzero) {            /* kptr_restrict: every address reads as 0 */
+        tab_free(&c->ksyms);
+        return;
+    }
+    qsort(c->ksyms.e, c->ksyms.n, sizeof(*c->ksyms.e), cmp_sym);
+}
+
+const char *sym_kernel(struct sym_cache *c, uint64_t addr) {
+    const char *s;
+
+    if (!c->ksyms_loaded) ksyms_load(c);
+    s = tab_find(&c->ksyms, addr);
+    return s ? s : "[unknown]";
+}
+
+/* ---- ELF ---------------------------------------------------------------- */
+static void elf_syms(struct sym_elf *el, const uint8_t *p, size_t len) {
+    const Elf64_Ehdr *eh = (const Elf64_Ehdr *)p;
+    const Elf64_Shdr *sh, *symsh = NULL;
+
+    if (len < sizeof(*eh) || memcmp(eh->e_ident, ELFMAG, SELFMAG) || eh->e_ident[EI_CLASS] != ELFCLASS64)
+        return;
+    if (eh->e_phoff + (uint64_t)eh->e_phnum * sizeof(Elf64_Phdr) <= len) {
+        const Elf64_Phdr *ph = (const Elf64_Phdr *)(p + eh->e_phoff);
+        for (int i = 0; i < eh->e_phnum && el->nload < SYM_LOADS; i++)
+            if (ph[i].p_type == PT_LOAD && (ph[i].p_flags & PF_X))
+                el->load[el->nload++] = (struct sym_load){ ph[i].p_offset, ph[i].p_vaddr, ph[i].p_filesz };
+    }
+    if (!eh->e_shoff || eh->e_shoff + (uint64_t)eh->e_shnum * sizeof(Elf64_Shdr) > len) return;
+    sh = (const Elf64_Shdr *)(p + eh->e_shoff);
+    for (int i = 0; i < eh->e_shnum; i++) {
+        if (sh[i].sh_type == SHT_SYMTAB) { symsh = &sh[i]; break; }
+        if (sh[i].sh_type == SHT_DYNSYM) symsh = &sh[i];
+    }
+    if (!symsh || symsh->sh_link >= eh->e_shnum) return;
+
+    const Elf64_Shdr *strsh = &sh[symsh->sh_link];
+    if (symsh->sh_offset + symsh->sh_size > len || strsh->sh_offset + strsh->sh_size > len) return;
+    const Elf64_Sym *sym = (const Elf64_Sym *)(p + symsh->sh_offset);
+    const char *str = (const char *)(p + strsh->sh_offset);
+    size_t nsym = symsh->sh_size / sizeof(*sym);
+
+    for (size_t i = 0; i < nsym; i++) {
+        if (ELF64_ST_TYPE(sym[i].st_info) != STT_FUNC || !sym[i].st_value) continue;
+        if (sym[i].st_name >= strsh->sh_size || !str[sym[i].st_name]) continue;
+        if (memchr(str + sym[i].st_name, '\0', strsh->sh_size - sym[i].st_name) == NULL) continue;
+        if (tab_add(&el->tab, sym[i].st_value, sym[i].st_size, str + sym[i].st_name)) break;
+    }
+    qsort(el->tab.e, el->tab.n, sizeof(*el->tab.e), cmp_sym);
+}
+
+/* Index of the cached ELF for path as seen by pid, loading it if new. */
+static int elf_get(struct sym_cache *c, uint32_t pid, const char *path) {
+    char root[PATH_MAX + 32];
+    const char *slash = strrchr(path, '/');
+    struct stat st;
+    int fd;
+
+    snprintf(root, sizeof(root), "/proc/%u/root%s", pid, path);
+    if ((fd = open(root, O_RDONLY | O_CLOEXEC)) < 0 && (fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+        return -1;
+    if (fstat(fd, &st) || !S_ISREG(st.st_mode)) { close(fd); return -1; }
+    for (size_t i = 0; i < c->nelfs; i++)
+        if (c->elfs[i].dev == st.st_dev && c->elfs[i].ino == st.st_ino) { close(fd); return (int)i; }
+
+    if (c->nelfs == c->cap) {
+        size_t cap = c->cap ? 2 * c->cap : 64;
+        struct sym_elf *e = realloc(c->elfs, cap * sizeof(*e));
+        if (!e) { close(fd); return -1; }
+        c->elfs = e;
+        c->cap = cap;
+    }
+    struct sym_elf *el = &c->elfs[c->nelfs];
+    memset(el, 0, sizeof(*el));
+    el->dev = st.st_dev;
+    el->ino = st.st_ino;
+    slash = slash ? slash + 1 : path;
+    if ((el->base = malloc(strlen(slash) + 3))) sprintf(el->base, "[%s]", slash);
+    if (st.st_size > 0) {
+        void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            elf_syms(el, p, (size_t)st.st_size);
+            munmap(p, (size_t)st.st_size);
+        }
+    }
+    close(fd);
+    return (int)c->nelfs++;
+}
+
+/* ---- Processes ---------------------------------------------------------- */
+static void proc_load(struct sym_cache *c, uint32_t pid, struct sym_proc *pr) {
+    char path[64], line[PATH_MAX + 128], perms[8], file[PATH_MAX];
+    unsigned long long start, end, pgoff, inode;
+    size_t cap = 0;
+    FILE *f;
+
+    pr->loaded = 1;
+    snprintf(path, sizeof(path), "/proc/%u/maps", pid);
+    if (!(f = fopen(path, "r"))) return;
+    while (fgets(line, sizeof(line), f)) {
+        file[0] = '\0';
+        if (sscanf(line, "%llx-%llx %7s %llx %*s %llu %4095[^\n]", &start, &end, perms, &pgoff,
+                   &inode, file) < 5)
+            continue;
+        if (perms[2] != 'x' || file[0] != '/') continue;
+        char *del = strstr(file, " (deleted)");
+        if (del) *del = '\0';
+        if (pr->n == cap) {
+            cap = cap ? 2 * cap : 32;
+            struct sym_vma *v = realloc(pr->v, cap * sizeof(*v));
+            if (!v) break;
+            pr->v = v;
+        }
+        pr->v[pr->n++] = (struct sym_vma){ start, end, pgoff, elf_get(c, pid, file) };
+    }
+    fclose(f);
+}
+
+const char *sym_user(struct sym_cache *c, uint32_t pid, uint64_t addr) {
+    struct sym_proc *pr = u64map_get(&c->procs, pid);
+
+    if (!pr) return "[unknown]";
+    if (!pr->loaded) proc_load(c, pid, pr);
+    for (size_t i = 0; i < pr->n; i++) {
+        const struct sym_vma *v = &pr->v[i];
+        if (addr < v->start || addr >= v->end) continue;
+        if (v->elf < 0) return "[unknown]";
+
+        const struct sym_elf *el = &c->elfs[v->elf];
+        uint64_t off = addr - v->start + v->pgoff;
+        for (int j = 0; j < el->nload; j++) {
+            if (off < el->load[j].off || off >= el->load[j].off + el->load[j].size) continue;
+            const char *s = tab_find(&el->tab, off - el->load[j].off + el->load[j].vaddr);
+            if (s) return s;
+        }
+        return el->base ? el->base : "[unknown]";
+    }
+    return "[unknown]";
+}
+
+void sym_forget(struct sym_cache *c, uint32_t pid) {
+    struct sym_proc *pr = u64map_find(&c->procs, pid);
+    if (!pr) return;
+    free(pr->v);
+    memset(pr, 0, sizeof(*pr));
+}
+
+void sym_fold(struct sym_cache *c, FILE *f, uint32_t pid, const uint64_t *ips, size_t n,
+              int kernel) {
+    size_t depth = 0;
+
+    while (depth < n && ips[depth]) depth++;
+    while (depth--) {
+        if (kernel) fprintf(f, ";%s_[k]", sym_kernel(c, ips[depth]));
+        else        fprintf(f, ";%s", sym_user(c, pid, ips[depth]));
+    }
+}
+
+/* ---- Cache -------------------------------------------------------------- */
+struct sym_cache *sym_new(void) {
+    struct sym_cache *c = calloc(1, sizeof(*c));
+    if (c && u64map_init(&c->procs, sizeof(struct sym_proc))) {
+        free(c);
+        return NULL;
+    }
+    return c;
+}
+
+void sym_free(struct sym_cache *c) {
+    if (!c) return;
+    for (size_t i = 0; i < c->procs.cap; i++)
+        if (c->procs.keys[i]) free(((struct sym_proc *)(c->procs.vals + i * c->procs.vsz))->v);
+    u64map_free(&c->procs);
+    for (size_t i = 0; i < c->nelfs; i++) {
+        tab_free(&c->elfs[i].tab);
+        free(c->elfs[i].base);
+    }
+    free(c->elfs);
+    tab_free(&c->ksyms);
+    free(c);
+}
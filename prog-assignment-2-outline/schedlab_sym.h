@@ -0,0 +1,40 @@
+// schedlab/schedlab_sym.h
+// SPDX-License-Identifier: MIT
+#ifndef SCHEDLAB_SYM_H
+#define SCHEDLAB_SYM_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/* ---- Stack symbolization -------------------------------------------------
+ * Kernel addresses resolve against /proc/kallsyms, read on first use.
+ * User addresses go through /proc/PID/maps (read once per PID, until
+ * sym_forget) to a file offset in an executable mapping, then through the
+ * file's PT_LOAD headers to a link-time address looked up in .symtab, or
+ * .dynsym for stripped files. Each ELF file is parsed once per cache,
+ * keyed by device and inode, so every process sharing libc shares one
+ * table. Names are the raw (possibly mangled) symbol names; a frame that
+ * maps to a file without a matching symbol prints as "[file]", anything
+ * else as "[unknown]".
+ */
+struct sym_cache;
+
+struct sym_cache *sym_new(void);
+void              sym_free(struct sym_cache *c);
+
+/* Returned names stay valid until sym_free. */
+const char *sym_kernel(struct sym_cache *c, uint64_t addr);
+const char *sym_user(struct sym_cache *c, uint32_t pid, uint64_t addr);
+
+/* Drop PID's cached mappings (exec, exit, pid reuse). */
+void sym_forget(struct sym_cache *c, uint32_t pid);
+
+/* ips[] as bpf_get_stackid() stores them: leaf first, 0-terminated if
+ * shorter than n. Writes ";frame" per frame, root first, so the caller
+ * can put its own root label in front. Kernel frames get the "_[k]"
+ * suffix flamegraph.pl colours as kernel code. */
+void sym_fold(struct sym_cache *c, FILE *f, uint32_t pid, const uint64_t *ips, size_t n,
+              int kernel);
+
+#endif
@@ -7,10 +7,26 @@
 #include <unistd.h>
 #include <errno.h>
 #include <inttypes.h>
+#include <time.h>
+#include <math.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <dirent.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <stdarg.h>
 
 #include <bpf/libbpf.h>
 #include <bpf/bpf.h>
 #include "schedlab.skel.h"   // generated from schedlab.bpf.o
+#include "schedlab_analyze.h"
+#include "schedlab_capture.h"
+#include "schedlab_sym.h"
 
 /* ---- CLI modes (6 tasks only) ----------------------------------------- */
 enum mode {
@@ -20,15 +36,28 @@ enum mode {
     MODE_CTX,          // Task 3
     MODE_TIMELINE,     // Task 4
     MODE_SHORTLONG,    // Task 5
-    MODE_STARVATION    // Task 6
+    MODE_STARVATION,   // Task 6
+    MODE_UTIL,         // per-CPU busy/idle from cpu_state
+    MODE_CPUSERIES,    // per-CPU bucketed time series from cpu_buckets
+    MODE_HEATMAP,      // time x log-latency matrix from heat
+    MODE_CLASSES,      // latency/run/fairness by policy and priority
+    MODE_TOP,          // live per-PID/cgroup view from agg_by_pid deltas
+    MODE_EXPORT,       // OpenMetrics endpoint / textfile from kernel aggregates
+    MODE_OFFCPU,       // folded blocked-time stacks from offcpu_stacks
+    MODE_INTERF,       // (victim, preemptor) pairs from interference
+    MODE_WAKES,        // wakeup placement by topology domain from wake_hist/wake_pairs
+    MODE_TOPO,         // per-CPU metrics by core/LLC/node, off-home-node run time per PID
+    MODE_SMT           // run time with the SMT sibling busy/idle, co-running pairs
 };
 
 static const char *mode_names[] = {
-    "stream","latency","fairness","ctx","timeline","shortlong","starvation"
+    "stream","latency","fairness","ctx","timeline","shortlong","starvation","util","cpuseries","heatmap","classes","top","export",
+    "offcpu-flame","interference","wakeups","topology","smt"
 };
+#define N_MODES ((int)(sizeof(mode_names)/sizeof(mode_names[0])))
 
 static enum mode parse_mode(const char *s) {
-    for (int i=0;i<(int)(sizeof(mode_names)/sizeof(mode_names[0]));++i)
+    for (int i=0;i<N_MODES;++i)
         if (strcmp(s, mode_names[i])==0) return (enum mode)i;
     return MODE_STREAM;
 }
@@ -39,7 +68,11 @@ enum ev_type {
     EV_SWITCH   = 2,
     EV_EXEC     = 3,
     EV_EXIT     = 4,
+    EV_FORK     = 5,
     EV_WAITLONG = 6,
+    EV_LIFE     = 7,
+    EV_MARK     = 8,
+    EV_REQ      = 9,
 };
 
 struct ev_switch_payload {
@@ -50,30 +83,226 @@ struct ev_switch_payload {
     __s32 prev_cpu, next_cpu;
 };
 
+enum wait_rule_kind {
+    RULE_GLOBAL = 0,
+    RULE_PID    = 1,
+    RULE_CGROUP = 2,
+    RULE_POLICY = 3,
+    RULE_NICE   = 4,
+};
+
+struct ev_waitlong_payload {
+    __u64 wait_ns;
+    __u64 threshold_ns;
+    __u32 rule_kind;
+    __u32 rule_id;
+    __s32 kstack, ustack;
+    __s32 run_kstack, run_ustack;
+    __u32 run_pid;
+    __u32 stack_gen;
+    char  run_comm[16];
+};
+
+enum life_origin { LIFE_UNKNOWN = 0, LIFE_FORK = 1, LIFE_EXEC = 2 };
+static const char *life_origin_names[] = { "unknown", "fork", "exec" };
+
+struct ev_life_payload {
+    __u64 lifetime_ns;
+    __u64 run_ns;
+    __u64 wait_ns;
+    __u64 wakes;
+    __u64 switches;
+    __u32 origin;
+    __u32 ppid;
+};
+
+struct ev_fork_payload {
+    __u32 parent_pid;
+    __u32 child_pid;
+};
+
+#define MARK_NAME_LEN 32
+struct ev_mark_payload {
+    char name[MARK_NAME_LEN];
+};
+
+struct ev_req_payload {
+    __u64 latency_ns;
+    __u64 run_ns;
+    __u64 wait_ns;
+    __u64 off_ns;
+    __u32 switches;
+    __u32 _pad;
+};
+
 struct event {
     __u64 ts_ns;
     __u32 type;
     __u32 pid;
     char  comm[16];
     union {
-        struct ev_switch_payload  sw;
+        struct ev_switch_payload    sw;
+        struct ev_waitlong_payload  wl;
+        struct ev_life_payload      life;
+        struct ev_fork_payload      fork;
+        struct ev_mark_payload      mark;
+        struct ev_req_payload       req;
     } u;
 };
 
+/* Must match struct wait_rule_key / struct wait_rule in schedlab.bpf.c */
+struct wait_rule_key {
+    __u32 kind;
+    __u32 _pad;
+    __u64 id;
+};
+
+struct wait_rule {
+    __u64 threshold_ns;
+    __u32 rule_id;
+    __u32 _pad;
+};
+
+/* Must match struct cpu_state in schedlab.bpf.c (per-CPU value) */
+struct cpu_state {
+    __u32 curr_pid;
+    __u32 _pad;
+    __u64 since_ns;
+    __u64 busy_ns;
+    __u64 idle_ns;
+    __u64 switches;
+    __u32 victim_pid;
+    __u32 _pad2;
+    __u64 victim_cgid;
+};
+
+/* Must match struct cpu_bucket / CPU_BUCKETS in schedlab.bpf.c */
+#define CPU_BUCKETS 256
+struct cpu_bucket {
+    __u64 idx;
+    __u64 busy_ns;
+    __u64 idle_ns;
+    __u64 switches;
+    __u64 nr_running_sum;
+};
+
+/* Must match LAT_BUCKETS / enum heat_metric / struct heat_col in schedlab.bpf.c */
+#define LAT_BUCKETS 32
+enum heat_metric { HEAT_WAIT = 0, HEAT_RUN, HEAT_OFFCPU, HEAT_METRICS };
+static const char *heat_names[HEAT_METRICS] = { "wait", "run", "offcpu" };
+
+struct heat_col {
+    __u64 cnt[HEAT_METRICS][LAT_BUCKETS];
+};
+
+/* Must match struct lat_hist / struct comm_key / struct pid_lat in schedlab.bpf.c */
+struct lat_hist {
+    __u64 count;
+    __u64 sum_ns;
+    __u64 max_ns;
+    __u64 slots[LAT_BUCKETS];
+};
+
+struct comm_key {
+    char comm[16];
+};
+
+struct pid_lat {
+    struct lat_hist h;
+    char comm[16];
+};
+
+/* Must match enum req_hist_kind in schedlab.bpf.c (req_hist index) */
+enum { REQ_H_LATENCY = 0, REQ_H_WAIT, REQ_H_RUN, REQ_H_OFFCPU, REQ_HISTS };
+static const char *req_hist_names[REQ_HISTS] = { "latency", "wait", "run", "offcpu" };
+
+/* Must match struct agg in schedlab.bpf.c (agg_by_pid value) */
+struct agg {
+    __u64 total_run_ns;
+    __u64 total_wait_ns;
+    __u64 switches;
+    __u64 wakes;
+    __u64 exec_ts_ns;
+    __u64 weight;
+    __u32 policy;
+    __s32 prio;
+    __u64 start_ns;
+    __u32 origin;
+    __u32 ppid;
+    __u64 waitlongs;
+    __u64 cgid;
+    __u64 off_home_ns;
+    __u32 home_node;   /* NUMA node + 1, 0 = unknown */
+    __u32 _pad;
+};
+
+/* Must match struct life_hist / LIFE_BUCKETS in schedlab.bpf.c */
+#define LIFE_BUCKETS 40
+struct life_hist {
+    __u64 count;
+    __u64 sum_ns;
+    __u64 slots[LIFE_BUCKETS];
+};
+
+/* Must match struct class_stats / CLASS_* in schedlab.bpf.c */
+#define CLASS_POLICIES 8
+#define CLASS_PRIOS    141   /* slot 0 = prio -1 */
+struct class_stats {
+    __u64 wakes;
+    __u64 slices;
+    __u64 run_ns;
+    __u64 wait_ns;
+    __u64 waits;
+    __u64 wait_slots[LAT_BUCKETS];
+    __u64 run_slots[LAT_BUCKETS];
+};
+
+static const char *policy_names[CLASS_POLICIES] = {
+    "normal", "fifo", "rr", "batch", "iso", "idle", "deadline", "ext"
+};
+
 /* This struct must match the one in schedlab.bpf.c */
+#define CFG_F_NO_EVENTS   (1u << 0)
+#define CFG_F_CPU_SERIES  (1u << 1)
+#define CFG_F_HEATMAP     (1u << 2)
+#define CFG_F_LAT_PID     (1u << 3)
+#define CFG_F_LAT_COMM    (1u << 4)
+#define CFG_F_CLASS       (1u << 5)
+#define CFG_F_NO_GLOBAL   (1u << 6)
+#define CFG_F_LIFE        (1u << 7)
+#define CFG_F_CGID        (1u << 8)
+#define CFG_F_REQ         (1u << 9)
+#define CFG_F_STACKS      (1u << 10)
+#define CFG_F_OFFCPU      (1u << 11)
+#define CFG_F_INTERF      (1u << 12)
+#define CFG_F_WAKES       (1u << 13)
+#define CFG_F_TOPO        (1u << 14)
+#define CFG_F_SMT         (1u << 15)
+
 struct cfg {
     __u64 wait_alert_ns;
     __u32 sample_filter_pid;
+    __u32 flags;
+    __u64 bucket_ns;
+    __u32 heat_slot;
+    __u32 heat_mask;
+    __u32 rule_kinds;
+    __u32 stack_gen;
+    __u64 life_cutoff_ns;
 };
 
 /* ---- Simple per-pid aggregates ---------------------------------------- */
 struct agg_user {
     __u64 total_run_ns, total_wait_ns, switches, wakes;
-    __u64 first_exec_ns, last_seen_ns;
+    __u32 pid;   /* last pid to use the slot, for dumps */
 };
 #define HSIZE 65536
 static struct agg_user agg_tbl[HSIZE];
-static inline struct agg_user* A(__u32 pid) { return &agg_tbl[pid % HSIZE]; }
+static inline struct agg_user* A(__u32 pid) {
+    struct agg_user *a = &agg_tbl[pid % HSIZE];
+    a->pid = pid;
+    return a;
+}
 
 /* ---- Globals ----------------------------------------------------------- */
 static volatile sig_atomic_t g_stop = 0;
@@ -82,49 +311,676 @@ static int        g_csv = 0;
 static int        g_csv_header = 0;
 static __u32      g_filter_pid = 0;
 static __u64      g_wait_alert_ns = 5ULL * 1000 * 1000; // 5ms default
+static __u64      g_reorder_ns = 20ULL * 1000 * 1000;   // 20ms default, 0=off
+static __u64      g_bucket_ns  = 10ULL * 1000 * 1000;   // cpuseries bucket width
+static __u64      g_heat_ns    = 1000ULL * 1000 * 1000; // heatmap column width
+static __u32      g_heat_mask  = 1u << HEAT_WAIT;
+static const char *g_svg_path;
+static const char *g_cap_path;
+static struct cap_writer *g_cap;                        // --capture
+static int                g_cap_err;                    // a capture write failed; stop appending
+static enum cap_enc g_cap_enc = CAP_ENC_DELTA;
+static FILE      *g_out;                                // stdout or the --output segment
+static __u64      g_duration_ns;                        // --duration, 0 = until killed
+static enum { LAT_BY_NONE = 0, LAT_BY_PID, LAT_BY_COMM } g_lat_by;
+static int        g_top_n = 20;
+static int        g_ncpus;                              // possible CPUs, per-CPU map width
+static __u64      g_short_ns = 200ULL * 1000 * 1000;    // shortlong cutoff
+static struct cfg g_cfg;                                // last cfg pushed to cfg_map
 
 static void on_sig(int sig) { (void)sig; g_stop = 1; }
 
+/* ---- Starvation threshold rules ----------------------------------------
+ * --wait-rule KIND:TARGET=MS, e.g. pid:1234=2, cgroup:/sys/fs/cgroup/a=5,
+ * policy:fifo=1, nice:19=200. Rule ids are 1-based indexes into g_rules so
+ * alerts can name the rule that fired.
+ */
+#define MAX_WAIT_RULES 64
+
+struct rule_ent {
+    struct wait_rule_key key;
+    struct wait_rule     val;
+    char                 spec[128];
+};
+static struct rule_ent g_rules[MAX_WAIT_RULES];
+static int             g_nrules;
+static int             g_no_global_alert;
+
+static int parse_wait_rule(const char *spec) {
+    char kind[16], target[PATH_MAX];
+    const char *colon = strchr(spec, ':'), *eq = strrchr(spec, '=');
+    struct rule_ent *r;
+    char *end;
+
+    if (g_nrules == MAX_WAIT_RULES || !colon || !eq || eq < colon) return -1;
+    if ((size_t)(colon - spec) >= sizeof(kind) || (size_t)(eq - colon - 1) >= sizeof(target))
+        return -1;
+    memcpy(kind, spec, colon - spec);       kind[colon - spec] = '\0';
+    memcpy(target, colon + 1, eq - colon - 1); target[eq - colon - 1] = '\0';
+
+    double ms = strtod(eq + 1, &end);
+    if (*end || ms <= 0) return -1;
+
+    r = &g_rules[g_nrules];
+    memset(r, 0, sizeof(*r));
+    if (!strcmp(kind, "pid")) {
+        r->key.kind = RULE_PID;
+        r->key.id = strtoull(target, &end, 10);
+        if (*end) return -1;
+    } else if (!strcmp(kind, "cgroup")) {
+        /* cgroup v2 ids are the inode numbers of the cgroup directories */
+        char path[PATH_MAX + 32];
+        struct stat st;
+        if (target[0] == '/') snprintf(path, sizeof(path), "%s", target);
+        else                  snprintf(path, sizeof(path), "/sys/fs/cgroup/%s", target);
+        if (stat(path, &st)) { perror(path); return -1; }
+        r->key.kind = RULE_CGROUP;
+        r->key.id = st.st_ino;
+    } else if (!strcmp(kind, "policy")) {
+        int p;
+        for (p = 0; p < CLASS_POLICIES; p++)
+            if (!strcmp(target, policy_names[p])) break;
+        if (p == CLASS_POLICIES) return -1;
+        r->key.kind = RULE_POLICY;
+        r->key.id = p;
+    } else if (!strcmp(kind, "nice")) {
+        long n = strtol(target, &end, 10);
+        if (*end || n < -20 || n > 19) return -1;
+        r->key.kind = RULE_NICE;
+        r->key.id = (__u64)(n + 20);
+    } else {
+        return -1;
+    }
+    r->val.threshold_ns = (__u64)(ms * 1e6);
+    r->val.rule_id = (__u32)++g_nrules;
+    snprintf(r->spec, sizeof(r->spec), "%s", spec);
+    return 0;
+}
+
+static int rules_push(int fd) {
+    for (int i = 0; i < g_nrules; i++)
+        if (bpf_map_update_elem(fd, &g_rules[i].key, &g_rules[i].val, BPF_ANY))
+            return -1;
+    return 0;
+}
+
+static __u32 rules_kind_mask(void) {
+    __u32 m = 0;
+    for (int i = 0; i < g_nrules; i++) m |= 1u << g_rules[i].key.kind;
+    return m;
+}
+
+static const char *rule_label(const struct ev_waitlong_payload *wl) {
+    if (wl->rule_kind == RULE_GLOBAL || !wl->rule_id || wl->rule_id > (__u32)g_nrules)
+        return "global";
+    return g_rules[wl->rule_id - 1].spec;
+}
+
 /* ---- CSV header printer ----------------------------------------------- */
 static void print_csv_header_once(void) {
     if (!g_csv || !g_csv_header) return;
     switch (g_mode) {
     case MODE_STREAM:
-        puts("ts_ns,type,pid,comm,prev_pid,next_pid,run_ns,wait_ns");
+        fputs("ts_ns,type,pid,comm,prev_pid,next_pid,run_ns,wait_ns\n", g_out);
         break;
     case MODE_LATENCY:
-        puts("ts_ns,pid,latency_ns");
+        if (g_lat_by) return;   /* per-key table prints its own header */
+        fputs("ts_ns,pid,latency_ns\n", g_out);
         break;
     case MODE_FAIRNESS:
-        puts("pid,run_ms,wait_ms,switches");
+        fputs("pid,run_ms,wait_ms,switches\n", g_out);
         break;
     case MODE_CTX:
-        puts("ts_ns,prev_pid,next_pid,run_ns");
+        fputs("ts_ns,prev_pid,next_pid,run_ns\n", g_out);
         break;
     case MODE_TIMELINE:
-        puts("ts_ns,pid,event,wait_ns,run_prev_ns");
+        fputs("ts_ns,pid,event,wait_ns,run_prev_ns\n", g_out);
         break;
     case MODE_SHORTLONG:
-        puts("pid,lifetime_ms,wakes,switches");
+        fputs("pid,lifetime_ms,wakes,switches,run_ms,wait_ms,origin,ppid,comm\n", g_out);
         break;
     case MODE_STARVATION:
-        puts("ts_ns,pid,event");
+        fputs("ts_ns,pid,event,wait_ns,rule\n", g_out);
+        break;
+    case MODE_UTIL:
+        fputs("ts_ns,cpu,busy_ns,idle_ns,util_pct,switches\n", g_out);
+        break;
+    case MODE_CPUSERIES:
+        fputs("bucket_ts_ns,cpu,busy_pct,idle_pct,switches_per_s,runq_avg\n", g_out);
+        break;
+    case MODE_CLASSES:
+        return;   /* two tables, each prints its own header at exit */
+    case MODE_EXPORT:
+    case MODE_OFFCPU:
+        return;   /* folded stacks have no header */
+    case MODE_INTERF:
+    case MODE_WAKES:
+    case MODE_TOPO:
+    case MODE_SMT:
+        return;   /* the exit report prints its own */
+    case MODE_TOP:
+        fputs("ts_ns,key,name,cpu_pct,wait_ms_per_s,switches_per_s,p99_ms,waitlongs\n", g_out);
+        break;
+    case MODE_HEATMAP:
+        /* column bI counts values in [2^I, 2^(I+1)) ns */
+        fputs("ts_ns,metric", g_out);
+        for (int i = 0; i < LAT_BUCKETS; i++) fprintf(g_out, ",b%d", i);
+        fputc('\n', g_out);
         break;
     }
-    fflush(stdout);
+    fflush(g_out);
     g_csv_header = 0;
 }
 
+static __u64 mono_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);   /* same clock as bpf_ktime_get_ns */
+    return (__u64)ts.tv_sec * 1000000000ULL + (__u64)ts.tv_nsec;
+}
+
+/* ---- Output files and rotation -----------------------------------------
+ * --output PATH sends the text/CSV stream to PATH instead of stdout. With
+ * --rotate-size or --rotate-interval, output (and --capture) are cut into
+ * segments named PATH-YYYYmmdd-HHMMSS-N.ext. The open segment is written
+ * as NAME.part. When a segment is cut, the next file is opened first and
+ * the old one is renamed only after that, so a reader never sees a
+ * half-written file. Rotation runs from the poll loop, so events stay
+ * queued in the ring buffer while it happens and none are lost. --keep N
+ * keeps the N newest finished segments of each stream.
+ */
+struct rot_list {
+    char **names;            /* finished segments, oldest first */
+    int    n;
+};
+
+static struct {
+    const char     *out_path;
+    __u64           size_limit;    /* bytes, 0 = off */
+    __u64           interval_ns;   /* 0 = off */
+    __u64           next_ns;
+    int             keep;          /* 0 = keep all */
+    int             header;        /* repeat the CSV header per segment */
+    int             by_phase;      /* new segment at every phase marker */
+    const char     *phase;         /* appended to segment names */
+    unsigned        seq;
+    char            out_name[PATH_MAX], cap_name[PATH_MAX];
+    struct rot_list out_done, cap_done;
+} g_rot;
+
+static int rot_enabled(void) { return g_rot.size_limit || g_rot.interval_ns || g_rot.by_phase; }
+
+/* "256M", "4G", "1048576" */
+static int parse_size(const char *s, __u64 *out) {
+    char *end;
+    double v = strtod(s, &end);
+    if (end == s || v <= 0) return -1;
+    switch (*end) {
+    case 'k': case 'K': v *= 1ULL << 10; end++; break;
+    case 'm': case 'M': v *= 1ULL << 20; end++; break;
+    case 'g': case 'G': v *= 1ULL << 30; end++; break;
+    }
+    if (*end) return -1;
+    *out = (__u64)v;
+    return 0;
+}
+
+/* "500ms", "20s", "10m", "24h"; a bare number is seconds */
+static int parse_duration(const char *s, __u64 *out) {
+    char *end;
+    double v = strtod(s, &end);
+    if (end == s || v <= 0) return -1;
+    if      (!strcmp(end, "ms"))             v *= 1e6;
+    else if (!*end || !strcmp(end, "s"))     v *= 1e9;
+    else if (!strcmp(end, "m"))              v *= 60e9;
+    else if (!strcmp(end, "h"))              v *= 3600e9;
+    else return -1;
+    *out = (__u64)v;
+    return 0;
+}
+
+static void seg_name(const char *path, char *buf, size_t len) {
+    const char *slash = strrchr(path, '/');
+    const char *dot = strrchr(slash ? slash + 1 : path, '.');
+    size_t stem = dot && dot != (slash ? slash + 1 : path) ? (size_t)(dot - path) : strlen(path);
+    char stamp[32];
+    time_t now = time(NULL);
+    struct tm tm;
+
+    localtime_r(&now, &tm);
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm);
+    snprintf(buf, len, "%.*s-%s-%u%s%s%s", (int)stem, path, stamp, g_rot.seq,
+             g_rot.phase ? "-" : "", g_rot.phase ? g_rot.phase : "",
+             stem < strlen(path) ? path + stem : "");
+}
+
+static void rot_finish(const char *name, struct rot_list *l) {
+    char part[PATH_MAX + 8];
+
+    snprintf(part, sizeof(part), "%s.part", name);
+    if (rename(part, name)) { perror(part); return; }
+    char **names = realloc(l->names, (size_t)(l->n + 1) * sizeof(*names));
+    if (!names) return;
+    l->names = names;
+    l->names[l->n++] = strdup(name);
+    while (g_rot.keep && l->n > g_rot.keep) {
+        if (l->names[0] && unlink(l->names[0])) perror(l->names[0]);
+        free(l->names[0]);
+        memmove(l->names, l->names + 1, (size_t)--l->n * sizeof(*l->names));
+    }
+}
+
+static void rot_list_free(struct rot_list *l) {
+    for (int i = 0; i < l->n; i++) free(l->names[i]);
+    free(l->names);
+    memset(l, 0, sizeof(*l));
+}
+
+/* Open the next output/capture segment and retire the current one. */
+static int rot_open(void) {
+    char out_name[PATH_MAX], cap_name[PATH_MAX], part[PATH_MAX + 8];
+    FILE *out = NULL;
+    struct cap_writer *cap = NULL;
+    int rotating = rot_enabled();
+
+    g_rot.seq++;
+    if (g_rot.out_path) {
+        if (rotating) seg_name(g_rot.out_path, out_name, sizeof(out_name));
+        else          snprintf(out_name, sizeof(out_name), "%s", g_rot.out_path);
+        snprintf(part, sizeof(part), rotating ? "%s.part" : "%s", out_name);
+        if (!(out = fopen(part, "w"))) { perror(part); return -1; }
+    }
+    if (g_cap_path && (rotating || !g_cap)) {
+        if (rotating) seg_name(g_cap_path, cap_name, sizeof(cap_name));
+        else          snprintf(cap_name, sizeof(cap_name), "%s", g_cap_path);
+        snprintf(part, sizeof(part), rotating ? "%s.part" : "%s", cap_name);
+        if (!(cap = cap_open(part, g_cap_enc))) { if (out) fclose(out); return -1; }
+    }
+
+    if (out) {
+        if (g_out && g_out != stdout) {
+            if (fclose(g_out)) perror(g_rot.out_name);
+            if (rotating) rot_finish(g_rot.out_name, &g_rot.out_done);
+        }
+        g_out = out;
+        strcpy(g_rot.out_name, out_name);
+        if (g_rot.header) { g_csv_header = 1; print_csv_header_once(); }
+    }
+    if (cap) {
+        if (g_cap) {
+            if (cap_close(g_cap)) fprintf(stderr, "capture %s is incomplete\n", g_rot.cap_name);
+            if (rotating) rot_finish(g_rot.cap_name, &g_rot.cap_done);
+        }
+        g_cap = cap;
+        strcpy(g_rot.cap_name, cap_name);
+    }
+    if (g_rot.interval_ns) g_rot.next_ns = mono_ns() + g_rot.interval_ns;
+    return 0;
+}
+
+static void rot_check(void) {
+    if (!rot_enabled()) return;
+    int due = g_rot.interval_ns && mono_ns() >= g_rot.next_ns;
+    if (!due && g_rot.size_limit) {
+        if (g_out != stdout) {
+            fflush(g_out);
+            due = (__u64)ftello(g_out) >= g_rot.size_limit;
+        }
+        if (!due && g_cap) due = cap_bytes(g_cap) >= g_rot.size_limit;
+    }
+    if (due && rot_open())
+        fprintf(stderr, "rotation failed; still writing the current segment\n");
+}
+
+static void rot_close(void) {
+    int rotating = rot_enabled();
+
+    if (g_out && g_out != stdout) {
+        if (fclose(g_out)) perror(g_rot.out_name);
+        if (rotating) rot_finish(g_rot.out_name, &g_rot.out_done);
+        g_out = stdout;
+    }
+    if (g_cap) {
+        if (cap_close(g_cap)) fprintf(stderr, "capture %s is incomplete\n", g_rot.cap_name);
+        if (rotating) rot_finish(g_rot.cap_name, &g_rot.cap_done);
+        g_cap = NULL;
+    }
+    rot_list_free(&g_rot.out_done);
+    rot_list_free(&g_rot.cap_done);
+}
+
+/* ---- Timestamp-ordered merge stage ------------------------------------
+ * The ring buffer hands us events in reservation order, which can differ
+ * from ts_ns order across CPUs. For stream/timeline output we hold events
+ * in a bounded min-heap and release them once they fall behind the
+ * watermark (now - max delay), so rows come out in strict ts_ns order.
+ * An event that shows up after the watermark already passed it is counted
+ * and emitted at once, out of order: dropping it would lose phase markers
+ * and the local aggregates. Human-readable rows for such events start with
+ * "late"; in CSV they are the rows whose ts_ns is below the row before.
+ */
+#define REORDER_CAP 65536
+
+struct reorder {
+    struct event *heap;    /* min-heap keyed by ts_ns */
+    size_t        len;
+    __u64         max_delay_ns;
+    __u64         last_ts;  /* ts_ns of the last released event */
+    __u64         late;     /* arrived behind the watermark (emitted out of order) */
+    __u64         forced;   /* released early because the heap was full */
+};
+static struct reorder g_ro;
+
+static void emit_event(const struct event *e);
+static void phase_mark(const struct event *e);
+static unsigned g_phase_seq;   /* bumped by every marker; 0 = before the first */
+static int      g_emit_late;   /* emit_event() is handling a late event */
+
+static int reorder_init(__u64 max_delay_ns) {
+    g_ro.heap = calloc(REORDER_CAP, sizeof(*g_ro.heap));
+    if (!g_ro.heap) return -1;
+    g_ro.max_delay_ns = max_delay_ns;
+    return 0;
+}
+
+static void reorder_pop(void) {
+    struct event *h = g_ro.heap;
+    size_t i = 0, n = --g_ro.len;
+
+    g_ro.last_ts = h[0].ts_ns;
+    emit_event(&h[0]);
+    if (!n) return;
+
+    struct event tail = h[n];
+    for (;;) {
+        size_t c = 2*i + 1;
+        if (c >= n) break;
+        if (c+1 < n && h[c+1].ts_ns < h[c].ts_ns) c++;
+        if (tail.ts_ns <= h[c].ts_ns) break;
+        h[i] = h[c];
+        i = c;
+    }
+    h[i] = tail;
+}
+
+static void reorder_push(const struct event *e) {
+    struct event *h = g_ro.heap;
+
+    if (g_ro.last_ts && e->ts_ns < g_ro.last_ts) {
+        g_ro.late++;
+        g_emit_late = 1;
+        emit_event(e);
+        g_emit_late = 0;
+        return;
+    }
+    if (g_ro.len == REORDER_CAP) { g_ro.forced++; reorder_pop(); }
+
+    size_t i = g_ro.len++;
+    while (i) {
+        size_t p = (i - 1) / 2;
+        if (h[p].ts_ns <= e->ts_ns) break;
+        h[i] = h[p];
+        i = p;
+    }
+    h[i] = *e;
+}
+
+/* Release everything at or below the watermark; all=1 flushes on exit. */
+static void reorder_drain(int all) {
+    __u64 now = mono_ns();
+    __u64 wm  = now > g_ro.max_delay_ns ? now - g_ro.max_delay_ns : 0;
+    while (g_ro.len && (all || g_ro.heap[0].ts_ns <= wm))
+        reorder_pop();
+}
+
+static void reorder_report(void) {
+    if (g_ro.late || g_ro.forced)
+        fprintf(stderr, "reorder: %" PRIu64 " late events emitted out of order, %" PRIu64
+            " released early (max delay %" PRIu64 "ms)\n",
+            (uint64_t)g_ro.late, (uint64_t)g_ro.forced,
+            (uint64_t)(g_ro.max_delay_ns/1000000ULL));
+}
+
+static int reorder_wanted(void) {
+    return g_reorder_ns && (g_mode == MODE_STREAM || g_mode == MODE_TIMELINE);
+}
+
+/* ---- Starvation stacks (--stacks DIR) ---------------------------------
+ * With CFG_F_STACKS every switch-out records the task's kernel and user
+ * stack ids in off_start, and an EV_WAITLONG carries the victim's ids
+ * (where it was when it left a CPU) and those of the task it took the
+ * CPU from (where that one was when it gave it up). Each episode goes to
+ * DIR/starv-N-PID.folded as two folded stacks weighted by the wait in
+ * microseconds, rooted at "victim:COMM-PID" and "running:COMM-PID", so
+ * a single episode renders as a flame graph and a whole directory can be
+ * concatenated into one. At most --stacks-max episodes are written (0 =
+ * no limit); the rest, and stacks the kernel could not store, are only
+ * counted and reported at exit.
+ */
+#define STACK_DEPTH 127   /* must match schedlab.bpf.c */
+
+/* Must match enum stack_miss_kind in schedlab.bpf.c */
+enum { STACK_MISS_STACKS = 0, STACK_MISS_OFFCPU, STACK_MISS_KINDS };
+
+static struct {
+    const char       *dir;     /* --stacks */
+    int               fd;      /* stack_traces */
+    int               miss_fd; /* stack_misses */
+    unsigned          seq;
+    unsigned          max;     /* --stacks-max, 0 = unlimited */
+    __u64             skipped; /* episodes over max */
+    __u64             stale;   /* episodes whose ids predate a table clear */
+    __u64             clears;
+    __u64             gc_miss; /* stack_misses at the last clear */
+    __u64             gc_ns;   /* next check */
+    struct sym_cache *sym;
+} g_stk = { .fd = -1, .miss_fd = -1, .max = 1000 };
+
+static int cfg_push(void);
+
+/* fd: stack_traces, or offcpu_traces for offcpu_stacks ids */
+static void stack_fold(FILE *f, int fd, __u32 pid, __s32 kid, __s32 uid) {
+    uint64_t ips[STACK_DEPTH];
+    int any = 0;
+
+    if (uid >= 0 && !bpf_map_lookup_elem(fd, &uid, ips)) {
+        sym_fold(g_stk.sym, f, pid, ips, STACK_DEPTH, 0);
+        any = 1;
+    }
+    if (kid >= 0 && !bpf_map_lookup_elem(fd, &kid, ips)) {
+        sym_fold(g_stk.sym, f, pid, ips, STACK_DEPTH, 1);
+        any = 1;
+    }
+    if (!any) fputs(";[no stack]", f);
+}
+
+static void stack_episode(const struct event *e) {
+    const struct ev_waitlong_payload *wl = &e->u.wl;
+    char path[PATH_MAX];
+    __u64 us = wl->wait_ns / 1000 ? wl->wait_ns / 1000 : 1;
+    int live = wl->stack_gen == g_cfg.stack_gen;   /* else the table was cleared since */
+    FILE *f;
+
+    if (g_stk.max && g_stk.seq >= g_stk.max) { g_stk.skipped++; return; }
+    if (!live) g_stk.stale++;
+    snprintf(path, sizeof(path), "%s/starv-%u-%u.folded", g_stk.dir, ++g_stk.seq, e->pid);
+    if (!(f = fopen(path, "w"))) { perror(path); return; }
+    fprintf(f, "victim:%s-%u", e->comm, e->pid);
+    stack_fold(f, g_stk.fd, e->pid, live ? wl->kstack : -1, live ? wl->ustack : -1);
+    fprintf(f, " %" PRIu64 "\n", (uint64_t)us);
+    if (wl->run_pid) {
+        fprintf(f, "running:%.16s-%u", wl->run_comm, wl->run_pid);
+        stack_fold(f, g_stk.fd, wl->run_pid, live ? wl->run_kstack : -1, live ? wl->run_ustack : -1);
+    } else {
+        fputs("running:[idle]", f);
+    }
+    fprintf(f, " %" PRIu64 "\n", (uint64_t)us);
+    if (fclose(f)) perror(path);
+}
+
+/* stack_misses[kind] summed over CPUs */
+static __u64 stack_misses(int fd, __u32 kind) {
+    __u64 *v = calloc(g_ncpus, sizeof(*v)), sum = 0;
+    if (v && !bpf_map_lookup_elem(fd, &kind, v))
+        for (int cpu = 0; cpu < g_ncpus; cpu++) sum += v[cpu];
+    free(v);
+    return sum;
+}
+
+/* Once a second: if stack_traces started missing since the last clear,
+ * empty it between two generation bumps. Ids taken during the clear carry
+ * the odd generation in between and are never used. */
+static void stack_gc(void) {
+    __u64 now = mono_ns(), miss;
+    char key[4];
+
+    if (now < g_stk.gc_ns) return;
+    g_stk.gc_ns = now + 1000000000ULL;
+    miss = stack_misses(g_stk.miss_fd, STACK_MISS_STACKS);
+    if (miss == g_stk.gc_miss) return;
+    g_stk.gc_miss = miss;
+    g_cfg.stack_gen++;
+    if (cfg_push()) { perror("cfg_map"); g_cfg.stack_gen--; return; }
+    while (bpf_map_get_next_key(g_stk.fd, NULL, key) == 0)
+        if (bpf_map_delete_elem(g_stk.fd, key)) break;
+    g_cfg.stack_gen++;
+    if (cfg_push()) perror("cfg_map");
+    g_stk.clears++;
+}
+
+static void stack_report(int misses_fd) {
+    __u64 miss = stack_misses(misses_fd, STACK_MISS_STACKS);
+    if (miss)
+        fprintf(stderr, "--stacks: %" PRIu64 " stacks not captured (stack_traces bucket in use)\n",
+            (uint64_t)miss);
+    if (g_mode == MODE_OFFCPU && (miss = stack_misses(misses_fd, STACK_MISS_OFFCPU)))
+        fprintf(stderr, "offcpu-flame: %" PRIu64 " stacks not captured (offcpu_traces bucket in use),"
+            " their time is under [no stack]\n", (uint64_t)miss);
+    if (g_stk.skipped)
+        fprintf(stderr, "--stacks: %" PRIu64 " episodes over --stacks-max %u not written\n",
+            (uint64_t)g_stk.skipped, g_stk.max);
+    if (g_stk.clears)
+        fprintf(stderr, "--stacks: stack table cleared %" PRIu64 " times; %" PRIu64
+            " episodes from before a clear written without stacks\n",
+            (uint64_t)g_stk.clears, (uint64_t)g_stk.stale);
+}
+
+/* ---- Off-CPU flame graph (MODE_OFFCPU) ---------------------------------
+ * offcpu_stacks is already aggregated per (tgid, stacks), so the report
+ * is one folded line per entry, heaviest first, weighted by blocked
+ * microseconds and rooted at COMM-TGID:
+ *   sudo ./schedlab --mode offcpu-flame --duration 30s | flamegraph.pl --countname=us
+ */
+/* Must match struct offcpu_key / offcpu_val in schedlab.bpf.c */
+struct offcpu_key {
+    __u32 tgid;
+    __s32 kstack, ustack;
+    __u32 _pad;
+};
+
+struct offcpu_val {
+    __u64 ns;
+    __u64 count;
+    char  comm[16];
+};
+
+struct offcpu_row {
+    struct offcpu_key k;
+    struct offcpu_val v;
+};
+
+static int cmp_offcpu_row(const void *a, const void *b) {
+    const struct offcpu_row *x = a, *y = b;
+    return (x->v.ns < y->v.ns) - (x->v.ns > y->v.ns);
+}
+
+static void offcpu_report(int fd, int traces_fd) {
+    struct offcpu_key key, next;
+    struct offcpu_row *rows = NULL;
+    size_t n = 0, cap = 0;
+    void *prev = NULL;
+
+    while (bpf_map_get_next_key(fd, prev, &next) == 0) {
+        key = next;
+        prev = &key;
+        if (n == cap) {
+            cap = cap ? 2 * cap : 1024;
+            struct offcpu_row *nr = realloc(rows, cap * sizeof(*nr));
+            if (!nr) break;
+            rows = nr;
+        }
+        rows[n].k = key;
+        if (bpf_map_lookup_elem(fd, &key, &rows[n].v) || rows[n].v.ns < 1000) continue;
+        n++;
+    }
+    qsort(rows, n, sizeof(*rows), cmp_offcpu_row);
+    for (size_t i = 0; i < n; i++) {
+        fprintf(g_out, "%.16s-%u", rows[i].v.comm, rows[i].k.tgid);
+        stack_fold(g_out, traces_fd, rows[i].k.tgid, rows[i].k.kstack, rows[i].k.ustack);
+        fprintf(g_out, " %" PRIu64 "\n", (uint64_t)(rows[i].v.ns / 1000));
+    }
+    fflush(g_out);
+    free(rows);
+}
+
 /* ---- Ring buffer callback --------------------------------------------- */
 static int handle_event(void *ctx, void *data, size_t len)
 {
-    (void)ctx;
-    const struct event *e = (const struct event *)data;
+    (void)ctx; (void)len;
+    if (g_ro.heap) reorder_push((const struct event *)data);
+    else           emit_event((const struct event *)data);
+    return 0;
+}
+
+/* One capture row per event; see schedlab_capture.h for the aux column. */
+static void capture_event(const struct event *e)
+{
+    struct cap_row r = { .ts_ns = e->ts_ns, .pid = e->pid, .cpu = -1, .type = (uint8_t)e->type };
+
+    switch (e->type) {
+    case EV_SWITCH:
+        r.pid = e->u.sw.next_pid;
+        r.aux = e->u.sw.prev_pid;
+        r.cpu = e->u.sw.next_cpu;
+        r.run_ns = e->u.sw.run_ns;
+        r.wait_ns = e->u.sw.wait_ns;
+        break;
+    case EV_FORK:
+        r.pid = e->u.fork.child_pid;
+        r.aux = e->u.fork.parent_pid;
+        break;
+    case EV_WAITLONG:
+        r.wait_ns = e->u.wl.wait_ns;
+        break;
+    case EV_MARK:
+        r.aux = g_phase_seq;     /* the phase this marker starts */
+        break;
+    case EV_REQ:
+        r.aux = e->u.req.switches;
+        r.run_ns = e->u.req.run_ns;
+        r.wait_ns = e->u.req.wait_ns;
+        break;
+    case EV_LIFE:
+        r.aux = e->u.life.ppid;
+        r.run_ns = e->u.life.run_ns;
+        r.wait_ns = e->u.life.wait_ns;
+        break;
+    }
+    if (cap_append(g_cap, &r)) {
+        perror("capture");
+        g_cap_err = 1;
+        g_stop = 1;
+    }
+}
+
+static void emit_event(const struct event *e)
+{
+    if (e->type == EV_MARK) phase_mark(e);   /* first, so the marker opens the new segment */
+    if (e->type == EV_WAITLONG && g_stk.sym) stack_episode(e);
+    if ((e->type == EV_EXEC || e->type == EV_EXIT) && g_stk.sym) sym_forget(g_stk.sym, e->pid);
+    if (g_cap && !g_cap_err) capture_event(e);
 
     /* maintain small local aggregates */
-    if (e->type == EV_EXEC) {
-        if (A(e->pid)->first_exec_ns == 0) A(e->pid)->first_exec_ns = e->ts_ns;
-    } else if (e->type == EV_SWITCH) {
+    if (e->type == EV_SWITCH) {
         A(e->u.sw.prev_pid)->total_run_ns  += e->u.sw.run_ns;
         A(e->u.sw.next_pid)->total_wait_ns += e->u.sw.wait_ns;
         A(e->u.sw.prev_pid)->switches++;
@@ -132,41 +988,56 @@ static int handle_event(void *ctx, void *data, size_t len)
     } else if (e->type == EV_WAKE) {
         A(e->pid)->wakes++;
     }
-    A(e->pid)->last_seen_ns = e->ts_ns;
 
     print_csv_header_once();
 
     if (!g_csv) {
         /* human-readable */
+        if (e->type == EV_MARK && g_mode != MODE_STREAM && g_mode != MODE_TIMELINE &&
+            g_mode != MODE_TOP)
+            fprintf(g_out, "== phase %s ==\n", e->u.mark.name);
+        /* only stream/timeline reorder; neither prints EV_LIFE, timeline skips EV_WAITLONG */
+        if (g_emit_late && e->type != EV_LIFE && (g_mode == MODE_STREAM || e->type != EV_WAITLONG))
+            fputs("late ", g_out);
         switch (g_mode) {
         case MODE_STREAM:
             switch (e->type) {
             case EV_WAKE:
-                fprintf(stdout, "[wake] pid=%u comm=%s\n", e->pid, e->comm); break;
+                fprintf(g_out, "[wake] pid=%u comm=%s\n", e->pid, e->comm); break;
             case EV_SWITCH:
-                fprintf(stdout, "[switch] prev=%u(%s) -> next=%u(%s) run=%" PRIu64 "ns wait=%" PRIu64 "ns\n",
+                fprintf(g_out, "[switch] prev=%u(%s) -> next=%u(%s) run=%" PRIu64 "ns wait=%" PRIu64 "ns\n",
                     e->u.sw.prev_pid, e->u.sw.prev_comm,
                     e->u.sw.next_pid, e->u.sw.next_comm,
                     (uint64_t)e->u.sw.run_ns, (uint64_t)e->u.sw.wait_ns); break;
             case EV_EXEC:
-                fprintf(stdout, "[exec] pid=%u comm=%s\n", e->pid, e->comm); break;
+                fprintf(g_out, "[exec] pid=%u comm=%s\n", e->pid, e->comm); break;
             case EV_EXIT:
-                fprintf(stdout, "[exit] pid=%u comm=%s\n", e->pid, e->comm); break;
+                fprintf(g_out, "[exit] pid=%u comm=%s\n", e->pid, e->comm); break;
+            case EV_FORK:
+                fprintf(g_out, "[fork] parent=%u -> child=%u comm=%s\n",
+                    e->u.fork.parent_pid, e->u.fork.child_pid, e->comm); break;
             case EV_WAITLONG:
-                fprintf(stdout, "[wait-alert] pid=%u comm=%s\n", e->pid, e->comm); break;
+                fprintf(g_out, "[wait-alert] pid=%u comm=%s\n", e->pid, e->comm); break;
+            case EV_MARK:
+                fprintf(g_out, "[mark] phase=%s pid=%u comm=%s\n", e->u.mark.name, e->pid, e->comm); break;
+            case EV_REQ:
+                fprintf(g_out, "[req] pid=%u comm=%s latency=%" PRIu64 "ns wait=%" PRIu64 "ns run=%" PRIu64
+                    "ns offcpu=%" PRIu64 "ns switches=%u\n", e->pid, e->comm,
+                    (uint64_t)e->u.req.latency_ns, (uint64_t)e->u.req.wait_ns,
+                    (uint64_t)e->u.req.run_ns, (uint64_t)e->u.req.off_ns, e->u.req.switches); break;
             }
             break;
 
         case MODE_LATENCY:
             if (e->type == EV_SWITCH)
-                fprintf(stdout, "latency_ns pid=%u value=%" PRIu64 "\n",
+                fprintf(g_out, "latency_ns pid=%u value=%" PRIu64 "\n",
                     e->u.sw.next_pid, (uint64_t)e->u.sw.wait_ns);
             break;
 
         case MODE_FAIRNESS:
             if (e->type == EV_SWITCH) {
                 const struct agg_user *an = A(e->u.sw.next_pid);
-                fprintf(stdout, "fair pid=%u run_ms=%.6f wait_ms=%.6f switches=%" PRIu64 "\n",
+                fprintf(g_out, "fair pid=%u run_ms=%.6f wait_ms=%.6f switches=%" PRIu64 "\n",
                     e->u.sw.next_pid,
                     an->total_run_ns/1e6, an->total_wait_ns/1e6,
                     (uint64_t)an->switches);
@@ -175,71 +1046,103 @@ static int handle_event(void *ctx, void *data, size_t len)
 
         case MODE_CTX:
             if (e->type == EV_SWITCH)
-                fprintf(stdout, "ctxswitch prev=%u next=%u run_ns=%" PRIu64 "\n",
+                fprintf(g_out, "ctxswitch prev=%u next=%u run_ns=%" PRIu64 "\n",
                     e->u.sw.prev_pid, e->u.sw.next_pid, (uint64_t)e->u.sw.run_ns);
             break;
 
         case MODE_TIMELINE:
-            if (e->type == EV_WAKE)      fprintf(stdout, "T %u WAKE\n", e->pid);
+            if (e->type == EV_WAKE)      fprintf(g_out, "T %u WAKE\n", e->pid);
             else if (e->type == EV_SWITCH)
-                fprintf(stdout, "T %u SWITCH wait=%" PRIu64 " run_prev=%" PRIu64 "\n",
+                fprintf(g_out, "T %u SWITCH wait=%" PRIu64 " run_prev=%" PRIu64 "\n",
                     e->u.sw.next_pid, (uint64_t)e->u.sw.wait_ns, (uint64_t)e->u.sw.run_ns);
-            else if (e->type == EV_EXEC) fprintf(stdout, "T %u EXEC\n", e->pid);
-            else if (e->type == EV_EXIT) fprintf(stdout, "T %u EXIT\n", e->pid);
+            else if (e->type == EV_EXEC) fprintf(g_out, "T %u EXEC\n", e->pid);
+            else if (e->type == EV_EXIT) fprintf(g_out, "T %u EXIT\n", e->pid);
+            else if (e->type == EV_FORK) fprintf(g_out, "T %u FORK parent=%u\n", e->pid, e->u.fork.parent_pid);
+            else if (e->type == EV_MARK) fprintf(g_out, "T %u MARK %s\n", e->pid, e->u.mark.name);
+            else if (e->type == EV_REQ)
+                fprintf(g_out, "T %u REQ latency=%" PRIu64 " wait=%" PRIu64 " run=%" PRIu64 "\n",
+                    e->pid, (uint64_t)e->u.req.latency_ns, (uint64_t)e->u.req.wait_ns,
+                    (uint64_t)e->u.req.run_ns);
             break;
 
         case MODE_SHORTLONG:
-            if (e->type == EV_EXIT) {
-                const struct agg_user *ax = A(e->pid);
-                __u64 life = (ax->last_seen_ns > ax->first_exec_ns)
-                           ? (ax->last_seen_ns - ax->first_exec_ns) : 0;
-                fprintf(stdout, "lifetime pid=%u ms=%.6f wakes=%" PRIu64 " switches=%" PRIu64 "\n",
-                    e->pid, life/1e6, (uint64_t)ax->wakes, (uint64_t)ax->switches);
-            }
+            if (e->type == EV_LIFE)
+                fprintf(g_out, "lifetime pid=%u comm=%s ms=%.6f wakes=%" PRIu64 " switches=%" PRIu64
+                    " run_ms=%.6f wait_ms=%.6f origin=%s ppid=%u\n",
+                    e->pid, e->comm, e->u.life.lifetime_ns/1e6, (uint64_t)e->u.life.wakes,
+                    (uint64_t)e->u.life.switches, e->u.life.run_ns/1e6, e->u.life.wait_ns/1e6,
+                    life_origin_names[e->u.life.origin % 3], e->u.life.ppid);
             break;
 
         case MODE_STARVATION:
             if (e->type == EV_WAITLONG)
-                fprintf(stdout, "starvation_alert pid=%u\n", e->pid);
+                fprintf(g_out, "starvation_alert pid=%u comm=%s wait_ms=%.3f threshold_ms=%.3f rule=%s\n",
+                    e->pid, e->comm, e->u.wl.wait_ns/1e6, e->u.wl.threshold_ns/1e6,
+                    rule_label(&e->u.wl));
+            break;
+
+        case MODE_UTIL:
+        case MODE_CPUSERIES:
+        case MODE_HEATMAP:
+        case MODE_CLASSES:
+        case MODE_TOP:
+        case MODE_EXPORT:
+        case MODE_OFFCPU:
+        case MODE_INTERF:
+        case MODE_WAKES:
+        case MODE_TOPO:
+        case MODE_SMT:
             break;
         }
-        fflush(stdout);
-        return 0;
+        fflush(g_out);
+        return;
     }
 
     /* CSV mode */
     switch (g_mode) {
     case MODE_STREAM:
         if (e->type == EV_SWITCH) {
-            printf("%" PRIu64 ",switch,%u,%s,%u,%u,%" PRIu64 ",%" PRIu64 "\n",
+            fprintf(g_out, "%" PRIu64 ",switch,%u,%s,%u,%u,%" PRIu64 ",%" PRIu64 "\n",
                 (uint64_t)e->ts_ns, e->pid, e->comm,
                 e->u.sw.prev_pid, e->u.sw.next_pid,
                 (uint64_t)e->u.sw.run_ns, (uint64_t)e->u.sw.wait_ns);
         } else if (e->type == EV_WAKE) {
-            printf("%" PRIu64 ",wake,%u,%s,,,%s,%s\n",
+            fprintf(g_out, "%" PRIu64 ",wake,%u,%s,,,%s,%s\n",
                 (uint64_t)e->ts_ns, e->pid, e->comm, "", "");
         } else if (e->type == EV_EXEC) {
-            printf("%" PRIu64 ",exec,%u,%s,,,%s,%s\n",
+            fprintf(g_out, "%" PRIu64 ",exec,%u,%s,,,%s,%s\n",
                 (uint64_t)e->ts_ns, e->pid, e->comm, "", "");
         } else if (e->type == EV_EXIT) {
-            printf("%" PRIu64 ",exit,%u,%s,,,%s,%s\n",
+            fprintf(g_out, "%" PRIu64 ",exit,%u,%s,,,%s,%s\n",
                 (uint64_t)e->ts_ns, e->pid, e->comm, "", "");
+        } else if (e->type == EV_FORK) {
+            fprintf(g_out, "%" PRIu64 ",fork,%u,%s,%u,%u,%s,%s\n",
+                (uint64_t)e->ts_ns, e->pid, e->comm,
+                e->u.fork.parent_pid, e->u.fork.child_pid, "", "");
         } else if (e->type == EV_WAITLONG) {
-            printf("%" PRIu64 ",wait_alert,%u,%s,,,%s,%s\n",
+            fprintf(g_out, "%" PRIu64 ",wait_alert,%u,%s,,,%s,%s\n",
                 (uint64_t)e->ts_ns, e->pid, e->comm, "", "");
+        } else if (e->type == EV_MARK) {
+            /* the phase name goes in the comm column */
+            fprintf(g_out, "%" PRIu64 ",mark,%u,%s,,,%s,%s\n",
+                (uint64_t)e->ts_ns, e->pid, e->u.mark.name, "", "");
+        } else if (e->type == EV_REQ) {
+            fprintf(g_out, "%" PRIu64 ",req,%u,%s,,,%" PRIu64 ",%" PRIu64 "\n",
+                (uint64_t)e->ts_ns, e->pid, e->comm,
+                (uint64_t)e->u.req.run_ns, (uint64_t)e->u.req.wait_ns);
         }
         break;
 
     case MODE_LATENCY:
         if (e->type == EV_SWITCH)
-            printf("%" PRIu64 ",%u,%" PRIu64 "\n",
+            fprintf(g_out, "%" PRIu64 ",%u,%" PRIu64 "\n",
                 (uint64_t)e->ts_ns, e->u.sw.next_pid, (uint64_t)e->u.sw.wait_ns);
         break;
 
     case MODE_FAIRNESS:
         if (e->type == EV_SWITCH) {
             const struct agg_user *an = A(e->u.sw.next_pid);
-            printf("%u,%.6f,%.6f,%" PRIu64 "\n",
+            fprintf(g_out, "%u,%.6f,%.6f,%" PRIu64 "\n",
                 e->u.sw.next_pid, an->total_run_ns/1e6,
                 an->total_wait_ns/1e6, (uint64_t)an->switches);
         }
@@ -247,114 +1150,2709 @@ static int handle_event(void *ctx, void *data, size_t len)
 
     case MODE_CTX:
         if (e->type == EV_SWITCH)
-            printf("%" PRIu64 ",%u,%u,%" PRIu64 "\n",
+            fprintf(g_out, "%" PRIu64 ",%u,%u,%" PRIu64 "\n",
                 (uint64_t)e->ts_ns, e->u.sw.prev_pid, e->u.sw.next_pid,
                 (uint64_t)e->u.sw.run_ns);
         break;
 
     case MODE_TIMELINE:
         if (e->type == EV_WAKE)
-            printf("%" PRIu64 ",%u,WAKE,,\n", (uint64_t)e->ts_ns, e->pid);
+            fprintf(g_out, "%" PRIu64 ",%u,WAKE,,\n", (uint64_t)e->ts_ns, e->pid);
         else if (e->type == EV_SWITCH)
-            printf("%" PRIu64 ",%u,SWITCH,%" PRIu64 ",%" PRIu64 "\n",
+            fprintf(g_out, "%" PRIu64 ",%u,SWITCH,%" PRIu64 ",%" PRIu64 "\n",
                 (uint64_t)e->ts_ns, e->u.sw.next_pid,
                 (uint64_t)e->u.sw.wait_ns, (uint64_t)e->u.sw.run_ns);
         else if (e->type == EV_EXEC)
-            printf("%" PRIu64 ",%u,EXEC,,\n", (uint64_t)e->ts_ns, e->pid);
+            fprintf(g_out, "%" PRIu64 ",%u,EXEC,,\n", (uint64_t)e->ts_ns, e->pid);
         else if (e->type == EV_EXIT)
-            printf("%" PRIu64 ",%u,EXIT,,\n", (uint64_t)e->ts_ns, e->pid);
+            fprintf(g_out, "%" PRIu64 ",%u,EXIT,,\n", (uint64_t)e->ts_ns, e->pid);
+        else if (e->type == EV_FORK)
+            fprintf(g_out, "%" PRIu64 ",%u,FORK,,\n", (uint64_t)e->ts_ns, e->pid);
+        else if (e->type == EV_MARK)
+            fprintf(g_out, "%" PRIu64 ",%u,MARK,,\n", (uint64_t)e->ts_ns, e->pid);
+        else if (e->type == EV_REQ)
+            fprintf(g_out, "%" PRIu64 ",%u,REQ,%" PRIu64 ",%" PRIu64 "\n", (uint64_t)e->ts_ns, e->pid,
+                (uint64_t)e->u.req.wait_ns, (uint64_t)e->u.req.run_ns);
         break;
 
     case MODE_SHORTLONG:
-        if (e->type == EV_EXIT) {
-            const struct agg_user *ax = A(e->pid);
-            __u64 life = (ax->last_seen_ns > ax->first_exec_ns)
-                       ? (ax->last_seen_ns - ax->first_exec_ns) : 0;
-            printf("%u,%.6f,%" PRIu64 ",%" PRIu64 "\n",
-                e->pid, life/1e6, (uint64_t)ax->wakes, (uint64_t)ax->switches);
-        }
+        if (e->type == EV_LIFE)
+            fprintf(g_out, "%u,%.6f,%" PRIu64 ",%" PRIu64 ",%.6f,%.6f,%s,%u,%s\n",
+                e->pid, e->u.life.lifetime_ns/1e6, (uint64_t)e->u.life.wakes,
+                (uint64_t)e->u.life.switches, e->u.life.run_ns/1e6, e->u.life.wait_ns/1e6,
+                life_origin_names[e->u.life.origin % 3], e->u.life.ppid, e->comm);
         break;
 
     case MODE_STARVATION:
         if (e->type == EV_WAITLONG)
-            printf("%" PRIu64 ",%u,wait_alert\n", (uint64_t)e->ts_ns, e->pid);
+            fprintf(g_out, "%" PRIu64 ",%u,wait_alert,%" PRIu64 ",%s\n", (uint64_t)e->ts_ns, e->pid,
+                (uint64_t)e->u.wl.wait_ns, rule_label(&e->u.wl));
+        break;
+
+    case MODE_UTIL:
+    case MODE_CPUSERIES:
+    case MODE_HEATMAP:
+    case MODE_CLASSES:
+    case MODE_TOP:
+    case MODE_EXPORT:
+    case MODE_OFFCPU:
+    case MODE_INTERF:
+    case MODE_WAKES:
+    case MODE_TOPO:
+    case MODE_SMT:
         break;
     }
-    fflush(stdout);
-    return 0;
+    fflush(g_out);
 }
 
-/* ---- CLI & main ------------------------------------------------------- */
-static void usage(const char *p) {
-    fprintf(stderr,
-        "Usage: sudo %s [--mode %s|%s|%s|%s|%s|%s|%s]\n"
-        "              [--filter-pid N] [--wait-alert-ms M] [--csv] [--csv-header]\n",
-        p,
-        mode_names[0], mode_names[1], mode_names[2], mode_names[3],
-        mode_names[4], mode_names[5], mode_names[6]);
+/* ---- Per-CPU utilization (MODE_UTIL) ----------------------------------
+ * Reads the per-CPU cpu_state slots once per interval and prints deltas.
+ * The slice currently on each CPU is folded in up to "now", so a CPU that
+ * ran one task for the whole interval still reports as busy.
+ */
+struct util_prev { __u64 busy_ns, idle_ns, switches; };
 
-}
+static struct util_prev *g_util_prev;
 
-int main(int argc, char **argv)
-{
-    for (int i=1; i<argc; i++) {
-        if (!strcmp(argv[i],"--mode") && i+1<argc) g_mode = parse_mode(argv[++i]);
-        else if (!strcmp(argv[i],"--filter-pid") && i+1<argc) g_filter_pid = (__u32)atoi(argv[++i]);
-        else if (!strcmp(argv[i],"--wait-alert-ms") && i+1<argc) g_wait_alert_ns = (__u64)atoll(argv[++i]) * 1000000ULL;
-        else if (!strcmp(argv[i],"--csv")) g_csv = 1;
-        else if (!strcmp(argv[i],"--csv-header")) g_csv_header = 1;
-        else { usage(argv[0]); return 1; }
+/* Per-CPU deltas since the previous call into d[g_ncpus] (NULL: just
+ * move the baseline). */
+static int util_deltas(int map_fd, struct util_prev *d) {
+    struct cpu_state *v = calloc(g_ncpus, sizeof(*v));
+    __u32 k = 0;
+    if (!v) return -1;
+    if (bpf_map_lookup_elem(map_fd, &k, v)) { free(v); return -1; }
+
+    __u64 now = mono_ns();
+    for (int cpu = 0; cpu < g_ncpus; cpu++) {
+        __u64 busy = v[cpu].busy_ns, idle = v[cpu].idle_ns;
+        if (v[cpu].since_ns && now > v[cpu].since_ns) {
+            if (v[cpu].curr_pid) busy += now - v[cpu].since_ns;
+            else                 idle += now - v[cpu].since_ns;
+        }
+        struct util_prev *p = &g_util_prev[cpu];
+        if (d) {
+            d[cpu].busy_ns  = busy - p->busy_ns;
+            d[cpu].idle_ns  = idle - p->idle_ns;
+            d[cpu].switches = v[cpu].switches - p->switches;
+        }
+        /* the in-flight part is re-derived next time, so only keep totals */
+        p->busy_ns = busy; p->idle_ns = idle; p->switches = v[cpu].switches;
     }
+    free(v);
+    return 0;
+}
 
-    libbpf_set_strict_mode(LIBBPF_STRICT_ALL);
-    signal(SIGINT,  on_sig);
-    signal(SIGTERM, on_sig);
+static void util_report(int map_fd, int quiet) {
+    struct util_prev *d;
+    if (quiet) { util_deltas(map_fd, NULL); return; }
+    if (!(d = calloc(g_ncpus, sizeof(*d))) || util_deltas(map_fd, d)) { free(d); return; }
 
-    /* open + load the BPF object via skeleton */
-    struct schedlab_bpf *skel = schedlab_bpf__open_and_load();
-    if (!skel) { perror("open_and_load"); return 2; }
+    __u64 now = mono_ns();
+    for (int cpu = 0; cpu < g_ncpus; cpu++) {
+        __u64 db = d[cpu].busy_ns, di = d[cpu].idle_ns, ds = d[cpu].switches;
+        double util = (db + di) ? 100.0 * db / (double)(db + di) : 0.0;
 
-    /* init cfg_map in kernel */
-    struct cfg c = {.wait_alert_ns = g_wait_alert_ns, .sample_filter_pid = g_filter_pid};
-    __u32 k = 0;
-    if (bpf_map_update_elem(bpf_map__fd(skel->maps.cfg_map), &k, &c, BPF_ANY)) {
-        perror("bpf_map_update_elem(cfg_map)");
-        schedlab_bpf__destroy(skel);
-        return 3;
+        if (g_csv)
+            fprintf(g_out, "%" PRIu64 ",%d,%" PRIu64 ",%" PRIu64 ",%.2f,%" PRIu64 "\n",
+                (uint64_t)now, cpu, (uint64_t)db, (uint64_t)di, util, (uint64_t)ds);
+        else
+            fprintf(g_out, "cpu=%d busy_ms=%.3f idle_ms=%.3f util=%.1f%% switches=%" PRIu64 "\n",
+                cpu, db/1e6, di/1e6, util, (uint64_t)ds);
     }
+    fflush(g_out);
+    free(d);
+}
 
-    /* attach all tp_btf programs */
-    if (schedlab_bpf__attach(skel)) {
-        perror("attach");
-        schedlab_bpf__destroy(skel);
-        return 4;
-    }
+/* ---- Per-CPU time series (MODE_CPUSERIES) -----------------------------
+ * The kernel fills a ring of CPU_BUCKETS buckets per CPU. Each tick we emit
+ * every bucket that has closed since the last tick as one row per CPU. A
+ * slice still running on a CPU has not been booked by the kernel yet, so
+ * its overlap with each bucket is taken from cpu_state instead.
+ */
+static __u64 g_series_next;  /* next absolute bucket index to emit */
 
-    /* ring buffer reader */
-    struct ring_buffer *rb = ring_buffer__new(bpf_map__fd(skel->maps.rb),
-                                              handle_event, NULL, NULL);
-    if (!rb) {
-        perror("ring_buffer__new");
-        schedlab_bpf__destroy(skel);
-        return 5;
-    }
+static void series_report(int buckets_fd, int state_fd) {
+    size_t nb = (size_t)CPU_BUCKETS * g_ncpus;
+    struct cpu_bucket *buf = calloc(nb, sizeof(*buf));
+    struct cpu_state  *st  = calloc(g_ncpus, sizeof(*st));
+    __u32 k = 0;
 
-    if (!g_csv)
-        fprintf(stderr, "schedlab attached. mode=%s filter-pid=%u wait-alert-ms=%" PRIu64 "\n",
-            mode_names[g_mode], g_filter_pid, (uint64_t)(g_wait_alert_ns/1000000ULL));
-    else
-        print_csv_header_once();
+    if (!buf || !st) goto out;
+    if (bpf_map_lookup_elem(state_fd, &k, st)) goto out;
+    for (__u32 slot = 0; slot < CPU_BUCKETS; slot++)
+        if (bpf_map_lookup_elem(buckets_fd, &slot, &buf[(size_t)slot * g_ncpus]))
+            goto out;
 
-    while (!g_stop) {
-        int err = ring_buffer__poll(rb, 200);
-        if (err == -EINTR) break;
-        if (err < 0 && err != -EAGAIN) {
-            fprintf(stderr, "ring_buffer__poll: %d\n", err);
-            break;
+    __u64 cur = mono_ns() / g_bucket_ns;
+    if (!g_series_next || cur - g_series_next > CPU_BUCKETS / 2)
+        g_series_next = cur;   /* first tick, or we fell too far behind */
+
+    for (__u64 b = g_series_next; b < cur; b++) {
+        __u64 b_lo = b * g_bucket_ns, b_hi = b_lo + g_bucket_ns;
+        if (!g_csv) fprintf(g_out, "t=%.3fs", b_lo / 1e9);
+        for (int cpu = 0; cpu < g_ncpus; cpu++) {
+            const struct cpu_bucket *v = &buf[(size_t)(b % CPU_BUCKETS) * g_ncpus + cpu];
+            __u64 busy = 0, idle = 0, sw = 0, rq = 0;
+            if (v->idx == b) {
+                busy = v->busy_ns; idle = v->idle_ns;
+                sw = v->switches;  rq = v->nr_running_sum;
+            }
+            if (st[cpu].since_ns && st[cpu].since_ns < b_hi) {
+                __u64 lo = st[cpu].since_ns > b_lo ? st[cpu].since_ns : b_lo;
+                if (st[cpu].curr_pid) busy += b_hi - lo;
+                else                  idle += b_hi - lo;
+            }
+            double busy_pct = 100.0 * busy / g_bucket_ns;
+            double idle_pct = 100.0 * idle / g_bucket_ns;
+            double sw_rate  = sw * 1e9 / g_bucket_ns;
+            /* no switch sampled rq->nr_running: a busy CPU had at least one */
+            double rq_avg   = sw ? (double)rq / sw : busy_pct / 100.0;
+            if (g_csv)
+                fprintf(g_out, "%" PRIu64 ",%d,%.2f,%.2f,%.1f,%.2f\n",
+                    (uint64_t)b_lo, cpu, busy_pct, idle_pct, sw_rate, rq_avg);
+            else
+                fprintf(g_out, " | cpu%d %5.1f%% %7.0f/s rq=%.2f",
+                    cpu, busy_pct, sw_rate, rq_avg);
         }
+        if (!g_csv) fputc('\n', g_out);
     }
+    g_series_next = cur;
+    fflush(g_out);
+out:
+    free(buf);
+    free(st);
+}
 
-    ring_buffer__free(rb);
-    schedlab_bpf__destroy(skel);
-    return 0;
+/* ---- Config push ------------------------------------------------------ */
+static int g_cfg_fd = -1;
+
+static int cfg_push(void) {
+    __u32 k = 0;
+    return bpf_map_update_elem(g_cfg_fd, &k, &g_cfg, BPF_ANY);
+}
+
+/* ---- Latency heatmap (MODE_HEATMAP) ------------------------------------
+ * Every interval we point the kernel at the other heat slot and emit one
+ * column from the slot it just left. Slots are never zeroed: a column is
+ * the growth of a slot's per-CPU sums since we last read it. A handler
+ * that loaded the old slot index just before the flip can still add to it
+ * after our read; before a slot is reused we read it once more and fold
+ * those stragglers into the new column, so no count is lost.
+ * Columns are kept so --svg can render the whole run at exit.
+ */
+static struct heat_col *g_heat_cols;
+static size_t           g_heat_n, g_heat_cap;
+static struct heat_col  g_heat_seen[2];   /* per slot: sums at the last read */
+
+/* add slot's growth since the last read to col */
+static int heat_take(int heat_fd, __u32 slot, struct heat_col *v, struct heat_col *col) {
+    struct heat_col cur = {0};
+
+    if (bpf_map_lookup_elem(heat_fd, &slot, v)) return -1;
+    for (int cpu = 0; cpu < g_ncpus; cpu++)
+        for (int m = 0; m < HEAT_METRICS; m++)
+            for (int b = 0; b < LAT_BUCKETS; b++)
+                cur.cnt[m][b] += v[cpu].cnt[m][b];
+    for (int m = 0; m < HEAT_METRICS; m++)
+        for (int b = 0; b < LAT_BUCKETS; b++)
+            col->cnt[m][b] += cur.cnt[m][b] - g_heat_seen[slot].cnt[m][b];
+    g_heat_seen[slot] = cur;
+    return 0;
+}
+
+static void heat_rotate(int heat_fd) {
+    __u32 old = g_cfg.heat_slot & 1;
+    struct heat_col *v = calloc(g_ncpus, sizeof(*v));
+    struct heat_col col = {0};
+    __u64 now = mono_ns();
+
+    if (!v) return;
+    if (heat_take(heat_fd, old ^ 1, v, &col)) { free(v); return; }   /* stragglers */
+    g_cfg.heat_slot = old ^ 1;
+    if (cfg_push()) { perror("cfg_push"); free(v); return; }
+    usleep(1000);  /* most handlers that loaded the old slot finish here */
+
+    if (heat_take(heat_fd, old, v, &col)) { free(v); return; }
+    free(v);
+
+    for (int m = 0; m < HEAT_METRICS; m++) {
+        if (!(g_heat_mask & (1u << m))) continue;
+        if (g_csv) fprintf(g_out, "%" PRIu64 ",%s", (uint64_t)now, heat_names[m]);
+        else       fprintf(g_out, "t=%.3fs %-6s", now / 1e9, heat_names[m]);
+        for (int b = 0; b < LAT_BUCKETS; b++)
+            fprintf(g_out, g_csv ? ",%" PRIu64 : " %" PRIu64, (uint64_t)col.cnt[m][b]);
+        fputc('\n', g_out);
+    }
+    fflush(g_out);
+
+    if (!g_svg_path) return;
+    if (g_heat_n == g_heat_cap) {
+        size_t cap = g_heat_cap ? 2 * g_heat_cap : 256;
+        struct heat_col *nc = realloc(g_heat_cols, cap * sizeof(*nc));
+        if (!nc) return;
+        g_heat_cols = nc;
+        g_heat_cap = cap;
+    }
+    g_heat_cols[g_heat_n++] = col;
+}
+
+/* One panel per enabled metric: x = interval, y = log2 bucket (fast at the
+ * bottom), colour = log-scaled count relative to the panel maximum. */
+static int heat_write_svg(const char *path) {
+    const int cw = 8, ch = 8, left = 70, top = 30, gap = 50;
+    int panels = 0;
+    for (int m = 0; m < HEAT_METRICS; m++) if (g_heat_mask & (1u << m)) panels++;
+    int pw = (int)g_heat_n * cw, ph = LAT_BUCKETS * ch;
+    int W = left + pw + 20, H = top + panels * (ph + gap);
+
+    FILE *f = fopen(path, "w");
+    if (!f) return -1;
+    fprintf(f, "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"%d\" height=\"%d\" "
+               "font-family=\"monospace\" font-size=\"10\">\n", W, H);
+    fprintf(f, "<rect width=\"100%%\" height=\"100%%\" fill=\"white\"/>\n");
+
+    int y0 = top;
+    for (int m = 0; m < HEAT_METRICS; m++) {
+        if (!(g_heat_mask & (1u << m))) continue;
+        __u64 max = 0;
+        for (size_t x = 0; x < g_heat_n; x++)
+            for (int b = 0; b < LAT_BUCKETS; b++)
+                if (g_heat_cols[x].cnt[m][b] > max) max = g_heat_cols[x].cnt[m][b];
+
+        fprintf(f, "<text x=\"%d\" y=\"%d\">%s latency (%.1fs/column, max %" PRIu64 ")</text>\n",
+            left, y0 - 8, heat_names[m], g_heat_ns / 1e9, (uint64_t)max);
+        for (size_t x = 0; x < g_heat_n; x++)
+            for (int b = 0; b < LAT_BUCKETS; b++) {
+                __u64 n = g_heat_cols[x].cnt[m][b];
+                if (!n) continue;
+                double t = max > 1 ? log((double)n) / log((double)max) : 1.0;
+                int r = 255, g = (int)(230 * (1 - t)), bl = (int)(160 * (1 - t));
+                fprintf(f, "<rect x=\"%d\" y=\"%d\" width=\"%d\" height=\"%d\" "
+                           "fill=\"rgb(%d,%d,%d)\"/>\n",
+                    left + (int)x * cw, y0 + (LAT_BUCKETS - 1 - b) * ch, cw, ch, r, g, bl);
+            }
+        /* y ticks at 1us / 1ms / 1s */
+        static const struct { int b; const char *l; } ticks[] = {{10,"1us"},{20,"1ms"},{30,"1s"}};
+        for (size_t i = 0; i < sizeof(ticks)/sizeof(ticks[0]); i++)
+            fprintf(f, "<text x=\"%d\" y=\"%d\" text-anchor=\"end\">%s</text>\n",
+                left - 6, y0 + (LAT_BUCKETS - ticks[i].b) * ch, ticks[i].l);
+        fprintf(f, "<rect x=\"%d\" y=\"%d\" width=\"%d\" height=\"%d\" "
+                   "fill=\"none\" stroke=\"black\"/>\n", left, y0, pw, ph);
+        y0 += ph + gap;
+    }
+    fprintf(f, "</svg>\n");
+    return fclose(f);
+}
+
+static int parse_heat_metrics(const char *s) {
+    char buf[64];
+    g_heat_mask = 0;
+    snprintf(buf, sizeof(buf), "%s", s);
+    for (char *tok = strtok(buf, ","); tok; tok = strtok(NULL, ",")) {
+        int m;
+        for (m = 0; m < HEAT_METRICS; m++)
+            if (!strcmp(tok, heat_names[m])) break;
+        if (m == HEAT_METRICS) return -1;
+        g_heat_mask |= 1u << m;
+    }
+    return g_heat_mask ? 0 : -1;
+}
+
+/* ---- Per-key latency percentiles (latency --by pid|comm) ---------------
+ * The kernel keeps a log2 histogram per key; percentiles are interpolated
+ * linearly inside the bucket that crosses the rank and capped at max.
+ */
+/* q-quantile of a log2 histogram with nb buckets, interpolated inside the bucket */
+static double hist_pct_nb(const __u64 *slots, int nb, __u64 count, double q, __u64 max_ns) {
+    if (!count) return 0.0;
+    double rank = q * (double)count, cum = 0.0;
+    for (int b = 0; b < nb; b++) {
+        if (!slots[b]) continue;
+        if (cum + slots[b] >= rank) {
+            double lo = b ? (double)(1ULL << b) : 0.0, hi = (double)(2ULL << b);
+            double v = lo + (hi - lo) * (rank - cum) / (double)slots[b];
+            return v < (double)max_ns ? v : (double)max_ns;
+        }
+        cum += slots[b];
+    }
+    return (double)max_ns;
+}
+
+static double hist_pct_ns(const __u64 *slots, __u64 count, double q, __u64 max_ns) {
+    return hist_pct_nb(slots, LAT_BUCKETS, count, q, max_ns);
+}
+
+struct lat_row {
+    char   key[32];
+    char   comm[16];   /* LAT_BY_PID: from the kernel entry */
+    __u64  count, max_ns;
+    double p50, p99, mean;
+};
+
+static int cmp_lat_row_p99(const void *a, const void *b) {
+    const struct lat_row *x = a, *y = b;
+    return (x->p99 < y->p99) - (x->p99 > y->p99);
+}
+
+static void pid_comm(__u32 pid, char *out, size_t n) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%u/comm", pid);
+    FILE *f = fopen(path, "r");
+    out[0] = '\0';
+    if (!f) return;
+    if (fgets(out, (int)n, f)) out[strcspn(out, "\n")] = '\0';
+    fclose(f);
+}
+
+static void lat_top_report(int fd) {
+    union { __u32 pid; struct comm_key comm; } key, next;
+    void *prev = NULL;
+    struct lat_row *rows = NULL;
+    size_t n = 0, cap = 0;
+    struct pid_lat v;   /* lat_by_comm values are just the lat_hist */
+    struct lat_hist h;
+
+    while (bpf_map_get_next_key(fd, prev, &next) == 0) {
+        key = next;
+        prev = &key;
+        if (bpf_map_lookup_elem(fd, &key, &v)) continue;
+        h = v.h;
+        if (!h.count) continue;
+        if (n == cap) {
+            cap = cap ? 2 * cap : 1024;
+            struct lat_row *nr = realloc(rows, cap * sizeof(*nr));
+            if (!nr) break;
+            rows = nr;
+        }
+        struct lat_row *r = &rows[n++];
+        if (g_lat_by == LAT_BY_PID) snprintf(r->key, sizeof(r->key), "%u", key.pid);
+        else                        snprintf(r->key, sizeof(r->key), "%.16s", key.comm.comm);
+        snprintf(r->comm, sizeof(r->comm), "%.15s", g_lat_by == LAT_BY_PID ? v.comm : "");
+        r->count  = h.count;
+        r->max_ns = h.max_ns;
+        r->mean   = (double)h.sum_ns / h.count;
+        r->p50    = hist_pct_ns(h.slots, h.count, 0.50, h.max_ns);
+        r->p99    = hist_pct_ns(h.slots, h.count, 0.99, h.max_ns);
+    }
+    qsort(rows, n, sizeof(*rows), cmp_lat_row_p99);
+
+    const char *kname = g_lat_by == LAT_BY_PID ? "pid" : "comm";
+    if (g_csv) {
+        if (g_csv_header) fprintf(g_out, "%s,%scount,p50_ms,p99_ms,max_ms,mean_ms\n",
+                                 kname, g_lat_by == LAT_BY_PID ? "comm," : "");
+    } else {
+        fprintf(g_out, "%-16s %s%10s %10s %10s %10s %10s\n", kname,
+            g_lat_by == LAT_BY_PID ? "comm             " : "",
+            "count", "p50_ms", "p99_ms", "max_ms", "mean_ms");
+    }
+    for (size_t i = 0; i < n && (int)i < g_top_n; i++) {
+        const struct lat_row *r = &rows[i];
+        const char *comm = r->comm;
+        if (g_csv) {
+            if (g_lat_by == LAT_BY_PID) fprintf(g_out, "%s,%s,", r->key, comm);
+            else                        fprintf(g_out, "%s,", r->key);
+            fprintf(g_out, "%" PRIu64 ",%.6f,%.6f,%.6f,%.6f\n", (uint64_t)r->count,
+                r->p50/1e6, r->p99/1e6, r->max_ns/1e6, r->mean/1e6);
+        } else {
+            fprintf(g_out, "%-16s ", r->key);
+            if (g_lat_by == LAT_BY_PID) fprintf(g_out, "%-16s ", comm);
+            fprintf(g_out, "%10" PRIu64 " %10.3f %10.3f %10.3f %10.3f\n", (uint64_t)r->count,
+                r->p50/1e6, r->p99/1e6, r->max_ns/1e6, r->mean/1e6);
+        }
+    }
+    fflush(g_out);
+    free(rows);
+}
+
+/* ---- Request-scoped scheduling delay (--uprobe-begin/--uprobe-end) ----
+ * on_req_begin/on_req_end are attached to BIN:SYM pairs; the switch
+ * handler books each thread's run, runqueue wait and off-CPU time into
+ * req_by_tid while a request is open, and on_req_end folds the totals
+ * into req_hist. The report is per request, not per switch.
+ */
+static struct {
+    const char *begin, *end;   /* BIN:SYM */
+} g_req;
+
+static int req_attach_one(struct bpf_program *prog, const char *spec, struct bpf_link **link) {
+    char bin[PATH_MAX];
+    const char *sym = strrchr(spec, ':');
+
+    if (!sym || sym == spec || !sym[1] || (size_t)(sym - spec) >= sizeof(bin)) {
+        errno = EINVAL;
+        return -1;
+    }
+    memcpy(bin, spec, sym - spec);
+    bin[sym - spec] = '\0';
+    LIBBPF_OPTS(bpf_uprobe_opts, uo, .func_name = sym + 1);
+    *link = bpf_program__attach_uprobe_opts(prog, -1, bin, 0, &uo);
+    return *link ? 0 : -1;
+}
+
+static int req_attach(struct schedlab_bpf *skel) {
+    if (req_attach_one(skel->progs.on_req_begin, g_req.begin, &skel->links.on_req_begin)) {
+        fprintf(stderr, "--uprobe-begin %s: %s\n", g_req.begin, strerror(errno));
+        return -1;
+    }
+    if (req_attach_one(skel->progs.on_req_end, g_req.end, &skel->links.on_req_end)) {
+        fprintf(stderr, "--uprobe-end %s: %s\n", g_req.end, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static void req_report(int fd) {
+    struct lat_hist h[REQ_HISTS] = {0};
+    double lat_mean;
+
+    for (__u32 i = 0; i < REQ_HISTS; i++)
+        bpf_map_lookup_elem(fd, &i, &h[i]);
+    lat_mean = h[REQ_H_LATENCY].count ? (double)h[REQ_H_LATENCY].sum_ns / h[REQ_H_LATENCY].count : 0;
+
+    if (g_csv) {
+        if (g_csv_header) fprintf(g_out, "request,count,p50_ms,p90_ms,p99_ms,max_ms,mean_ms,share\n");
+    } else {
+        fprintf(g_out, "requests %s -> %s\n", g_req.begin, g_req.end);
+        fprintf(g_out, "%-8s %10s %10s %10s %10s %10s %10s %7s\n", "request",
+            "count", "p50_ms", "p90_ms", "p99_ms", "max_ms", "mean_ms", "share");
+    }
+    for (int i = 0; i < REQ_HISTS; i++) {
+        const struct lat_hist *x = &h[i];
+        double mean = x->count ? (double)x->sum_ns / x->count : 0;
+        double p50 = hist_pct_ns(x->slots, x->count, 0.50, x->max_ns);
+        double p90 = hist_pct_ns(x->slots, x->count, 0.90, x->max_ns);
+        double p99 = hist_pct_ns(x->slots, x->count, 0.99, x->max_ns);
+        double share = lat_mean ? 100.0 * mean / lat_mean : 0;   /* of mean request latency */
+        if (g_csv)
+            fprintf(g_out, "%s,%" PRIu64 ",%.6f,%.6f,%.6f,%.6f,%.6f,%.2f\n", req_hist_names[i],
+                (uint64_t)x->count, p50/1e6, p90/1e6, p99/1e6, x->max_ns/1e6, mean/1e6, share);
+        else
+            fprintf(g_out, "%-8s %10" PRIu64 " %10.3f %10.3f %10.3f %10.3f %10.3f %6.1f%%\n",
+                req_hist_names[i], (uint64_t)x->count, p50/1e6, p90/1e6, p99/1e6,
+                x->max_ns/1e6, mean/1e6, share);
+    }
+    fflush(g_out);
+}
+
+/* ---- Scheduling class breakdown (MODE_CLASSES) ------------------------ */
+static void prio_label(__u32 policy, __s32 prio, char *out, size_t n) {
+    if (policy == 1 || policy == 2)          snprintf(out, n, "rt%d", 99 - prio);
+    else if (policy == 6)                    snprintf(out, n, "-");
+    else if (prio >= 100)                    snprintf(out, n, "nice%+d", prio - 120);
+    else                                     snprintf(out, n, "prio%d", prio);  /* PI-boosted */
+}
+
+static void class_report(int fd) {
+    __u32 nkeys = CLASS_POLICIES * CLASS_PRIOS;
+    struct class_stats *cs = calloc(nkeys, sizeof(*cs));
+    __u64 total_run = 0;
+
+    if (!cs) return;
+    for (__u32 k = 0; k < nkeys; k++) {
+        if (bpf_map_lookup_elem(fd, &k, &cs[k])) memset(&cs[k], 0, sizeof(cs[k]));
+        total_run += cs[k].run_ns;
+    }
+
+    if (g_csv) {
+        if (g_csv_header)
+            fputs("policy,level,wakes,slices,run_ms,cpu_share_pct,wait_ms,wait_p50_ms,wait_p99_ms,run_p50_ms,run_p99_ms\n", g_out);
+    } else {
+        fprintf(g_out, "%-8s %-8s %10s %10s %12s %6s %12s %9s %9s %9s %9s\n",
+            "policy", "level", "wakes", "slices", "run_ms", "cpu%", "wait_ms",
+            "wait_p50", "wait_p99", "run_p50", "run_p99");
+    }
+    for (__u32 k = 0; k < nkeys; k++) {
+        const struct class_stats *c = &cs[k];
+        if (!c->wakes && !c->slices && !c->waits) continue;
+        __u32 policy = k / CLASS_PRIOS;
+        char level[16];
+        prio_label(policy, (__s32)(k % CLASS_PRIOS) - 1, level, sizeof(level));
+        double share = total_run ? 100.0 * c->run_ns / total_run : 0.0;
+        double wp50 = hist_pct_ns(c->wait_slots, c->waits, 0.50, ~0ULL) / 1e6;
+        double wp99 = hist_pct_ns(c->wait_slots, c->waits, 0.99, ~0ULL) / 1e6;
+        double rp50 = hist_pct_ns(c->run_slots, c->slices, 0.50, ~0ULL) / 1e6;
+        double rp99 = hist_pct_ns(c->run_slots, c->slices, 0.99, ~0ULL) / 1e6;
+        if (g_csv)
+            fprintf(g_out, "%s,%s,%" PRIu64 ",%" PRIu64 ",%.6f,%.2f,%.6f,%.6f,%.6f,%.6f,%.6f\n",
+                policy_names[policy], level, (uint64_t)c->wakes, (uint64_t)c->slices,
+                c->run_ns/1e6, share, c->wait_ns/1e6, wp50, wp99, rp50, rp99);
+        else
+            fprintf(g_out, "%-8s %-8s %10" PRIu64 " %10" PRIu64 " %12.3f %6.2f %12.3f %9.3f %9.3f %9.3f %9.3f\n",
+                policy_names[policy], level, (uint64_t)c->wakes, (uint64_t)c->slices,
+                c->run_ns/1e6, share, c->wait_ns/1e6, wp50, wp99, rp50, rp99);
+    }
+    fflush(g_out);
+    free(cs);
+}
+
+/* Weighted fairness: for fair-class tasks, compare each task's share of
+ * CPU time with the share its load weight implies (w / sum w). Ratio < 1
+ * means the task got less than its weight entitles it to. Tasks that slept
+ * most of the run will show low ratios too; wait_ms tells them apart. */
+struct wfair_row {
+    __u32  pid;
+    __s32  prio;
+    __u32  policy;
+    __u64  run_ns, wait_ns, weight;
+    double share, implied;
+};
+
+static int cmp_wfair_ratio(const void *a, const void *b) {
+    const struct wfair_row *x = a, *y = b;
+    double rx = x->implied > 0 ? x->share / x->implied : 0;
+    double ry = y->implied > 0 ? y->share / y->implied : 0;
+    return (rx > ry) - (rx < ry);
+}
+
+static int is_fair_policy(__u32 policy) {
+    return policy == 0 || policy == 3 || policy == 5;   /* NORMAL, BATCH, IDLE */
+}
+
+static void wfair_report(int fd) {
+    __u32 key, next, *prev = NULL;
+    struct agg a;
+    struct wfair_row *rows = NULL;
+    size_t n = 0, cap = 0;
+    __u64 sum_run = 0, sum_w = 0;
+
+    while (bpf_map_get_next_key(fd, prev, &next) == 0) {
+        key = next;
+        prev = &key;
+        if (bpf_map_lookup_elem(fd, &key, &a)) continue;
+        if (!a.weight || !a.total_run_ns || !is_fair_policy(a.policy)) continue;
+        if (n == cap) {
+            cap = cap ? 2 * cap : 1024;
+            struct wfair_row *nr = realloc(rows, cap * sizeof(*nr));
+            if (!nr) break;
+            rows = nr;
+        }
+        rows[n++] = (struct wfair_row){ .pid = key, .prio = a.prio, .policy = a.policy,
+            .run_ns = a.total_run_ns, .wait_ns = a.total_wait_ns, .weight = a.weight };
+        sum_run += a.total_run_ns;
+        sum_w   += a.weight;
+    }
+    for (size_t i = 0; i < n; i++) {
+        rows[i].share   = sum_run ? (double)rows[i].run_ns / sum_run : 0;
+        rows[i].implied = sum_w   ? (double)rows[i].weight / sum_w   : 0;
+    }
+    qsort(rows, n, sizeof(*rows), cmp_wfair_ratio);
+
+    if (g_csv) {
+        if (g_csv_header)
+            fputs("pid,policy,level,weight,run_ms,wait_ms,cpu_share_pct,weight_share_pct,ratio\n", g_out);
+    } else {
+        fprintf(g_out, "\n%-8s %-8s %-8s %10s %12s %12s %8s %8s %6s\n",
+            "pid", "policy", "level", "weight", "run_ms", "wait_ms", "cpu%", "weight%", "ratio");
+    }
+    for (size_t i = 0; i < n && (int)i < g_top_n; i++) {
+        const struct wfair_row *r = &rows[i];
+        char level[16];
+        prio_label(r->policy, r->prio, level, sizeof(level));
+        double ratio = r->implied > 0 ? r->share / r->implied : 0;
+        if (g_csv)
+            fprintf(g_out, "%u,%s,%s,%" PRIu64 ",%.6f,%.6f,%.3f,%.3f,%.3f\n",
+                r->pid, policy_names[r->policy], level, (uint64_t)r->weight,
+                r->run_ns/1e6, r->wait_ns/1e6, 100*r->share, 100*r->implied, ratio);
+        else
+            fprintf(g_out, "%-8u %-8s %-8s %10" PRIu64 " %12.3f %12.3f %8.3f %8.3f %6.2f\n",
+                r->pid, policy_names[r->policy], level, (uint64_t)r->weight,
+                r->run_ns/1e6, r->wait_ns/1e6, 100*r->share, 100*r->implied, ratio);
+    }
+    fflush(g_out);
+    free(rows);
+}
+
+/* ---- Lifetime histograms (MODE_SHORTLONG) ------------------------------
+ * Summary of the kernel's short/long life_hist, printed to stderr at exit
+ * so it never lands in the middle of the per-exit CSV.
+ */
+static void life_report(int fd) {
+    static const char *group[2] = { "short", "long" };
+
+    fprintf(stderr, "\nlifetimes (cutoff %.1fms)\n", g_short_ns / 1e6);
+    fprintf(stderr, "%-6s %10s %12s %12s %12s\n", "group", "count", "mean_ms", "p50_ms", "p99_ms");
+    for (__u32 k = 0; k < 2; k++) {
+        struct life_hist h;
+        if (bpf_map_lookup_elem(fd, &k, &h)) continue;
+        double p50 = hist_pct_nb(h.slots, LIFE_BUCKETS, h.count, 0.50, ~0ULL);
+        double p99 = hist_pct_nb(h.slots, LIFE_BUCKETS, h.count, 0.99, ~0ULL);
+        fprintf(stderr, "%-6s %10" PRIu64 " %12.3f %12.3f %12.3f\n", group[k], (uint64_t)h.count,
+            h.count ? h.sum_ns / 1e6 / h.count : 0.0, p50 / 1e6, p99 / 1e6);
+        fprintf(stderr, "  log2 buckets:");
+        for (int b = 0; b < LIFE_BUCKETS; b++)
+            if (h.slots[b]) fprintf(stderr, " [%.3gms]=%" PRIu64, (double)(1ULL << b) / 1e6, (uint64_t)h.slots[b]);
+        fputc('\n', stderr);
+    }
+}
+
+/* ---- Per-PID aggregate deltas (top, export) ----------------------------
+ * agg_by_pid and lat_by_pid are read in full and diffed against the
+ * previous read, so callers get what happened since then without any
+ * events going through the ring buffer (CFG_F_NO_EVENTS).
+ */
+struct agg_snap {            /* cumulative counters at the previous read */
+    __u64 run_ns, wait_ns, switches, waitlongs, lat_count, lat_sum_ns;
+    __u64 slots[LAT_BUCKETS];
+};
+
+struct agg_row {
+    __u64  key;              /* pid, or cgroup id once grouped */
+    __u64  cgid;
+    __u32  tasks;
+    __u64  run_ns, wait_ns, switches, waitlongs, lat_count, lat_sum_ns, lat_max;
+    __u64  slots[LAT_BUCKETS];
+    double cpu, wait, sw, p99;   /* top: cpu %, wait ms/s, switches/s, p99 ns */
+};
+
+/* Rows for every PID that ran or waited since the last call; a PID not in
+ * *prev counts from zero. *prev is replaced by this read. */
+static size_t agg_deltas(struct u64map *prev_snap, int agg_fd, int lat_fd, struct agg_row **out) {
+    static const struct agg_snap none;
+    struct u64map snap;
+    struct agg_row *rows = NULL;
+    size_t n = 0, cap = 0;
+    __u32 key, next;
+    void *prev = NULL;
+    struct agg a;
+    struct pid_lat pl;
+    const struct lat_hist *h = &pl.h;
+
+    *out = NULL;
+    if (u64map_init(&snap, sizeof(struct agg_snap))) return 0;
+    while (bpf_map_get_next_key(agg_fd, prev, &next) == 0) {
+        key = next;
+        prev = &key;
+        if (bpf_map_lookup_elem(agg_fd, &key, &a)) continue;
+        struct agg_snap *s = u64map_get(&snap, key);
+        if (!s) break;
+        s->run_ns    = a.total_run_ns;
+        s->wait_ns   = a.total_wait_ns;
+        s->switches  = a.switches;
+        s->waitlongs = a.waitlongs;
+        pl.h.max_ns = 0;
+        if (!bpf_map_lookup_elem(lat_fd, &key, &pl)) {
+            s->lat_count  = h->count;
+            s->lat_sum_ns = h->sum_ns;
+            memcpy(s->slots, h->slots, sizeof(s->slots));
+        }
+
+        /* an LRU eviction restarts the counters; count from zero then */
+        const struct agg_snap *p = prev_snap->keys ? u64map_find(prev_snap, key) : NULL;
+        if (!p || s->switches < p->switches || s->run_ns < p->run_ns) p = &none;
+        if (s->run_ns == p->run_ns && s->wait_ns == p->wait_ns && s->switches == p->switches)
+            continue;        /* idle since the last read */
+        if (n == cap) {
+            cap = cap ? 2 * cap : 1024;
+            struct agg_row *nr = realloc(rows, cap * sizeof(*nr));
+            if (!nr) break;
+            rows = nr;
+        }
+        struct agg_row *r = &rows[n++];
+        memset(r, 0, sizeof(*r));
+        r->key       = key;
+        r->cgid      = a.cgid;
+        r->tasks     = 1;
+        r->run_ns    = s->run_ns - p->run_ns;
+        r->wait_ns   = s->wait_ns - p->wait_ns;
+        r->switches  = s->switches - p->switches;
+        r->waitlongs = s->waitlongs >= p->waitlongs ? s->waitlongs - p->waitlongs : s->waitlongs;
+        r->lat_max   = h->max_ns;
+        if (s->lat_count >= p->lat_count) {
+            r->lat_count  = s->lat_count - p->lat_count;
+            r->lat_sum_ns = s->lat_sum_ns - p->lat_sum_ns;
+            for (int b = 0; b < LAT_BUCKETS; b++) r->slots[b] = s->slots[b] - p->slots[b];
+        } else {             /* lat_by_pid entry evicted or reset: count from zero */
+            r->lat_count  = s->lat_count;
+            r->lat_sum_ns = s->lat_sum_ns;
+            memcpy(r->slots, s->slots, sizeof(r->slots));
+        }
+    }
+    u64map_free(prev_snap);
+    *prev_snap = snap;
+    *out = rows;
+    return n;
+}
+
+/* kernfs ids double as inode numbers on 64-bit, so a cgroup id is found
+ * by walking /sys/fs/cgroup and matching st_ino. Only the cgroup2 mount
+ * is walked; v1 hierarchies mounted below it are other filesystems. */
+#define CG_NAME_LEN 128
+static struct u64map g_cg_names;   /* cgid -> char[CG_NAME_LEN] */
+static __u64         g_cg_scan_ns;
+
+static void cg_scan_dir(char *path, size_t len, size_t cap, dev_t dev, int depth) {
+    DIR *d;
+    struct dirent *de;
+    struct stat st;
+
+    if (stat(path, &st) || st.st_dev != dev || !(d = opendir(path))) return;
+    char *name = u64map_get(&g_cg_names, (uint64_t)st.st_ino);
+    if (name) snprintf(name, CG_NAME_LEN, "%s", len > 14 ? path + 14 : "/");
+    while (depth < 16 && (de = readdir(d))) {
+        if (de->d_type != DT_DIR || de->d_name[0] == '.') continue;
+        int k = snprintf(path + len, cap - len, "/%s", de->d_name);
+        if (k > 0 && (size_t)k < cap - len)
+            cg_scan_dir(path, len + (size_t)k, cap, dev, depth + 1);
+        path[len] = '\0';
+    }
+    closedir(d);
+}
+
+static const char *cg_name(__u64 cgid) {
+    static char unknown[32];
+    const char *name;
+
+    if (!g_cg_names.keys && u64map_init(&g_cg_names, CG_NAME_LEN)) return "?";
+    name = u64map_find(&g_cg_names, cgid);
+    if ((!name || !name[0]) && mono_ns() - g_cg_scan_ns > 5000000000ULL) {
+        char path[PATH_MAX] = "/sys/fs/cgroup";
+        struct stat st;
+        if (!stat(path, &st))
+            cg_scan_dir(path, strlen(path), sizeof(path), st.st_dev, 0);
+        g_cg_scan_ns = mono_ns();
+        name = u64map_find(&g_cg_names, cgid);
+    }
+    if (name && name[0]) return name;
+    snprintf(unknown, sizeof(unknown), "cgid:%" PRIu64, (uint64_t)cgid);
+    return unknown;
+}
+
+/* ---- Live top view (MODE_TOP) ------------------------------------------
+ * Once per tick the agg deltas since the previous tick become one row per
+ * PID, so every column is a rate over the last interval. Grouping by
+ * cgroup sums the per-PID rows and merges their latency histograms, so a
+ * redraw after 'g' needs no new read.
+ */
+enum top_col { TOP_KEY = 0, TOP_CPU, TOP_WAIT, TOP_SW, TOP_P99, TOP_STARV, TOP_NCOLS };
+static const char *top_col_names[TOP_NCOLS] = { "pid", "cpu", "wait", "sw", "p99", "starv" };
+static const char  top_col_keys[TOP_NCOLS]  = { 'n', 'c', 'w', 's', 'p', 'x' };
+
+static struct {
+    struct u64map   prev;    /* pid -> struct agg_snap */
+    __u64           prev_ns;
+    struct agg_row *rows;    /* per-pid deltas of the last interval */
+    size_t          n;
+    double          dt;
+    int             by_cgroup, sort, reverse;
+    int             tty, raw;
+    struct termios  saved;
+} g_top = { .sort = TOP_CPU };
+
+static int parse_top_sort(const char *s) {
+    for (int i = 0; i < TOP_NCOLS; i++)
+        if (!strcmp(s, top_col_names[i])) return i;
+    if (!strcmp(s, "cgroup")) return TOP_KEY;
+    return -1;
+}
+
+static void top_finish(struct agg_row *r, double dt) {
+    r->cpu  = dt > 0 ? r->run_ns / (dt * 1e7) : 0.0;
+    r->wait = dt > 0 ? r->wait_ns / (dt * 1e6) : 0.0;
+    r->sw   = dt > 0 ? r->switches / dt : 0.0;
+    r->p99  = hist_pct_ns(r->slots, r->lat_count, 0.99, r->lat_max);
+}
+
+static double top_val(const struct agg_row *r) {
+    switch (g_top.sort) {
+    case TOP_CPU:   return r->cpu;
+    case TOP_WAIT:  return r->wait;
+    case TOP_SW:    return r->sw;
+    case TOP_P99:   return r->p99;
+    case TOP_STARV: return (double)r->waitlongs;
+    default:        return -(double)r->key;   /* ascending pid/cgid */
+    }
+}
+
+static int cmp_top_row(const void *a, const void *b) {
+    double x = top_val(a), y = top_val(b);
+    int c = (x < y) - (x > y);
+    return g_top.reverse ? -c : c;
+}
+
+static void top_draw(void) {
+    struct agg_row *rows = g_top.rows;
+    size_t n = g_top.n;
+    struct u64map grp = {0};
+    int lines = g_top_n;
+
+    if (g_top.by_cgroup) {
+        if (u64map_init(&grp, sizeof(struct agg_row))) return;
+        for (size_t i = 0; i < g_top.n; i++) {
+            const struct agg_row *s = &g_top.rows[i];
+            struct agg_row *d = u64map_get(&grp, s->cgid);
+            if (!d) break;
+            d->key = d->cgid = s->cgid;
+            d->tasks++;
+            d->run_ns    += s->run_ns;
+            d->wait_ns   += s->wait_ns;
+            d->switches  += s->switches;
+            d->waitlongs += s->waitlongs;
+            d->lat_count += s->lat_count;
+            if (s->lat_max > d->lat_max) d->lat_max = s->lat_max;
+            for (int b = 0; b < LAT_BUCKETS; b++) d->slots[b] += s->slots[b];
+        }
+        rows = malloc((grp.n ? grp.n : 1) * sizeof(*rows));
+        if (!rows) { u64map_free(&grp); return; }
+        n = 0;
+        for (size_t i = 0; i < grp.cap; i++)
+            if (grp.keys[i]) {
+                rows[n] = *(struct agg_row *)(grp.vals + i * grp.vsz);
+                top_finish(&rows[n++], g_top.dt);
+            }
+        u64map_free(&grp);
+    }
+    qsort(rows, n, sizeof(*rows), cmp_top_row);
+
+    if (g_csv) {
+        __u64 now = mono_ns();
+        char comm[32];
+        for (size_t i = 0; i < n && (int)i < g_top_n; i++) {
+            const struct agg_row *r = &rows[i];
+            if (!g_top.by_cgroup) pid_comm((__u32)r->key, comm, sizeof(comm));
+            fprintf(g_out, "%" PRIu64 ",%" PRIu64 ",%s,%.2f,%.3f,%.1f,%.3f,%" PRIu64 "\n",
+                (uint64_t)now, (uint64_t)r->key, g_top.by_cgroup ? cg_name(r->key) : comm,
+                r->cpu, r->wait, r->sw, r->p99 / 1e6, (uint64_t)r->waitlongs);
+        }
+        fflush(g_out);
+        if (rows != g_top.rows) free(rows);
+        return;
+    }
+
+    double cpu = 0, sw = 0;
+    size_t starved = 0;
+    for (size_t i = 0; i < n; i++) {
+        cpu += rows[i].cpu;
+        sw  += rows[i].sw;
+        starved += rows[i].waitlongs != 0;
+    }
+    if (g_top.tty) {
+        struct winsize ws;
+        if (!ioctl(fileno(g_out), TIOCGWINSZ, &ws) && ws.ws_row > 5) lines = ws.ws_row - 5;
+        fputs("\033[H\033[2J", g_out);
+    }
+    time_t t = time(NULL);
+    char ts[16];
+    strftime(ts, sizeof(ts), "%H:%M:%S", localtime(&t));
+    fprintf(g_out, "schedlab top %s  interval %.2fs  %zu %s active  cpu %.1f%%  %.0f sw/s  %zu starved\n",
+        ts, g_top.dt, n, g_top.by_cgroup ? "cgroups" : "tasks", cpu, sw, starved);
+    if (g_top.raw)
+        fputs("sort: c=cpu w=wait s=sw p=p99 x=starv n=id  r=reverse  g=pid/cgroup  q=quit\n", g_out);
+    fputc('\n', g_out);
+
+    static const char *hdr[TOP_NCOLS] = { "", "CPU%", "WAITms/s", "SW/s", "P99ms", "STARV" };
+    static const int   wid[TOP_NCOLS] = { 8, 7, 9, 8, 9, 6 };
+    for (int c = 0; c < TOP_NCOLS; c++) {
+        const char *h = c ? hdr[c] : g_top.by_cgroup ? "CGID" : "PID";
+        int hi = g_top.tty && c == g_top.sort;
+        fprintf(g_out, "%s%*s%s ", hi ? "\033[7m" : "", wid[c], h, hi ? "\033[0m" : "");
+    }
+    fputs(g_top.by_cgroup ? " TASKS CGROUP\n" : " COMM\n", g_out);
+
+    for (size_t i = 0; i < n && (int)i < lines; i++) {
+        const struct agg_row *r = &rows[i];
+        char comm[32] = "";
+        fprintf(g_out, "%8" PRIu64 " %7.1f %9.2f %8.0f %9.3f %5" PRIu64 "%c  ",
+            (uint64_t)r->key, r->cpu, r->wait, r->sw, r->p99 / 1e6,
+            (uint64_t)r->waitlongs, r->waitlongs ? '!' : ' ');
+        if (g_top.by_cgroup) {
+            fprintf(g_out, "%5u %s\n", r->tasks, cg_name(r->key));
+        } else {
+            pid_comm((__u32)r->key, comm, sizeof(comm));
+            fprintf(g_out, "%s\n", comm[0] ? comm : "-");
+        }
+    }
+    if (!g_top.tty) fputc('\n', g_out);
+    fflush(g_out);
+    if (rows != g_top.rows) free(rows);
+}
+
+static void top_refresh(int agg_fd, int lat_fd) {
+    struct agg_row *rows;
+    __u64 now = mono_ns();
+    double dt = g_top.prev_ns ? (now - g_top.prev_ns) / 1e9 : 0.0;
+    size_t n = agg_deltas(&g_top.prev, agg_fd, lat_fd, &rows);
+
+    g_top.prev_ns = now;
+    if (!dt) { free(rows); return; }   /* first read is the baseline */
+    for (size_t i = 0; i < n; i++) top_finish(&rows[i], dt);
+    free(g_top.rows);
+    g_top.rows = rows;
+    g_top.n    = n;
+    g_top.dt   = dt;
+    top_draw();
+}
+
+static void top_term_restore(void) {
+    if (!g_top.raw) return;
+    tcsetattr(STDIN_FILENO, TCSANOW, &g_top.saved);
+    g_top.raw = 0;
+}
+
+/* Interactive keys only when both ends are a terminal; ISIG stays on so
+ * Ctrl-C still goes through on_sig. */
+static void top_init(void) {
+    struct termios t;
+
+    g_top.tty = !g_csv && isatty(fileno(g_out));
+    if (!g_top.tty || !isatty(STDIN_FILENO) || tcgetattr(STDIN_FILENO, &g_top.saved)) return;
+    t = g_top.saved;
+    t.c_lflag &= ~(ICANON | ECHO);
+    t.c_cc[VMIN]  = 0;
+    t.c_cc[VTIME] = 0;
+    if (tcsetattr(STDIN_FILENO, TCSANOW, &t)) return;
+    g_top.raw = 1;
+    atexit(top_term_restore);
+}
+
+static void top_keys(void) {
+    char ch;
+    int redraw = 0;
+
+    while (g_top.raw && read(STDIN_FILENO, &ch, 1) == 1) {
+        if (ch == 'q') { g_stop = 1; return; }
+        if (ch == 'r') { g_top.reverse = !g_top.reverse; redraw = 1; }
+        if (ch == 'g') { g_top.by_cgroup = !g_top.by_cgroup; redraw = 1; }
+        for (int c = 0; c < TOP_NCOLS; c++)
+            if (ch == top_col_keys[c]) {
+                g_top.sort = c;
+                g_top.reverse = 0;
+                redraw = 1;
+            }
+    }
+    if (redraw && g_top.dt) top_draw();
+}
+
+static void top_free(void) {
+    top_term_restore();
+    u64map_free(&g_top.prev);
+    free(g_top.rows);
+}
+
+/* ---- Interference matrix (MODE_INTERF) --------------------------------
+ * interference holds, per (victim, preemptor) pair of tasks and of
+ * cgroups, how often the preemptor took the CPU from a still-runnable
+ * victim and how long it then ran. The report is the --top N pairs by
+ * that run time, i.e. the CPU the preemptor took from the victim.
+ */
+/* Must match enum interf_kind / struct interf_key / struct interf_val in schedlab.bpf.c */
+enum { INTERF_PID = 0, INTERF_CGROUP = 1 };
+
+struct interf_key {
+    __u32 kind;
+    __u32 _pad;
+    __u64 victim;
+    __u64 preemptor;
+};
+
+struct interf_val {
+    __u64 count;
+    __u64 run_ns;
+};
+
+struct interf_row {
+    struct interf_key k;
+    struct interf_val v;
+};
+
+static int cmp_interf_row(const void *a, const void *b) {
+    const struct interf_row *x = a, *y = b;
+    if (x->v.run_ns != y->v.run_ns) return (x->v.run_ns < y->v.run_ns) - (x->v.run_ns > y->v.run_ns);
+    return (x->v.count < y->v.count) - (x->v.count > y->v.count);
+}
+
+static void interf_name(__u64 key, char *out, size_t n) {
+    if (g_top.by_cgroup) snprintf(out, n, "%s", key ? cg_name(key) : "?");
+    else                 pid_comm((__u32)key, out, n);
+}
+
+static void interf_report(int fd) {
+    __u32 kind = g_top.by_cgroup ? INTERF_CGROUP : INTERF_PID;
+    struct interf_key key, next;
+    struct interf_row *rows = NULL;
+    size_t n = 0, cap = 0;
+    void *prev = NULL;
+    char vn[256], pn[256];
+
+    while (bpf_map_get_next_key(fd, prev, &next) == 0) {
+        key = next;
+        prev = &key;
+        if (key.kind != kind) continue;
+        if (n == cap) {
+            cap = cap ? 2 * cap : 1024;
+            struct interf_row *nr = realloc(rows, cap * sizeof(*nr));
+            if (!nr) break;
+            rows = nr;
+        }
+        rows[n].k = key;
+        if (bpf_map_lookup_elem(fd, &key, &rows[n].v) || !rows[n].v.count) continue;
+        n++;
+    }
+    qsort(rows, n, sizeof(*rows), cmp_interf_row);
+
+    const char *kname = g_top.by_cgroup ? "cgid" : "pid";
+    if (g_csv) {
+        if (g_csv_header)
+            fprintf(g_out, "victim_%s,victim,preemptor_%s,preemptor,preemptions,run_ms,mean_run_us\n",
+                kname, kname);
+    } else {
+        const char *name = g_top.by_cgroup ? "cgroup" : "comm";
+        fprintf(g_out, "%-10s %-24s %-10s %-24s %11s %10s %11s\n", "victim", name, "preemptor", name,
+            "preemptions", "run_ms", "mean_run_us");
+    }
+    for (size_t i = 0; i < n && (int)i < g_top_n; i++) {
+        const struct interf_row *r = &rows[i];
+        double mean = r->v.run_ns / 1e3 / r->v.count;
+        interf_name(r->k.victim, vn, sizeof(vn));
+        interf_name(r->k.preemptor, pn, sizeof(pn));
+        if (g_csv)
+            fprintf(g_out, "%" PRIu64 ",%s,%" PRIu64 ",%s,%" PRIu64 ",%.6f,%.3f\n",
+                (uint64_t)r->k.victim, vn, (uint64_t)r->k.preemptor, pn,
+                (uint64_t)r->v.count, r->v.run_ns / 1e6, mean);
+        else
+            fprintf(g_out, "%-10" PRIu64 " %-24.24s %-10" PRIu64 " %-24.24s %11" PRIu64 " %10.3f %11.1f\n",
+                (uint64_t)r->k.victim, vn, (uint64_t)r->k.preemptor, pn,
+                (uint64_t)r->v.count, r->v.run_ns / 1e6, mean);
+    }
+    fflush(g_out);
+    free(rows);
+}
+
+/* ---- CPU topology (sysfs) ---------------------------------------------
+ * Read once at startup from /sys/devices/system/cpu and pushed to
+ * cpu_topo before attach. Core and LLC ids are the lowest CPU among the
+ * SMT siblings / the CPUs sharing the highest-level data or unified
+ * cache; without cache info (some VMs) the package stands in for the
+ * LLC. sibling is the first other CPU of the core (-1 without SMT).
+ * Anything else unreadable stays 0.
+ */
+/* Must match struct cpu_topo / struct cpu_dom / MAX_CPUS in schedlab.bpf.c */
+#define MAX_CPUS 1024
+struct cpu_topo {
+    __u32 llc;
+    __u32 node;
+    __u32 pkg;
+    __u32 core;
+    __s32 sibling;   /* -1 = none */
+    __u32 valid;
+};
+
+struct cpu_dom {
+    struct lat_hist wait;
+    __u64 mig_in;
+    __u64 mig_xllc;
+    __u64 mig_xnode;
+};
+
+static const char      *g_sysfs_cpu = "/sys/devices/system/cpu";
+static struct cpu_topo *g_topo;   /* g_ncpus entries, valid = in use */
+
+static int sysfs_line(char *buf, size_t n, const char *fmt, ...) {
+    char path[PATH_MAX];
+    va_list ap;
+    FILE *f;
+    int ok;
+
+    va_start(ap, fmt);
+    vsnprintf(path, sizeof(path), fmt, ap);
+    va_end(ap);
+    if (!(f = fopen(path, "r"))) return -1;
+    ok = fgets(buf, (int)n, f) != NULL;
+    fclose(f);
+    if (!ok) return -1;
+    buf[strcspn(buf, "\n")] = '\0';
+    return 0;
+}
+
+static __u32 topo_llc(int cpu) {
+    char buf[256];
+    int best = -1, level;
+    __u32 llc = 0;
+
+    for (int i = 0; !sysfs_line(buf, sizeof(buf), "%s/cpu%d/cache/index%d/level", g_sysfs_cpu, cpu, i); i++) {
+        level = atoi(buf);
+        if (level <= best) continue;
+        if (!sysfs_line(buf, sizeof(buf), "%s/cpu%d/cache/index%d/type", g_sysfs_cpu, cpu, i) &&
+            !strcmp(buf, "Instruction"))
+            continue;
+        if (sysfs_line(buf, sizeof(buf), "%s/cpu%d/cache/index%d/shared_cpu_list", g_sysfs_cpu, cpu, i))
+            continue;
+        best = level;
+        llc = (__u32)strtoul(buf, NULL, 10);   /* lists are sorted, so this is the lowest */
+    }
+    if (best < 0 && !sysfs_line(buf, sizeof(buf), "%s/cpu%d/topology/core_siblings_list", g_sysfs_cpu, cpu))
+        llc = (__u32)strtoul(buf, NULL, 10);
+    return llc;
+}
+
+static __u32 topo_node(int cpu) {
+    char path[PATH_MAX];
+    struct dirent *d;
+    unsigned node = 0;
+    DIR *dir;
+
+    snprintf(path, sizeof(path), "%s/cpu%d", g_sysfs_cpu, cpu);
+    if (!(dir = opendir(path))) return 0;
+    while ((d = readdir(dir)))
+        if (sscanf(d->d_name, "node%u", &node) == 1) break;
+    closedir(dir);
+    return node;
+}
+
+/* first CPU in a cpulist ("0-3,8") other than cpu, -1 if none */
+static __s32 cpulist_other(const char *s, int cpu) {
+    char *end;
+    while (*s) {
+        unsigned long lo = strtoul(s, &end, 10), hi = lo;
+        if (end == s) break;
+        if (*end == '-') hi = strtoul(end + 1, &end, 10);
+        for (unsigned long c = lo; c <= hi; c++)
+            if ((int)c != cpu) return (__s32)c;
+        s = *end == ',' ? end + 1 : end;
+    }
+    return -1;
+}
+
+static int cpulist_has(const char *s, int cpu) {
+    char *end;
+    while (*s) {
+        unsigned long lo = strtoul(s, &end, 10), hi = lo;
+        if (end == s) break;
+        if (*end == '-') hi = strtoul(end + 1, &end, 10);
+        if ((unsigned long)cpu >= lo && (unsigned long)cpu <= hi) return 1;
+        s = *end == ',' ? end + 1 : end;
+    }
+    return 0;
+}
+
+/* Possible CPUs that are not present, not online or have no topology/
+ * directory stay invalid: they are not pushed and no domain counts them. */
+static int topo_load(void) {
+    char buf[64], present[4096], online[4096], path[PATH_MAX];
+    int have_present, have_online;
+
+    if (!(g_topo = calloc(g_ncpus, sizeof(*g_topo)))) return -1;
+    have_present = !sysfs_line(present, sizeof(present), "%s/present", g_sysfs_cpu);
+    have_online  = !sysfs_line(online, sizeof(online), "%s/online", g_sysfs_cpu);
+    for (int cpu = 0; cpu < g_ncpus; cpu++) {
+        struct cpu_topo *t = &g_topo[cpu];
+        t->sibling = -1;
+        if (have_present && !cpulist_has(present, cpu)) continue;
+        if (have_online && !cpulist_has(online, cpu)) continue;
+        snprintf(path, sizeof(path), "%s/cpu%d/topology", g_sysfs_cpu, cpu);
+        if (access(path, F_OK)) continue;
+        t->valid = 1;
+        if (!sysfs_line(buf, sizeof(buf), "%s/cpu%d/topology/physical_package_id", g_sysfs_cpu, cpu) &&
+            atoi(buf) > 0)
+            t->pkg = (__u32)atoi(buf);
+        t->llc  = topo_llc(cpu);
+        t->node = topo_node(cpu);
+        t->core = cpu;
+        t->sibling = -1;
+        if (!sysfs_line(buf, sizeof(buf), "%s/cpu%d/topology/thread_siblings_list", g_sysfs_cpu, cpu)) {
+            t->core = (__u32)strtoul(buf, NULL, 10);
+            t->sibling = cpulist_other(buf, cpu);
+        }
+    }
+    for (int cpu = 0; cpu < g_ncpus; cpu++) {
+        __s32 sib = g_topo[cpu].sibling;
+        if (sib >= 0 && (sib >= g_ncpus || !g_topo[sib].valid)) g_topo[cpu].sibling = -1;
+    }
+    return 0;
+}
+
+static int topo_push(int fd) {
+    for (__u32 cpu = 0; cpu < (__u32)g_ncpus && cpu < MAX_CPUS; cpu++)
+        if (g_topo[cpu].valid && bpf_map_update_elem(fd, &cpu, &g_topo[cpu], BPF_ANY)) return -1;
+    return 0;
+}
+
+/* ---- Wakeup placement (MODE_WAKES) -------------------------------------
+ * Each wakeup is classified by the narrowest cpu_topo domain shared by
+ * the CPU the waker ran on and the CPU the wakee was queued on, and its
+ * wake -> switch-in latency goes to that class's histogram in wake_hist.
+ * The pair table folds wake_pairs into unordered task pairs that wake
+ * each other from outside their LLC in both directions (ping-pong across
+ * caches or sockets), most cross-node wakeups first.
+ */
+/* Must match enum wake_class / struct wake_pair_key / struct wake_pair_val in schedlab.bpf.c */
+enum { WAKE_LOCAL = 0, WAKE_LLC, WAKE_XLLC, WAKE_XNODE, WAKE_CLASSES };
+static const char *wake_class_names[WAKE_CLASSES] = { "local", "same-llc", "cross-llc", "cross-node" };
+
+struct wake_pair_key {
+    __u32 waker;
+    __u32 wakee;
+};
+
+struct wake_pair_val {
+    __u64 count[WAKE_CLASSES];
+    __u64 wait_ns[WAKE_CLASSES];
+};
+
+struct wake_pp {              /* a < b; [0] = a woke b, [1] = b woke a */
+    __u32 a, b;
+    __u64 xnode[2], xllc[2];
+    __u64 xnode_wait_ns;
+};
+
+static int cmp_wake_pp(const void *a, const void *b) {
+    const struct wake_pp *x = a, *y = b;
+    __u64 xn = x->xnode[0] + x->xnode[1], yn = y->xnode[0] + y->xnode[1];
+    __u64 xl = x->xllc[0] + x->xllc[1], yl = y->xllc[0] + y->xllc[1];
+    if (xn != yn) return (xn < yn) - (xn > yn);
+    return (xl < yl) - (xl > yl);
+}
+
+static void wake_class_report(int fd) {
+    struct lat_hist h[WAKE_CLASSES] = {0};
+    __u64 total = 0;
+
+    for (__u32 i = 0; i < WAKE_CLASSES; i++) {
+        bpf_map_lookup_elem(fd, &i, &h[i]);
+        total += h[i].count;
+    }
+    if (g_csv) {
+        if (g_csv_header) fputs("class,wakeups,share_pct,p50_us,p99_us,max_us,mean_us\n", g_out);
+    } else {
+        fprintf(g_out, "%-10s %12s %7s %10s %10s %10s %10s\n", "class", "wakeups", "share",
+            "p50_us", "p99_us", "max_us", "mean_us");
+    }
+    for (int i = 0; i < WAKE_CLASSES; i++) {
+        const struct lat_hist *x = &h[i];
+        double share = total ? 100.0 * x->count / total : 0;
+        double mean = x->count ? (double)x->sum_ns / x->count : 0;
+        double p50 = hist_pct_ns(x->slots, x->count, 0.50, x->max_ns);
+        double p99 = hist_pct_ns(x->slots, x->count, 0.99, x->max_ns);
+        if (g_csv)
+            fprintf(g_out, "%s,%" PRIu64 ",%.2f,%.3f,%.3f,%.3f,%.3f\n", wake_class_names[i],
+                (uint64_t)x->count, share, p50/1e3, p99/1e3, x->max_ns/1e3, mean/1e3);
+        else
+            fprintf(g_out, "%-10s %12" PRIu64 " %6.1f%% %10.1f %10.1f %10.1f %10.1f\n",
+                wake_class_names[i], (uint64_t)x->count, share, p50/1e3, p99/1e3,
+                x->max_ns/1e3, mean/1e3);
+    }
+}
+
+static void wake_pair_report(int fd) {
+    struct wake_pair_key key, next;
+    struct wake_pair_val v;
+    struct u64map pairs;
+    struct wake_pp *rows = NULL;
+    size_t n = 0;
+    void *prev = NULL;
+    char an[32], bn[32];
+
+    if (u64map_init(&pairs, sizeof(struct wake_pp))) return;
+    while (bpf_map_get_next_key(fd, prev, &next) == 0) {
+        key = next;
+        prev = &key;
+        if (key.waker == key.wakee || bpf_map_lookup_elem(fd, &key, &v)) continue;
+        if (!v.count[WAKE_XLLC] && !v.count[WAKE_XNODE]) continue;
+        int dir = key.waker > key.wakee;
+        __u32 a = dir ? key.wakee : key.waker, b = dir ? key.waker : key.wakee;
+        struct wake_pp *pp = u64map_get(&pairs, (uint64_t)a << 32 | b);
+        if (!pp) break;
+        pp->a = a;
+        pp->b = b;
+        pp->xnode[dir] += v.count[WAKE_XNODE];
+        pp->xllc[dir]  += v.count[WAKE_XLLC];
+        pp->xnode_wait_ns += v.wait_ns[WAKE_XNODE];
+    }
+    if (pairs.n && (rows = malloc(pairs.n * sizeof(*rows)))) {
+        for (size_t i = 0; i < pairs.cap; i++) {
+            const struct wake_pp *pp = (const struct wake_pp *)(pairs.vals + i * pairs.vsz);
+            if (!pairs.keys[i]) continue;
+            if ((pp->xnode[0] || pp->xllc[0]) && (pp->xnode[1] || pp->xllc[1])) rows[n++] = *pp;
+        }
+        qsort(rows, n, sizeof(*rows), cmp_wake_pp);
+    }
+
+    if (g_csv) {
+        if (g_csv_header)
+            fputs("pid_a,comm_a,pid_b,comm_b,xnode_ab,xnode_ba,xllc_ab,xllc_ba,xnode_mean_wait_us\n", g_out);
+    } else {
+        fprintf(g_out, "\nping-pong pairs (wakeups from outside the LLC, both directions)\n");
+        fprintf(g_out, "%-8s %-16s %-8s %-16s %9s %9s %9s %9s %12s\n", "pid_a", "comm", "pid_b", "comm",
+            "xnode_ab", "xnode_ba", "xllc_ab", "xllc_ba", "xnode_wt_us");
+    }
+    for (size_t i = 0; i < n && (int)i < g_top_n; i++) {
+        const struct wake_pp *r = &rows[i];
+        __u64 xn = r->xnode[0] + r->xnode[1];
+        double wt = xn ? r->xnode_wait_ns / 1e3 / xn : 0;
+        pid_comm(r->a, an, sizeof(an));
+        pid_comm(r->b, bn, sizeof(bn));
+        if (g_csv)
+            fprintf(g_out, "%u,%s,%u,%s,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%.3f\n",
+                r->a, an, r->b, bn, (uint64_t)r->xnode[0], (uint64_t)r->xnode[1],
+                (uint64_t)r->xllc[0], (uint64_t)r->xllc[1], wt);
+        else
+            fprintf(g_out, "%-8u %-16.16s %-8u %-16.16s %9" PRIu64 " %9" PRIu64 " %9" PRIu64 " %9" PRIu64 " %12.1f\n",
+                r->a, an, r->b, bn, (uint64_t)r->xnode[0], (uint64_t)r->xnode[1],
+                (uint64_t)r->xllc[0], (uint64_t)r->xllc[1], wt);
+    }
+    fflush(g_out);
+    free(rows);
+    u64map_free(&pairs);
+}
+
+/* ---- SMT sibling contention (MODE_SMT) ---------------------------------
+ * smt_by_pid splits each task's run time on SMT CPUs into time with the
+ * sibling running a task and time with it idle; smt_pairs holds how long
+ * each pair of tasks ran on the two siblings of a core at once. The
+ * report is the --top N tasks by SMT run time, then the --top N pairs.
+ */
+/* Must match struct smt_val / struct smt_pair_key / struct smt_pair_val in schedlab.bpf.c */
+struct smt_val {
+    __u64 run_ns;
+    __u64 busy_ns;
+};
+
+struct smt_pair_key {
+    __u32 a, b;
+};
+
+struct smt_pair_val {
+    __u64 ns;
+    __u64 count;
+};
+
+struct smt_row {
+    __u32 a, b;        /* b unused for per-PID rows */
+    __u64 ns, aux;     /* run_ns, busy_ns | corun ns, count */
+};
+
+static int cmp_smt_row(const void *a, const void *b) {
+    const struct smt_row *x = a, *y = b;
+    if (x->ns != y->ns) return (x->ns < y->ns) - (x->ns > y->ns);
+    return (x->aux < y->aux) - (x->aux > y->aux);
+}
+
+/* every entry of an smt_* map as rows, sorted; caller frees */
+static size_t smt_rows(int fd, int pairs, struct smt_row **out) {
+    struct smt_pair_key key, next;
+    union { struct smt_val t; struct smt_pair_val p; } v;
+    size_t ksz = pairs ? sizeof(struct smt_pair_key) : sizeof(__u32), n = 0, cap = 0;
+    struct smt_row *rows = NULL;
+    void *prev = NULL;
+
+    while (bpf_map_get_next_key(fd, prev, &next) == 0) {
+        memcpy(&key, &next, ksz);
+        prev = &key;
+        if (bpf_map_lookup_elem(fd, &key, &v)) continue;
+        if (n == cap) {
+            cap = cap ? 2 * cap : 1024;
+            struct smt_row *nr = realloc(rows, cap * sizeof(*nr));
+            if (!nr) break;
+            rows = nr;
+        }
+        rows[n] = pairs ? (struct smt_row){ key.a, key.b, v.p.ns, v.p.count }
+                        : (struct smt_row){ key.a, 0, v.t.run_ns, v.t.busy_ns };
+        if (rows[n].ns) n++;
+    }
+    if (n) qsort(rows, n, sizeof(*rows), cmp_smt_row);
+    *out = rows;
+    return n;
+}
+
+static void smt_report(int pid_fd, int pair_fd) {
+    struct smt_row *rows;
+    size_t n = smt_rows(pid_fd, 0, &rows);
+    char an[32], bn[32];
+
+    if (g_csv) {
+        if (g_csv_header) fputs("pid,comm,run_ms,sib_busy_ms,sib_idle_ms,sib_busy_pct\n", g_out);
+    } else {
+        fprintf(g_out, "%-8s %-16s %12s %12s %12s %9s\n", "pid", "comm", "run_ms", "sib_busy_ms",
+            "sib_idle_ms", "sib_busy");
+    }
+    for (size_t i = 0; i < n && (int)i < g_top_n; i++) {
+        const struct smt_row *r = &rows[i];
+        __u64 busy = r->aux < r->ns ? r->aux : r->ns;   /* racy reads can overshoot */
+        pid_comm(r->a, an, sizeof(an));
+        if (g_csv)
+            fprintf(g_out, "%u,%s,%.3f,%.3f,%.3f,%.2f\n", r->a, an, r->ns / 1e6, busy / 1e6,
+                (r->ns - busy) / 1e6, 100.0 * busy / r->ns);
+        else
+            fprintf(g_out, "%-8u %-16.16s %12.3f %12.3f %12.3f %8.1f%%\n", r->a, an, r->ns / 1e6,
+                busy / 1e6, (r->ns - busy) / 1e6, 100.0 * busy / r->ns);
+    }
+    free(rows);
+
+    n = smt_rows(pair_fd, 1, &rows);
+    if (g_csv) {
+        if (g_csv_header) fputs("pid_a,comm_a,pid_b,comm_b,corun_ms,overlaps\n", g_out);
+    } else {
+        fprintf(g_out, "\n%-8s %-16s %-8s %-16s %12s %10s\n", "pid_a", "comm", "pid_b", "comm",
+            "corun_ms", "overlaps");
+    }
+    for (size_t i = 0; i < n && (int)i < g_top_n; i++) {
+        const struct smt_row *r = &rows[i];
+        pid_comm(r->a, an, sizeof(an));
+        pid_comm(r->b, bn, sizeof(bn));
+        if (g_csv)
+            fprintf(g_out, "%u,%s,%u,%s,%.3f,%" PRIu64 "\n", r->a, an, r->b, bn, r->ns / 1e6,
+                (uint64_t)r->aux);
+        else
+            fprintf(g_out, "%-8u %-16.16s %-8u %-16.16s %12.3f %10" PRIu64 "\n", r->a, an, r->b, bn,
+                r->ns / 1e6, (uint64_t)r->aux);
+    }
+    fflush(g_out);
+    free(rows);
+}
+
+/* ---- OpenMetrics exporter (MODE_EXPORT) --------------------------------
+ * Every scrape (or --textfile write) reads the kernel aggregates once, so
+ * its cost depends on the number of PIDs and CPUs, never on event rate.
+ * Per-cgroup counters are running sums of per-PID deltas and stay
+ * monotonic when tasks exit or LRU entries are evicted. Latency
+ * histograms reuse the kernel's log2 slots: bucket b is le=2^(b+1) ns,
+ * except the open-ended last slot, which only counts toward +Inf.
+ * HTTP and unix-socket scrapes get OpenMetrics when the Accept header
+ * asks for it, the Prometheus 0.0.4 text format otherwise; the textfile
+ * is always 0.0.4, which is what the node_exporter collector parses.
+ */
+#define EXP_DEFAULT_LISTEN "127.0.0.1:9465"
+
+static struct {
+    const char   *listen;       /* --listen [HOST:]PORT or unix:PATH */
+    const char   *textfile;     /* --textfile FILE */
+    __u64         interval_ns;  /* --textfile-interval */
+    int           fd;           /* listening socket, -1 = none */
+    char          unix_path[108];
+    int           agg_fd, lat_fd, cpu_fd;
+    struct u64map prev;         /* pid -> struct agg_snap */
+    struct u64map cg;           /* cgid -> struct agg_row, totals since attach */
+} g_exp = { .fd = -1, .interval_ns = 10000000000ULL };
+
+static void exp_collect(void) {
+    struct agg_row *rows;
+    size_t n;
+
+    if (!g_exp.cg.keys && u64map_init(&g_exp.cg, sizeof(struct agg_row))) return;
+    n = agg_deltas(&g_exp.prev, g_exp.agg_fd, g_exp.lat_fd, &rows);
+    for (size_t i = 0; i < n; i++) {
+        const struct agg_row *s = &rows[i];
+        struct agg_row *d = u64map_get(&g_exp.cg, s->cgid);
+        if (!d) break;
+        d->run_ns     += s->run_ns;
+        d->wait_ns    += s->wait_ns;
+        d->switches   += s->switches;
+        d->waitlongs  += s->waitlongs;
+        d->lat_count  += s->lat_count;
+        d->lat_sum_ns += s->lat_sum_ns;
+        for (int b = 0; b < LAT_BUCKETS; b++) d->slots[b] += s->slots[b];
+    }
+    free(rows);
+}
+
+static void om_family(FILE *f, int om, const char *name, const char *type, const char *help) {
+    const char *sfx = !om && !strcmp(type, "counter") ? "_total" : "";
+    fprintf(f, "# HELP %s%s %s\n# TYPE %s%s %s\n", name, sfx, help, name, sfx, type);
+}
+
+static void om_label(FILE *f, const char *v) {
+    for (; *v; v++) {
+        if (*v == '\\' || *v == '"') fputc('\\', f);
+        if (*v == '\n') { fputs("\\n", f); continue; }
+        fputc(*v, f);
+    }
+}
+
+static void om_cg_sample(FILE *f, const char *name, const char *cg, const char *extra, double v) {
+    fprintf(f, "%s{cgroup=\"", name);
+    om_label(f, cg);
+    fprintf(f, "\"%s} %.9g\n", extra ? extra : "", v);
+}
+
+static void exp_write(FILE *f, int om) {
+    struct cpu_state *v = calloc(g_ncpus, sizeof(*v));
+    __u32 k = 0;
+    __u64 now = mono_ns();
+
+    exp_collect();
+
+    if (v && !bpf_map_lookup_elem(g_exp.cpu_fd, &k, v)) {
+        /* fold in the slice still running, as util_report does */
+        for (int cpu = 0; cpu < g_ncpus; cpu++)
+            if (v[cpu].since_ns && now > v[cpu].since_ns) {
+                if (v[cpu].curr_pid) v[cpu].busy_ns += now - v[cpu].since_ns;
+                else                 v[cpu].idle_ns += now - v[cpu].since_ns;
+            }
+        om_family(f, om, "schedlab_cpu_busy_seconds", "counter", "Time the CPU ran a task.");
+        for (int cpu = 0; cpu < g_ncpus; cpu++)
+            fprintf(f, "schedlab_cpu_busy_seconds_total{cpu=\"%d\"} %.9g\n", cpu, v[cpu].busy_ns / 1e9);
+        om_family(f, om, "schedlab_cpu_idle_seconds", "counter", "Time the CPU ran the idle task.");
+        for (int cpu = 0; cpu < g_ncpus; cpu++)
+            fprintf(f, "schedlab_cpu_idle_seconds_total{cpu=\"%d\"} %.9g\n", cpu, v[cpu].idle_ns / 1e9);
+        om_family(f, om, "schedlab_cpu_switches", "counter", "Context switches on the CPU.");
+        for (int cpu = 0; cpu < g_ncpus; cpu++)
+            fprintf(f, "schedlab_cpu_switches_total{cpu=\"%d\"} %" PRIu64 "\n", cpu, (uint64_t)v[cpu].switches);
+    }
+    free(v);
+
+    static const struct { const char *name, *help; size_t off; double scale; } ctr[] = {
+        { "schedlab_cgroup_run_seconds", "CPU time of tasks in the cgroup.",
+          offsetof(struct agg_row, run_ns), 1e-9 },
+        { "schedlab_cgroup_runqueue_wait_seconds", "Time tasks in the cgroup spent runnable but not running.",
+          offsetof(struct agg_row, wait_ns), 1e-9 },
+        { "schedlab_cgroup_switches", "Switches into tasks of the cgroup.",
+          offsetof(struct agg_row, switches), 1.0 },
+        { "schedlab_cgroup_long_waits", "Runqueue waits over the --wait-alert-ms/--wait-rule threshold.",
+          offsetof(struct agg_row, waitlongs), 1.0 },
+    };
+    for (size_t c = 0; c < sizeof(ctr) / sizeof(ctr[0]); c++) {
+        char sample[96];
+        snprintf(sample, sizeof(sample), "%s_total", ctr[c].name);
+        om_family(f, om, ctr[c].name, "counter", ctr[c].help);
+        for (size_t i = 0; i < g_exp.cg.cap; i++) {
+            if (!g_exp.cg.keys[i]) continue;
+            const char *row = g_exp.cg.vals + i * g_exp.cg.vsz;
+            __u64 cgid = g_exp.cg.keys[i] - 1;
+            om_cg_sample(f, sample, cgid ? cg_name(cgid) : "unknown", NULL,
+                *(const __u64 *)(row + ctr[c].off) * ctr[c].scale);
+        }
+    }
+
+    om_family(f, om, "schedlab_cgroup_runqueue_latency_seconds", "histogram",
+              "Wakeup-to-run latency of tasks in the cgroup.");
+    for (size_t i = 0; i < g_exp.cg.cap; i++) {
+        if (!g_exp.cg.keys[i]) continue;
+        const struct agg_row *r = (const struct agg_row *)(g_exp.cg.vals + i * g_exp.cg.vsz);
+        __u64 cgid = g_exp.cg.keys[i] - 1;
+        const char *cg = cgid ? cg_name(cgid) : "unknown";
+        char le[48];
+        __u64 cum = 0;
+        for (int b = 0; b < LAT_BUCKETS - 1; b++) {   /* the last slot only has +Inf */
+            cum += r->slots[b];
+            snprintf(le, sizeof(le), ",le=\"%.12g\"", (double)(2ULL << b) / 1e9);
+            om_cg_sample(f, "schedlab_cgroup_runqueue_latency_seconds_bucket", cg, le, (double)cum);
+        }
+        om_cg_sample(f, "schedlab_cgroup_runqueue_latency_seconds_bucket", cg, ",le=\"+Inf\"",
+                     (double)r->lat_count);
+        om_cg_sample(f, "schedlab_cgroup_runqueue_latency_seconds_count", cg, NULL, (double)r->lat_count);
+        om_cg_sample(f, "schedlab_cgroup_runqueue_latency_seconds_sum", cg, NULL, r->lat_sum_ns / 1e9);
+    }
+    if (om) fputs("# EOF\n", f);
+}
+
+/* write FILE.tmp and rename it, so the collector never reads half a file */
+static void exp_textfile(void) {
+    char tmp[PATH_MAX];
+    FILE *f;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", g_exp.textfile);
+    if (!(f = fopen(tmp, "w"))) { perror(tmp); return; }
+    exp_write(f, 0);
+    if (fclose(f) || rename(tmp, g_exp.textfile)) {
+        perror(g_exp.textfile);
+        unlink(tmp);
+    }
+}
+
+/* Remove a socket left behind by an earlier run; anything else at path
+ * is not ours to delete (EEXIST). */
+static int sock_unlink_stale(const char *path) {
+    struct stat st;
+    if (lstat(path, &st)) return errno == ENOENT ? 0 : -1;
+    if (!S_ISSOCK(st.st_mode)) { errno = EEXIST; return -1; }
+    return unlink(path);
+}
+
+static int exp_listen(const char *spec) {
+    int fd = -1;
+
+    if (!strncmp(spec, "unix:", 5)) {
+        struct sockaddr_un sa = { .sun_family = AF_UNIX };
+        if (strlen(spec + 5) >= sizeof(sa.sun_path)) { errno = ENAMETOOLONG; return -1; }
+        strcpy(sa.sun_path, spec + 5);
+        if (sock_unlink_stale(sa.sun_path)) return -1;
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0 || bind(fd, (struct sockaddr *)&sa, sizeof(sa)) || listen(fd, 16)) goto fail;
+        strcpy(g_exp.unix_path, sa.sun_path);
+    } else {
+        char host[256] = "127.0.0.1";
+        const char *port = strrchr(spec, ':');
+        struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM,
+                                  .ai_flags = AI_PASSIVE }, *ai;
+        int one = 1;
+
+        if (port) {
+            snprintf(host, sizeof(host), "%.*s", (int)(port - spec), spec);
+            port++;
+        } else {
+            port = spec;
+        }
+        if (getaddrinfo(host[0] ? host : NULL, port, &hints, &ai)) { errno = EINVAL; return -1; }
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd >= 0) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (fd < 0 || bind(fd, ai->ai_addr, ai->ai_addrlen) || listen(fd, 16)) {
+            freeaddrinfo(ai);
+            goto fail;
+        }
+        freeaddrinfo(ai);
+    }
+    g_exp.fd = fd;
+    return 0;
+fail:
+    if (fd >= 0) close(fd);
+    return -1;
+}
+
+static void exp_send(int c, const char *buf, size_t len) {
+    while (len) {
+        ssize_t w = send(c, buf, len, MSG_NOSIGNAL);
+        if (w <= 0) return;
+        buf += w;
+        len -= (size_t)w;
+    }
+}
+
+static void exp_serve(int c) {
+    struct timeval tv = { .tv_sec = 1 };
+    char req[4096], *body = NULL, hdr[256];
+    size_t got = 0, blen = 0;
+    int om, code = 200;
+
+    setsockopt(c, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(c, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    while (got < sizeof(req) - 1) {
+        ssize_t r = recv(c, req + got, sizeof(req) - 1 - got, 0);
+        if (r <= 0) break;
+        got += (size_t)r;
+        req[got] = '\0';
+        if (strstr(req, "\r\n\r\n")) break;
+    }
+    req[got] = '\0';
+    if (strncmp(req, "GET /metrics", 12) && strncmp(req, "GET / ", 6)) code = 404;
+    om = strstr(req, "application/openmetrics-text") != NULL;
+
+    FILE *f = open_memstream(&body, &blen);
+    if (!f) return;
+    if (code == 200) exp_write(f, om);
+    else             fputs("not found; try /metrics\n", f);
+    fclose(f);
+
+    int hl = snprintf(hdr, sizeof(hdr),
+        "HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+        code == 200 ? "200 OK" : "404 Not Found",
+        code != 200 ? "text/plain" :
+        om ? "application/openmetrics-text; version=1.0.0; charset=utf-8"
+           : "text/plain; version=0.0.4; charset=utf-8", blen);
+    exp_send(c, hdr, (size_t)hl);
+    exp_send(c, body, blen);
+    free(body);
+}
+
+/* Wait up to timeout_ms for scrapers and answer them one at a time. */
+static void exp_poll(int timeout_ms) {
+    struct pollfd pfd = { .fd = g_exp.fd, .events = POLLIN };
+    int c;
+
+    if (g_exp.fd < 0 || poll(&pfd, 1, timeout_ms) <= 0) return;
+    while ((c = accept(g_exp.fd, NULL, NULL)) >= 0) {
+        exp_serve(c);
+        close(c);
+    }
+}
+
+static int exp_init(struct schedlab_bpf *skel) {
+    g_exp.agg_fd = bpf_map__fd(skel->maps.agg_by_pid);
+    g_exp.lat_fd = bpf_map__fd(skel->maps.lat_by_pid);
+    g_exp.cpu_fd = bpf_map__fd(skel->maps.cpu_state);
+    if (!g_exp.listen && !g_exp.textfile) g_exp.listen = EXP_DEFAULT_LISTEN;
+    if (g_exp.listen && exp_listen(g_exp.listen)) {
+        fprintf(stderr, "--listen %s: %s\n", g_exp.listen, strerror(errno));
+        return -1;
+    }
+    if (g_exp.listen)
+        fprintf(stderr, "serving metrics on %s\n", g_exp.listen);
+    return 0;
+}
+
+static void exp_free(void) {
+    if (g_exp.fd >= 0) close(g_exp.fd);
+    if (g_exp.unix_path[0]) unlink(g_exp.unix_path);
+    u64map_free(&g_exp.prev);
+    u64map_free(&g_exp.cg);
+}
+
+/* ---- Aggregate snapshot / reset (SIGUSR1, SIGUSR2, ctl) -----------------
+ * agg_by_pid is read with batched lookups, up to AGG_BATCH entries per
+ * syscall. A reset uses lookup-and-delete batches, so every switch
+ * booked while the reset runs lands either in the snapshot or in a fresh
+ * entry, never in neither. Deleted entries are put back with zeroed
+ * counters (BPF_NOEXIST, so a fresh entry wins) to keep start_ns/origin/
+ * ppid/cgid for shortlong. Kernels without batch ops fall back to
+ * get_next_key walks, and a reset then zeroes entries in place.
+ */
+#define AGG_BATCH 1024
+
+static struct schedlab_bpf *g_skel;
+static volatile sig_atomic_t g_dump_req;   /* 1 = SIGUSR1 dump, 2 = SIGUSR2 dump + reset */
+static const char *g_dump_dir = ".";
+static unsigned    g_dump_seq;
+
+static void on_usr(int sig) { g_dump_req = sig == SIGUSR2 ? 2 : g_dump_req ? g_dump_req : 1; }
+
+static size_t agg_walk(int fd, int zero, __u32 **keys, struct agg **vals) {
+    size_t n = 0, cap = 0;
+    __u32 key, next;
+    void *prev = NULL;
+    struct agg a;
+
+    while (bpf_map_get_next_key(fd, prev, &next) == 0) {
+        key = next;
+        prev = &key;
+        if (bpf_map_lookup_elem(fd, &key, &a)) continue;
+        if (n == cap) {
+            cap = cap ? 2 * cap : AGG_BATCH;
+            __u32 *nk = realloc(*keys, cap * sizeof(*nk));
+            struct agg *nv = nk ? realloc(*vals, cap * sizeof(*nv)) : NULL;
+            if (nk) *keys = nk;
+            if (!nv) break;
+            *vals = nv;
+        }
+        (*keys)[n] = key;
+        (*vals)[n++] = a;
+        if (zero) {
+            a.total_run_ns = a.total_wait_ns = a.switches = a.wakes = a.waitlongs = a.off_home_ns = 0;
+            bpf_map_update_elem(fd, &key, &a, BPF_EXIST);
+        }
+    }
+    return n;
+}
+
+/* Every agg_by_pid entry into keys/vals (caller frees); with del the
+ * map is drained and reseeded as described above. */
+static size_t agg_read(int fd, int del, __u32 **keys, struct agg **vals) {
+    LIBBPF_OPTS(bpf_map_batch_opts, opts);
+    size_t n = 0, cap = 0;
+    __u32 in, out;
+    void *inp = NULL;
+    int err;
+
+    *keys = NULL;
+    *vals = NULL;
+    for (;;) {
+        if (cap - n < AGG_BATCH) {
+            cap += 4 * AGG_BATCH;
+            __u32 *nk = realloc(*keys, cap * sizeof(*nk));
+            struct agg *nv = nk ? realloc(*vals, cap * sizeof(*nv)) : NULL;
+            if (nk) *keys = nk;
+            if (!nv) return n;
+            *vals = nv;
+        }
+        __u32 cnt = AGG_BATCH;
+        err = del ? bpf_map_lookup_and_delete_batch(fd, inp, &out, *keys + n, *vals + n, &cnt, &opts)
+                  : bpf_map_lookup_batch(fd, inp, &out, *keys + n, *vals + n, &cnt, &opts);
+        if (err) err = -errno;
+        if (err && err != -ENOENT) break;
+        n += cnt;
+        if (err == -ENOENT) break;
+        in = out;
+        inp = &in;
+    }
+    /* after a partial batch read a walk would count entries twice */
+    if (err && err != -ENOENT && !n)
+        return agg_walk(fd, del, keys, vals);
+    if (del) {
+        for (size_t i = 0; i < n; i++) {
+            struct agg a = (*vals)[i];
+            a.total_run_ns = a.total_wait_ns = a.switches = a.wakes = a.waitlongs = a.off_home_ns = 0;
+            bpf_map_update_elem(fd, &(*keys)[i], &a, BPF_NOEXIST);
+        }
+    }
+    return n;
+}
+
+static void agg_write(FILE *f, const __u32 *keys, const struct agg *vals, size_t n) {
+    char comm[32];
+    for (size_t i = 0; i < n; i++) {
+        pid_comm(keys[i], comm, sizeof(comm));
+        fprintf(f, "kernel,%u,%s,%.3f,%.3f,%" PRIu64 ",%" PRIu64 ",%" PRIu64 "\n", keys[i], comm,
+            vals[i].total_run_ns / 1e6, vals[i].total_wait_ns / 1e6, (uint64_t)vals[i].switches,
+            (uint64_t)vals[i].wakes, (uint64_t)vals[i].waitlongs);
+    }
+}
+
+/* Maps besides agg_by_pid that a reset starts over. cpu_state is left
+ * alone: its counters are monotonic for util and export. */
+static void map_clear(int fd, size_t key_sz) {
+    char key[64];
+    if (key_sz > sizeof(key)) return;
+    while (bpf_map_get_next_key(fd, NULL, key) == 0)
+        if (bpf_map_delete_elem(fd, key)) break;
+}
+
+static void map_zero(int fd, __u32 n, size_t val_sz) {
+    void *z = calloc(1, val_sz);
+    if (!z) return;
+    for (__u32 i = 0; i < n; i++) bpf_map_update_elem(fd, &i, z, BPF_ANY);
+    free(z);
+}
+
+static void aggs_reset_rest(void) {
+    map_clear(bpf_map__fd(g_skel->maps.lat_by_pid), sizeof(__u32));
+    map_clear(bpf_map__fd(g_skel->maps.lat_by_comm), sizeof(struct comm_key));
+    map_zero(bpf_map__fd(g_skel->maps.class_stats), CLASS_POLICIES * CLASS_PRIOS,
+             sizeof(struct class_stats));
+    map_zero(bpf_map__fd(g_skel->maps.life_hist), 2, sizeof(struct life_hist));
+    map_zero(bpf_map__fd(g_skel->maps.req_hist), REQ_HISTS, sizeof(struct lat_hist));
+    map_clear(bpf_map__fd(g_skel->maps.offcpu_stacks), sizeof(struct offcpu_key));
+    map_clear(bpf_map__fd(g_skel->maps.interference), sizeof(struct interf_key));
+    map_zero(bpf_map__fd(g_skel->maps.wake_hist), WAKE_CLASSES, sizeof(struct lat_hist));
+    map_clear(bpf_map__fd(g_skel->maps.wake_pairs), sizeof(struct wake_pair_key));
+    map_zero(bpf_map__fd(g_skel->maps.cpu_dom), g_ncpus < MAX_CPUS ? g_ncpus : MAX_CPUS,
+             sizeof(struct cpu_dom));
+    map_clear(bpf_map__fd(g_skel->maps.smt_by_pid), sizeof(__u32));
+    map_clear(bpf_map__fd(g_skel->maps.smt_pairs), sizeof(struct smt_pair_key));
+    memset(agg_tbl, 0, sizeof(agg_tbl));
+}
+
+/* kernel rows, then the user-side totals built from streamed events */
+static void aggs_write(FILE *f, int reset) {
+    __u32 *keys;
+    struct agg *vals;
+    size_t n = agg_read(bpf_map__fd(g_skel->maps.agg_by_pid), reset, &keys, &vals);
+
+    fputs("source,pid,comm,run_ms,wait_ms,switches,wakes,waitlongs\n", f);
+    agg_write(f, keys, vals, n);
+    for (__u32 i = 0; i < HSIZE; i++) {
+        const struct agg_user *u = &agg_tbl[i];
+        if (!u->switches && !u->wakes) continue;
+        fprintf(f, "user,%u,,%.3f,%.3f,%" PRIu64 ",%" PRIu64 ",\n", u->pid,
+            u->total_run_ns / 1e6, u->total_wait_ns / 1e6, (uint64_t)u->switches,
+            (uint64_t)u->wakes);
+    }
+    if (reset) aggs_reset_rest();
+    free(keys);
+    free(vals);
+}
+
+static void aggs_reset(void) {
+    __u32 *keys;
+    struct agg *vals;
+
+    agg_read(bpf_map__fd(g_skel->maps.agg_by_pid), 1, &keys, &vals);
+    aggs_reset_rest();
+    free(keys);
+    free(vals);
+}
+
+static void aggs_dump(int reset, const char *phase) {
+    char name[PATH_MAX], tmp[PATH_MAX + 8], ts[32];
+    time_t t = time(NULL);
+    FILE *f;
+
+    strftime(ts, sizeof(ts), "%Y%m%d-%H%M%S", localtime(&t));
+    snprintf(name, sizeof(name), "%s/schedlab-%s-%u%s%s%s.csv", g_dump_dir, ts, ++g_dump_seq,
+             phase ? "-phase-" : "", phase ? phase : "", reset && !phase ? "-reset" : "");
+    snprintf(tmp, sizeof(tmp), "%s.part", name);
+    if (!(f = fopen(tmp, "w"))) { perror(tmp); return; }
+    aggs_write(f, reset);
+    if (fclose(f) || rename(tmp, name)) { perror(name); unlink(tmp); return; }
+    fprintf(stderr, "schedlab: %s %s\n", reset ? "snapshot+reset" : "snapshot", name);
+}
+
+/* ---- Topology domains (MODE_TOPO) --------------------------------------
+ * cpu_state (busy/idle/switches, as in util) and cpu_dom (wait latency,
+ * migrations in) summed per SMT core, LLC and NUMA node of cpu_topo; the
+ * core level is left out when there is no SMT. Then, per PID, how much of
+ * its run time was spent outside its home node (agg.home_node). Printed
+ * at exit and at each phase marker, covering the time since the last one.
+ */
+enum { TOPO_CORE = 0, TOPO_LLC, TOPO_NODE, TOPO_LEVELS };
+static const char *topo_level_names[TOPO_LEVELS] = { "core", "llc", "node" };
+
+static __u32 topo_id(int cpu, int level) {
+    const struct cpu_topo *t = &g_topo[cpu];
+    return level == TOPO_CORE ? t->core : level == TOPO_LLC ? t->llc : t->node;
+}
+
+static void topo_dom_report(int state_fd, int dom_fd) {
+    struct util_prev *d = calloc(g_ncpus, sizeof(*d));
+    struct cpu_dom *cd = calloc(g_ncpus, sizeof(*cd));
+    int smt = 0;
+
+    if (!d || !cd || util_deltas(state_fd, d)) goto out;
+    for (__u32 cpu = 0; cpu < (__u32)g_ncpus; cpu++) {
+        if (cpu >= MAX_CPUS || bpf_map_lookup_elem(dom_fd, &cpu, &cd[cpu]))
+            memset(&cd[cpu], 0, sizeof(cd[cpu]));
+        if (g_topo[cpu].valid && g_topo[cpu].core != cpu) smt = 1;
+    }
+
+    if (g_csv) {
+        if (g_csv_header)
+            fputs("level,id,cpus,util_pct,switches_per_s,wakeups,wait_p50_us,wait_p99_us,"
+                  "migrations_in,mig_xllc,mig_xnode\n", g_out);
+    } else {
+        fprintf(g_out, "%-5s %5s %5s %7s %12s %10s %10s %10s %10s %9s %9s\n", "level", "id", "cpus",
+            "util", "switches/s", "wakeups", "p50_us", "p99_us", "mig_in", "mig_xllc", "mig_xnode");
+    }
+    for (int level = 0; level < TOPO_LEVELS; level++) {
+        if (level == TOPO_CORE && !smt) continue;
+        for (int cpu = 0; cpu < g_ncpus; cpu++) {
+            if (!g_topo[cpu].valid) continue;
+            __u32 id = topo_id(cpu, level);
+            int seen = 0, n = 0;
+            for (int j = 0; j < cpu && !seen; j++) seen = g_topo[j].valid && topo_id(j, level) == id;
+            if (seen) continue;
+
+            struct lat_hist w = {0};
+            __u64 busy = 0, idle = 0, sw = 0, mi = 0, ml = 0, mn = 0;
+            for (int j = cpu; j < g_ncpus; j++) {
+                if (!g_topo[j].valid || topo_id(j, level) != id) continue;
+                const struct lat_hist *h = &cd[j].wait;
+                n++;
+                busy += d[j].busy_ns; idle += d[j].idle_ns; sw += d[j].switches;
+                mi += cd[j].mig_in; ml += cd[j].mig_xllc; mn += cd[j].mig_xnode;
+                w.count += h->count; w.sum_ns += h->sum_ns;
+                if (h->max_ns > w.max_ns) w.max_ns = h->max_ns;
+                for (int b = 0; b < LAT_BUCKETS; b++) w.slots[b] += h->slots[b];
+            }
+            double util = busy + idle ? 100.0 * busy / (double)(busy + idle) : 0;
+            double secs = (busy + idle) / 1e9 / n;   /* wall time, the same on every CPU */
+            double swps = secs > 0 ? sw / secs : 0;
+            double p50 = hist_pct_ns(w.slots, w.count, 0.50, w.max_ns) / 1e3;
+            double p99 = hist_pct_ns(w.slots, w.count, 0.99, w.max_ns) / 1e3;
+            if (g_csv)
+                fprintf(g_out, "%s,%u,%d,%.2f,%.1f,%" PRIu64 ",%.3f,%.3f,%" PRIu64 ",%" PRIu64 ",%" PRIu64 "\n",
+                    topo_level_names[level], id, n, util, swps, (uint64_t)w.count, p50, p99,
+                    (uint64_t)mi, (uint64_t)ml, (uint64_t)mn);
+            else
+                fprintf(g_out, "%-5s %5u %5d %6.1f%% %12.1f %10" PRIu64 " %10.1f %10.1f %10" PRIu64 " %9" PRIu64 " %9" PRIu64 "\n",
+                    topo_level_names[level], id, n, util, swps, (uint64_t)w.count, p50, p99,
+                    (uint64_t)mi, (uint64_t)ml, (uint64_t)mn);
+        }
+    }
+out:
+    free(d);
+    free(cd);
+}
+
+struct home_row {
+    __u32 pid;
+    __u32 home;      /* node + 1 */
+    __u64 run_ns;
+    __u64 off_ns;
+};
+
+static int cmp_home_row(const void *a, const void *b) {
+    const struct home_row *x = a, *y = b;
+    if (x->off_ns != y->off_ns) return (x->off_ns < y->off_ns) - (x->off_ns > y->off_ns);
+    return (x->run_ns < y->run_ns) - (x->run_ns > y->run_ns);
+}
+
+static void topo_home_report(int agg_fd) {
+    __u32 *keys;
+    struct agg *vals;
+    size_t n = agg_read(agg_fd, 0, &keys, &vals), m = 0;
+    struct home_row *rows = n ? malloc(n * sizeof(*rows)) : NULL;
+    char comm[32];
+
+    for (size_t i = 0; rows && i < n; i++) {
+        if (!vals[i].total_run_ns || !vals[i].home_node) continue;
+        rows[m++] = (struct home_row){ keys[i], vals[i].home_node, vals[i].total_run_ns,
+                                       vals[i].off_home_ns };
+    }
+    if (m) qsort(rows, m, sizeof(*rows), cmp_home_row);
+
+    if (g_csv) {
+        if (g_csv_header) fputs("pid,comm,run_ms,home_node,off_home_ms,off_home_pct\n", g_out);
+    } else {
+        fprintf(g_out, "\n%-8s %-16s %12s %5s %12s %9s\n", "pid", "comm", "run_ms", "home",
+            "off_home_ms", "off_home");
+    }
+    for (size_t i = 0; i < m && (int)i < g_top_n; i++) {
+        const struct home_row *r = &rows[i];
+        double pct = 100.0 * r->off_ns / r->run_ns;
+        pid_comm(r->pid, comm, sizeof(comm));
+        if (g_csv)
+            fprintf(g_out, "%u,%s,%.3f,%u,%.3f,%.2f\n", r->pid, comm, r->run_ns / 1e6,
+                r->home - 1, r->off_ns / 1e6, pct);
+        else
+            fprintf(g_out, "%-8u %-16.16s %12.3f %5u %12.3f %8.1f%%\n", r->pid, comm,
+                r->run_ns / 1e6, r->home - 1, r->off_ns / 1e6, pct);
+    }
+    fflush(g_out);
+    free(rows);
+    free(keys);
+    free(vals);
+}
+
+/* ---- Phase markers (--mark-lib, --mark-fifo) --------------------------
+ * A marker ends the current phase and starts a named one. Markers come
+ * from the on_mark uprobe on schedlab_mark() in libschedmark.so (see
+ * schedmark.h) or from lines written to a FIFO, and go through the same
+ * ring/reorder path as scheduler events, so they sit in the timeline at
+ * the point they happened. At each marker the mode's exit report is
+ * printed for the phase that ended, every aggregate is dumped to
+ * DIR/schedlab-...-phase-NAME.csv and reset, and --output/--capture
+ * start a new segment named after the new phase.
+ */
+static struct {
+    const char *lib;                 /* --mark-lib */
+    const char *fifo;                /* --mark-fifo */
+    int         fd, wfd;             /* wfd keeps the FIFO open between writers */
+    char        buf[256];
+    size_t      len;
+    char        name[MARK_NAME_LEN];  /* current phase */
+} g_mark = { .fd = -1, .wfd = -1, .name = "start" };
+
+static void mode_reports(void) {
+    if (g_mode == MODE_LATENCY && g_lat_by)
+        lat_top_report(bpf_map__fd(g_lat_by == LAT_BY_PID ? g_skel->maps.lat_by_pid
+                                                          : g_skel->maps.lat_by_comm));
+    if (g_mode == MODE_SHORTLONG)
+        life_report(bpf_map__fd(g_skel->maps.life_hist));
+    if (g_mode == MODE_CLASSES) {
+        class_report(bpf_map__fd(g_skel->maps.class_stats));
+        wfair_report(bpf_map__fd(g_skel->maps.agg_by_pid));
+    }
+    if (g_req.begin)
+        req_report(bpf_map__fd(g_skel->maps.req_hist));
+    if (g_mode == MODE_OFFCPU)
+        offcpu_report(bpf_map__fd(g_skel->maps.offcpu_stacks), bpf_map__fd(g_skel->maps.offcpu_traces));
+    if (g_mode == MODE_INTERF)
+        interf_report(bpf_map__fd(g_skel->maps.interference));
+    if (g_mode == MODE_WAKES) {
+        wake_class_report(bpf_map__fd(g_skel->maps.wake_hist));
+        wake_pair_report(bpf_map__fd(g_skel->maps.wake_pairs));
+    }
+    if (g_mode == MODE_TOPO) {
+        topo_dom_report(bpf_map__fd(g_skel->maps.cpu_state), bpf_map__fd(g_skel->maps.cpu_dom));
+        topo_home_report(bpf_map__fd(g_skel->maps.agg_by_pid));
+    }
+    if (g_mode == MODE_SMT)
+        smt_report(bpf_map__fd(g_skel->maps.smt_by_pid), bpf_map__fd(g_skel->maps.smt_pairs));
+}
+
+/* phase names end up in file names */
+static void mark_name(char *dst, const char *src) {
+    size_t n = 0;
+    for (; src[n] && n < MARK_NAME_LEN - 1; n++) {
+        char c = src[n];
+        dst[n] = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+                 c == '_' || c == '.' || c == '-' ? c : '_';
+    }
+    if (!n) dst[n++] = '_';
+    dst[n] = '\0';
+}
+
+static void phase_mark(const struct event *e) {
+    char name[MARK_NAME_LEN];
+
+    memcpy(name, e->u.mark.name, sizeof(name));
+    name[sizeof(name) - 1] = '\0';
+    mode_reports();
+    aggs_dump(1, g_mark.name);
+    mark_name(g_mark.name, name);
+    g_phase_seq++;
+    if (g_rot.by_phase) rot_open();
+}
+
+static int mark_fifo_open(void) {
+    if (mkfifo(g_mark.fifo, 0600) && errno != EEXIST) return -1;
+    g_mark.fd = open(g_mark.fifo, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (g_mark.fd < 0) return -1;
+    g_mark.wfd = open(g_mark.fifo, O_WRONLY | O_CLOEXEC);
+    return g_mark.wfd < 0 ? -1 : 0;
+}
+
+/* one marker per line; comm "fifo", pid 0 */
+static void mark_fifo_poll(void) {
+    ssize_t n;
+
+    while ((n = read(g_mark.fd, g_mark.buf + g_mark.len, sizeof(g_mark.buf) - 1 - g_mark.len)) > 0) {
+        char *line = g_mark.buf, *nl;
+        g_mark.len += (size_t)n;
+        g_mark.buf[g_mark.len] = '\0';
+        while ((nl = strchr(line, '\n'))) {
+            *nl = '\0';
+            if (nl > line && nl[-1] == '\r') nl[-1] = '\0';
+            if (*line) {
+                struct event e = { .ts_ns = mono_ns(), .type = EV_MARK, .comm = "fifo" };
+                snprintf(e.u.mark.name, sizeof(e.u.mark.name), "%s", line);
+                handle_event(NULL, &e, sizeof(e));
+            }
+            line = nl + 1;
+        }
+        g_mark.len -= (size_t)(line - g_mark.buf);
+        memmove(g_mark.buf, line, g_mark.len);
+        if (g_mark.len == sizeof(g_mark.buf) - 1) g_mark.len = 0;   /* overlong line */
+    }
+}
+
+static void mark_free(void) {
+    if (g_mark.fd >= 0)  close(g_mark.fd);
+    if (g_mark.wfd >= 0) close(g_mark.wfd);
+}
+
+/* ---- Control socket (--ctl PATH, schedlab ctl) -------------------------
+ * One text command per connection; the reply ends with "ok" or
+ * "error: ...". Commands only update cfg_map and wait_rules in place,
+ * so the programs stay attached and every aggregate keeps counting.
+ *   get                         current filter, threshold and rules
+ *   set filter-pid N            0 = off
+ *   set threshold MS            --wait-alert-ms; 0 = no global alert
+ *   set rule KIND:TARGET=MS     add a --wait-rule, or retune one
+ *   snapshot                    aggregates as CSV, as SIGUSR1 writes them
+ *   reset                       start per-PID, per-key and per-class aggregates over
+ */
+#define CTL_DEFAULT_PATH "/run/schedlab.sock"
+
+static struct {
+    const char          *path;   /* --ctl */
+    int                  fd;
+} g_ctl = { .fd = -1 };
+
+static void ctl_get(FILE *f) {
+    fprintf(f, "filter-pid %u\n", g_cfg.sample_filter_pid);
+    fprintf(f, "threshold-ms %.3f%s\n", g_cfg.wait_alert_ns / 1e6,
+            g_cfg.flags & CFG_F_NO_GLOBAL ? " (no global alert)" : "");
+    for (int i = 0; i < g_nrules; i++)
+        fprintf(f, "rule %d %s\n", i + 1, g_rules[i].spec);
+}
+
+static int ctl_set_rule(const char *spec, FILE *f) {
+    if (parse_wait_rule(spec)) return -1;
+    struct rule_ent *r = &g_rules[g_nrules - 1];
+    /* same kind and target: retune the existing rule and keep its id */
+    for (int i = 0; i < g_nrules - 1; i++)
+        if (g_rules[i].key.kind == r->key.kind && g_rules[i].key.id == r->key.id) {
+            g_rules[i].val.threshold_ns = r->val.threshold_ns;
+            memcpy(g_rules[i].spec, r->spec, sizeof(r->spec));
+            r = &g_rules[i];
+            g_nrules--;
+            break;
+        }
+    if (bpf_map_update_elem(bpf_map__fd(g_skel->maps.wait_rules), &r->key, &r->val, BPF_ANY))
+        return -1;
+    g_cfg.rule_kinds = rules_kind_mask();
+    fprintf(f, "rule %u %s\n", r->val.rule_id, r->spec);
+    return cfg_push();
+}
+
+static int ctl_exec(char *line, FILE *f) {
+    char *argv[4], *save = NULL, *end;
+    int argc = 0;
+
+    for (char *t = strtok_r(line, " \t\r\n", &save); t && argc < 4; t = strtok_r(NULL, " \t\r\n", &save))
+        argv[argc++] = t;
+    if (!argc) return -1;
+
+    if (!strcmp(argv[0], "get") && argc == 1) {
+        ctl_get(f);
+        return 0;
+    }
+    if (!strcmp(argv[0], "snapshot") && argc == 1) {
+        aggs_write(f, 0);
+        return 0;
+    }
+    if (!strcmp(argv[0], "reset") && argc == 1) {
+        aggs_reset();
+        return 0;
+    }
+    if (strcmp(argv[0], "set") || argc != 3) return -1;
+    if (!strcmp(argv[1], "filter-pid")) {
+        unsigned long pid = strtoul(argv[2], &end, 10);
+        if (*end) return -1;
+        g_filter_pid = g_cfg.sample_filter_pid = (__u32)pid;
+        return cfg_push();
+    }
+    if (!strcmp(argv[1], "threshold")) {
+        double ms = strtod(argv[2], &end);
+        if (*end || ms < 0) return -1;
+        g_wait_alert_ns = g_cfg.wait_alert_ns = (__u64)(ms * 1e6);
+        return cfg_push();
+    }
+    if (!strcmp(argv[1], "rule"))
+        return ctl_set_rule(argv[2], f);
+    return -1;
+}
+
+static int ctl_listen(void) {
+    struct sockaddr_un sa = { .sun_family = AF_UNIX };
+    int fd;
+
+    if (strlen(g_ctl.path) >= sizeof(sa.sun_path)) { errno = ENAMETOOLONG; return -1; }
+    strcpy(sa.sun_path, g_ctl.path);
+    if (sock_unlink_stale(sa.sun_path)) return -1;
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) || chmod(sa.sun_path, 0600) || listen(fd, 4)) {
+        close(fd);
+        return -1;
+    }
+    g_ctl.fd = fd;
+    return 0;
+}
+
+static void ctl_poll(void) {
+    struct timeval tv = { .tv_sec = 1 };
+    char line[512], cmd[512], *reply = NULL;
+    size_t len = 0;
+    int c;
+
+    while ((c = accept(g_ctl.fd, NULL, NULL)) >= 0) {
+        size_t got = 0;
+        setsockopt(c, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        while (got < sizeof(line) - 1) {
+            ssize_t r = recv(c, line + got, sizeof(line) - 1 - got, 0);
+            if (r <= 0) break;
+            got += (size_t)r;
+            if (memchr(line, '\n', got)) break;
+        }
+        line[got] = '\0';
+        snprintf(cmd, sizeof(cmd), "%s", line);
+        cmd[strcspn(cmd, "\r\n")] = '\0';
+
+        FILE *f = open_memstream(&reply, &len);
+        if (f) {
+            if (ctl_exec(line, f)) fprintf(f, "error: %s\n", cmd);
+            else                   fputs("ok\n", f);
+            fclose(f);
+            exp_send(c, reply, len);   /* MSG_NOSIGNAL: a client that left is not fatal */
+            free(reply);
+            reply = NULL;
+        }
+        close(c);
+    }
+}
+
+static void ctl_free(void) {
+    if (g_ctl.fd < 0) return;
+    close(g_ctl.fd);
+    unlink(g_ctl.path);
+}
+
+/* schedlab ctl [--socket PATH] COMMAND... */
+static int ctl_main(int argc, char **argv) {
+    struct sockaddr_un sa = { .sun_family = AF_UNIX };
+    const char *path = CTL_DEFAULT_PATH;
+    char cmd[512] = "", buf[4096];
+    size_t len = 0;
+    int i = 1, fd, ok = 0;
+
+    if (argc > 2 && !strcmp(argv[1], "--socket")) {
+        path = argv[2];
+        i = 3;
+    }
+    for (; i < argc && len < sizeof(cmd); i++)
+        len += snprintf(cmd + len, sizeof(cmd) - len, "%s%s", len ? " " : "", argv[i]);
+    if (!len || len >= sizeof(cmd) - 1 || strlen(path) >= sizeof(sa.sun_path)) {
+        fprintf(stderr, "Usage: %s [--socket PATH] get|snapshot|reset|set filter-pid N|"
+                        "set threshold MS|set rule KIND:TARGET=MS\n", argv[0]);
+        return 1;
+    }
+    strcat(cmd, "\n");
+    strcpy(sa.sun_path, path);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&sa, sizeof(sa))) {
+        perror(path);
+        return 1;
+    }
+    if (write(fd, cmd, strlen(cmd)) < 0) { perror(path); close(fd); return 1; }
+
+    FILE *f = fdopen(fd, "r");
+    if (!f) { close(fd); return 1; }
+    while (fgets(buf, sizeof(buf), f)) {
+        ok = !strcmp(buf, "ok\n");
+        if (!ok) fputs(buf, strncmp(buf, "error:", 6) ? stdout : stderr);
+    }
+    fclose(f);
+    return ok ? 0 : 1;
+}
+
+/* ---- Periodic (non-streaming) reports --------------------------------- */
+static __u64 g_tick_ns;  /* 0 = mode has no periodic report */
+
+static int periodic_init(struct schedlab_bpf *skel) {
+    switch (g_mode) {
+    case MODE_UTIL:
+    case MODE_TOPO:
+        g_util_prev = calloc(g_ncpus, sizeof(*g_util_prev));
+        if (!g_util_prev) return -1;
+        util_report(bpf_map__fd(skel->maps.cpu_state), 1);  /* baseline */
+        if (g_mode == MODE_UTIL) g_tick_ns = 1000000000ULL;
+        break;
+    case MODE_CPUSERIES:
+        /* read at least 4x per ring lap so buckets are never overwritten unread */
+        g_tick_ns = CPU_BUCKETS * g_bucket_ns / 4;
+        if (g_tick_ns > 1000000000ULL) g_tick_ns = 1000000000ULL;
+        break;
+    case MODE_HEATMAP:
+        g_tick_ns = g_heat_ns;
+        break;
+    case MODE_TOP:
+        top_init();
+        top_refresh(bpf_map__fd(skel->maps.agg_by_pid),
+                    bpf_map__fd(skel->maps.lat_by_pid));      /* baseline */
+        g_tick_ns = 1000000000ULL;
+        break;
+    case MODE_EXPORT:
+        if (exp_init(skel)) return -1;
+        if (g_exp.textfile) {
+            exp_textfile();
+            g_tick_ns = g_exp.interval_ns;
+        }
+        break;
+    default:
+        break;
+    }
+    return 0;
+}
+
+static void periodic_tick(struct schedlab_bpf *skel) {
+    switch (g_mode) {
+    case MODE_UTIL:
+        util_report(bpf_map__fd(skel->maps.cpu_state), 0);
+        break;
+    case MODE_CPUSERIES:
+        series_report(bpf_map__fd(skel->maps.cpu_buckets),
+                      bpf_map__fd(skel->maps.cpu_state));
+        break;
+    case MODE_HEATMAP:
+        heat_rotate(bpf_map__fd(skel->maps.heat));
+        break;
+    case MODE_TOP:
+        top_refresh(bpf_map__fd(skel->maps.agg_by_pid),
+                    bpf_map__fd(skel->maps.lat_by_pid));
+        break;
+    case MODE_EXPORT:
+        exp_textfile();
+        break;
+    default:
+        break;
+    }
+}
+
+/* ---- CLI & main ------------------------------------------------------- */
+static void usage(const char *p) {
+    fprintf(stderr, "Usage: sudo %s [--mode ", p);
+    for (int i = 0; i < N_MODES; i++)
+        fprintf(stderr, "%s%s", i ? "|" : "", mode_names[i]);
+    fprintf(stderr, "]\n"
+        "              [--filter-pid N] [--wait-alert-ms M] [--reorder-ms D] [--bucket-ms B]\n"
+        "              [--heat-ms H] [--heat-metrics wait,run,offcpu] [--svg FILE]\n"
+        "              [--capture FILE] [--capture-enc raw|delta|zstd]\n"
+        "              [--output FILE] [--rotate-size 256M] [--rotate-interval 10m] [--keep N]\n"
+        "              [--duration 20s] [--ctl SOCKET] [--dump-dir DIR]\n"
+        "              [--mark-lib libschedmark.so] [--mark-fifo FIFO]\n"
+        "              [--uprobe-begin BIN:SYM --uprobe-end BIN:SYM] [--stacks DIR] [--stacks-max N]\n"
+        "              [--by pid|comm|cgroup] [--top N] [--sort pid|cpu|wait|sw|p99|starv] [--short-ms S]\n"
+        "              [--wait-rule pid:N=MS|cgroup:PATH=MS|policy:NAME=MS|nice:N=MS]... [--no-global-alert]\n"
+        "              [--csv] [--csv-header]\n"
+        "       %s top [--by pid|cgroup] [--sort COL] [--top N] [options]\n"
+        "       %s export [--listen [HOST:]PORT|unix:PATH] [--textfile FILE] [--textfile-interval D] [options]\n"
+        "       %s analyze [--threads N] [--top N] [--short-ms S] FILE.csv...\n"
+        "       %s diff [--threads N] [--top N] [--short-ms S] [--resamples R] [--alpha A] [--seed S]\n"
+        "              [--by-rank] A.csv B.csv\n"
+        "       %s query [--pid N] [--from T] [--to T] [--count] FILE.cap\n"
+        "       %s ctl [--socket PATH] get|snapshot|reset|set filter-pid N|set threshold MS|set rule SPEC\n",
+        p, p, p, p, p, p);
+}
+
+int main(int argc, char **argv)
+{
+    g_out = stdout;
+    if (argc >= 2 && !strcmp(argv[1], "analyze"))
+        return analyze_main(argc - 1, argv + 1);
+    if (argc >= 2 && !strcmp(argv[1], "diff"))
+        return diff_main(argc - 1, argv + 1);
+    if (argc >= 2 && !strcmp(argv[1], "query"))
+        return query_main(argc - 1, argv + 1);
+    if (argc >= 2 && !strcmp(argv[1], "ctl"))
+        return ctl_main(argc - 1, argv + 1);
+
+    int argi = 1;
+    if (argc >= 2 && !strcmp(argv[1], "top")) {
+        g_mode = MODE_TOP;
+        argi = 2;
+    }
+    if (argc >= 2 && !strcmp(argv[1], "export")) {
+        g_mode = MODE_EXPORT;
+        argi = 2;
+    }
+    for (int i=argi; i<argc; i++) {
+        if (!strcmp(argv[i],"--mode") && i+1<argc) g_mode = parse_mode(argv[++i]);
+        else if (!strcmp(argv[i],"--filter-pid") && i+1<argc) g_filter_pid = (__u32)atoi(argv[++i]);
+        else if (!strcmp(argv[i],"--wait-alert-ms") && i+1<argc) g_wait_alert_ns = (__u64)atoll(argv[++i]) * 1000000ULL;
+        else if (!strcmp(argv[i],"--reorder-ms") && i+1<argc) g_reorder_ns = (__u64)atoll(argv[++i]) * 1000000ULL;
+        else if (!strcmp(argv[i],"--bucket-ms") && i+1<argc) g_bucket_ns = (__u64)atoll(argv[++i]) * 1000000ULL;
+        else if (!strcmp(argv[i],"--heat-ms") && i+1<argc) g_heat_ns = (__u64)atoll(argv[++i]) * 1000000ULL;
+        else if (!strcmp(argv[i],"--heat-metrics") && i+1<argc) { if (parse_heat_metrics(argv[++i])) { usage(argv[0]); return 1; } }
+        else if (!strcmp(argv[i],"--svg") && i+1<argc) g_svg_path = argv[++i];
+        else if (!strcmp(argv[i],"--capture") && i+1<argc) g_cap_path = argv[++i];
+        else if (!strcmp(argv[i],"--output") && i+1<argc) g_rot.out_path = argv[++i];
+        else if (!strcmp(argv[i],"--rotate-size") && i+1<argc) {
+            if (parse_size(argv[++i], &g_rot.size_limit)) { usage(argv[0]); return 1; }
+        }
+        else if (!strcmp(argv[i],"--rotate-interval") && i+1<argc) {
+            if (parse_duration(argv[++i], &g_rot.interval_ns)) { usage(argv[0]); return 1; }
+        }
+        else if (!strcmp(argv[i],"--ctl") && i+1<argc) g_ctl.path = argv[++i];
+        else if (!strcmp(argv[i],"--dump-dir") && i+1<argc) g_dump_dir = argv[++i];
+        else if (!strcmp(argv[i],"--mark-lib") && i+1<argc) g_mark.lib = argv[++i];
+        else if (!strcmp(argv[i],"--mark-fifo") && i+1<argc) g_mark.fifo = argv[++i];
+        else if (!strcmp(argv[i],"--uprobe-begin") && i+1<argc) g_req.begin = argv[++i];
+        else if (!strcmp(argv[i],"--uprobe-end") && i+1<argc) g_req.end = argv[++i];
+        else if (!strcmp(argv[i],"--stacks") && i+1<argc) g_stk.dir = argv[++i];
+        else if (!strcmp(argv[i],"--stacks-max") && i+1<argc) g_stk.max = (unsigned)atoi(argv[++i]);
+        else if (!strcmp(argv[i],"--listen") && i+1<argc) g_exp.listen = argv[++i];
+        else if (!strcmp(argv[i],"--textfile") && i+1<argc) g_exp.textfile = argv[++i];
+        else if (!strcmp(argv[i],"--textfile-interval") && i+1<argc) {
+            if (parse_duration(argv[++i], &g_exp.interval_ns) || !g_exp.interval_ns) { usage(argv[0]); return 1; }
+        }
+        else if (!strcmp(argv[i],"--keep") && i+1<argc) g_rot.keep = atoi(argv[++i]);
+        else if (!strcmp(argv[i],"--duration") && i+1<argc) {
+            if (parse_duration(argv[++i], &g_duration_ns)) { usage(argv[0]); return 1; }
+        }
+        else if (!strcmp(argv[i],"--capture-enc") && i+1<argc) {
+            if (cap_parse_enc(argv[++i], &g_cap_enc)) { usage(argv[0]); return 1; }
+        }
+        else if (!strcmp(argv[i],"--by") && i+1<argc) {
+            ++i;
+            if      (!strcmp(argv[i],"pid"))  g_lat_by = LAT_BY_PID;
+            else if (!strcmp(argv[i],"comm")) g_lat_by = LAT_BY_COMM;
+            else if (!strcmp(argv[i],"cgroup")) g_top.by_cgroup = 1;
+            else { usage(argv[0]); return 1; }
+        }
+        else if (!strcmp(argv[i],"--sort") && i+1<argc) {
+            if ((g_top.sort = parse_top_sort(argv[++i])) < 0) { usage(argv[0]); return 1; }
+        }
+        else if (!strcmp(argv[i],"--top") && i+1<argc) g_top_n = atoi(argv[++i]);
+        else if (!strcmp(argv[i],"--short-ms") && i+1<argc) g_short_ns = (__u64)(atof(argv[++i]) * 1e6);
+        else if (!strcmp(argv[i],"--wait-rule") && i+1<argc) {
+            if (parse_wait_rule(argv[++i])) {
+                fprintf(stderr, "bad --wait-rule '%s'\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i],"--no-global-alert")) g_no_global_alert = 1;
+        else if (!strcmp(argv[i],"--csv")) g_csv = 1;
+        else if (!strcmp(argv[i],"--csv-header")) g_csv_header = 1;
+        else { usage(argv[0]); return 1; }
+    }
+    if (!g_bucket_ns || !g_heat_ns) { usage(argv[0]); return 1; }
+    if (g_top.by_cgroup && g_mode != MODE_TOP && g_mode != MODE_INTERF) { usage(argv[0]); return 1; }
+    if ((g_stk.dir || g_mode == MODE_OFFCPU) && !(g_stk.sym = sym_new())) { perror("sym_new"); return 1; }
+    if (!g_req.begin != !g_req.end) {
+        fprintf(stderr, "--uprobe-begin and --uprobe-end go together\n");
+        return 1;
+    }
+    if (rot_enabled() && !g_rot.out_path && !g_cap_path) {
+        fprintf(stderr, "--rotate-size/--rotate-interval need --output or --capture\n");
+        return 1;
+    }
+    g_rot.header = g_csv && g_csv_header;
+    if ((g_mark.lib || g_mark.fifo) && (g_rot.out_path || g_cap_path)) {
+        g_rot.by_phase = 1;
+        g_rot.phase = g_mark.name;
+    }
+
+    g_ncpus = libbpf_num_possible_cpus();
+    if (g_ncpus <= 0) { fprintf(stderr, "cannot determine possible CPUs\n"); return 1; }
+
+    libbpf_set_strict_mode(LIBBPF_STRICT_ALL);
+    signal(SIGINT,  on_sig);
+    signal(SIGTERM, on_sig);
+    signal(SIGUSR1, on_usr);
+    signal(SIGUSR2, on_usr);
+
+    /* open + load the BPF object via skeleton */
+    struct schedlab_bpf *skel = schedlab_bpf__open_and_load();
+    if (!skel) { perror("open_and_load"); return 2; }
+    g_skel = skel;
+
+    /* init cfg_map in kernel */
+    g_cfg = (struct cfg){.wait_alert_ns = g_wait_alert_ns, .sample_filter_pid = g_filter_pid,
+                         .bucket_ns = g_bucket_ns, .heat_mask = g_heat_mask,
+                         .life_cutoff_ns = g_short_ns};
+    if (g_mode == MODE_UTIL || g_mode == MODE_CPUSERIES || g_mode == MODE_HEATMAP)
+        g_cfg.flags |= CFG_F_NO_EVENTS;
+    if (g_mode == MODE_CPUSERIES)
+        g_cfg.flags |= CFG_F_CPU_SERIES;
+    if (g_mode == MODE_HEATMAP)
+        g_cfg.flags |= CFG_F_HEATMAP;
+    if (g_mode == MODE_CLASSES)
+        g_cfg.flags |= CFG_F_NO_EVENTS | CFG_F_CLASS;
+    if (g_mode == MODE_SHORTLONG)
+        g_cfg.flags |= CFG_F_NO_EVENTS | CFG_F_LIFE;
+    if (g_mode == MODE_LATENCY && g_lat_by)
+        g_cfg.flags |= CFG_F_NO_EVENTS |
+                       (g_lat_by == LAT_BY_PID ? CFG_F_LAT_PID : CFG_F_LAT_COMM);
+    if (g_mode == MODE_TOP || g_mode == MODE_EXPORT)
+        g_cfg.flags |= CFG_F_NO_EVENTS | CFG_F_LAT_PID | CFG_F_CGID;
+    if (g_req.begin)
+        g_cfg.flags |= CFG_F_REQ;
+    if (g_stk.dir)
+        g_cfg.flags |= CFG_F_STACKS;
+    if (g_mode == MODE_OFFCPU)
+        g_cfg.flags |= CFG_F_NO_EVENTS | CFG_F_OFFCPU;
+    if (g_mode == MODE_INTERF)
+        g_cfg.flags |= CFG_F_NO_EVENTS | CFG_F_INTERF;
+    if (g_mode == MODE_WAKES)
+        g_cfg.flags |= CFG_F_NO_EVENTS | CFG_F_WAKES;
+    if (g_mode == MODE_TOPO)
+        g_cfg.flags |= CFG_F_NO_EVENTS | CFG_F_TOPO;
+    if (g_mode == MODE_SMT)
+        g_cfg.flags |= CFG_F_NO_EVENTS | CFG_F_SMT;
+    g_cfg.rule_kinds = rules_kind_mask();
+    if (g_no_global_alert)
+        g_cfg.flags |= CFG_F_NO_GLOBAL;
+    if (rules_push(bpf_map__fd(skel->maps.wait_rules))) {
+        perror("bpf_map_update_elem(wait_rules)");
+        schedlab_bpf__destroy(skel);
+        return 3;
+    }
+    if (topo_load() || topo_push(bpf_map__fd(skel->maps.cpu_topo))) {
+        perror("cpu_topo");
+        schedlab_bpf__destroy(skel);
+        return 3;
+    }
+    if (g_mode == MODE_SMT) {
+        int smt = 0;
+        for (int cpu = 0; cpu < g_ncpus; cpu++) smt |= g_topo[cpu].sibling >= 0;
+        if (!smt) fprintf(stderr, "--mode smt: no SMT siblings in %s; the report will be empty\n", g_sysfs_cpu);
+    }
+    g_cfg_fd = bpf_map__fd(skel->maps.cfg_map);
+    if (cfg_push()) {
+        perror("bpf_map_update_elem(cfg_map)");
+        schedlab_bpf__destroy(skel);
+        return 3;
+    }
+
+    /* attach all tp_btf programs */
+    if (schedlab_bpf__attach(skel)) {
+        perror("attach");
+        schedlab_bpf__destroy(skel);
+        return 4;
+    }
+    if (g_mark.lib) {
+        LIBBPF_OPTS(bpf_uprobe_opts, uo, .func_name = "schedlab_mark");
+        skel->links.on_mark = bpf_program__attach_uprobe_opts(skel->progs.on_mark, -1,
+                                                              g_mark.lib, 0, &uo);
+        if (!skel->links.on_mark) {
+            fprintf(stderr, "--mark-lib %s: cannot attach to schedlab_mark: %s\n",
+                g_mark.lib, strerror(errno));
+            schedlab_bpf__destroy(skel);
+            return 4;
+        }
+    }
+    if (g_req.begin && req_attach(skel)) {
+        schedlab_bpf__destroy(skel);
+        return 4;
+    }
+
+    g_stk.fd = bpf_map__fd(skel->maps.stack_traces);
+    g_stk.miss_fd = bpf_map__fd(skel->maps.stack_misses);
+    if (g_stk.dir && (g_cfg.flags & CFG_F_NO_EVENTS))
+        fprintf(stderr, "--stacks: mode %s does not stream events; no episodes will be written\n",
+            mode_names[g_mode]);
+    if (g_cap_path && (g_cfg.flags & CFG_F_NO_EVENTS) && !(g_cfg.flags & CFG_F_LIFE))
+        fprintf(stderr, "--capture: mode %s does not stream events; capture will be empty\n",
+            mode_names[g_mode]);
+    struct ring_buffer *rb = NULL;
+    if (g_ctl.path && ctl_listen()) {
+        fprintf(stderr, "--ctl %s: %s\n", g_ctl.path, strerror(errno));
+        goto fail;
+    }
+    if (g_mark.fifo && mark_fifo_open()) {
+        fprintf(stderr, "--mark-fifo %s: %s\n", g_mark.fifo, strerror(errno));
+        goto fail;
+    }
+    if ((g_rot.out_path || g_cap_path) && rot_open())
+        goto fail;
+
+    if (reorder_wanted() && reorder_init(g_reorder_ns)) {
+        perror("reorder_init");
+        goto fail;
+    }
+
+    /* ring buffer reader */
+    rb = ring_buffer__new(bpf_map__fd(skel->maps.rb), handle_event, NULL, NULL);
+    if (!rb) {
+        perror("ring_buffer__new");
+        goto fail;
+    }
+
+    if (!g_csv)
+        fprintf(stderr, "schedlab attached. mode=%s filter-pid=%u wait-alert-ms=%" PRIu64 "\n",
+            mode_names[g_mode], g_filter_pid, (uint64_t)(g_wait_alert_ns/1000000ULL));
+    else
+        print_csv_header_once();
+
+    if (periodic_init(skel)) {
+        perror("periodic_init");
+        goto fail;
+    }
+    __u64 next_tick = mono_ns() + g_tick_ns;
+    __u64 deadline = g_duration_ns ? mono_ns() + g_duration_ns : 0;
+
+    while (!g_stop) {
+        int err = ring_buffer__poll(rb, g_exp.fd >= 0 ? 0 : g_ro.heap ? 10 : 200);
+        if (err == -EINTR && g_stop) break;
+        if (err < 0 && err != -EAGAIN && err != -EINTR) {
+            fprintf(stderr, "ring_buffer__poll: %d\n", err);
+            break;
+        }
+        if (g_ro.heap) reorder_drain(0);
+        if (g_exp.fd >= 0) exp_poll(200);
+        if (g_ctl.fd >= 0) ctl_poll();
+        if (g_mark.fd >= 0) mark_fifo_poll();
+        if (g_dump_req) {
+            int reset = g_dump_req == 2;
+            g_dump_req = 0;
+            aggs_dump(reset, NULL);
+        }
+        if (g_mode == MODE_TOP) top_keys();
+        if (g_tick_ns && mono_ns() >= next_tick) {
+            periodic_tick(skel);
+            next_tick += g_tick_ns;
+        }
+        rot_check();
+        if (g_stk.dir) stack_gc();
+        if (deadline && mono_ns() >= deadline) break;
+    }
+    if (g_ro.heap) {
+        ring_buffer__consume(rb);
+        reorder_drain(1);
+        reorder_report();
+        free(g_ro.heap);
+    }
+    mode_reports();
+    if (g_stk.dir || g_mode == MODE_OFFCPU) stack_report(bpf_map__fd(skel->maps.stack_misses));
+    if (g_phase_seq) aggs_dump(0, g_mark.name);   /* the last phase */
+    if (g_mode == MODE_HEATMAP) {
+        heat_rotate(bpf_map__fd(skel->maps.heat));  /* partial last column */
+        if (g_svg_path && heat_write_svg(g_svg_path))
+            perror(g_svg_path);
+    }
+
+    if (g_mode == MODE_TOP)
+        top_free();
+    if (g_mode == MODE_EXPORT)
+        exp_free();
+    u64map_free(&g_cg_names);
+    ctl_free();
+    mark_free();
+    sym_free(g_stk.sym);
+
+    rot_close();
+    free(g_heat_cols);
+    free(g_util_prev);
+    free(g_topo);
+    ring_buffer__free(rb);
+    schedlab_bpf__destroy(skel);
+    return 0;
+
+fail:   /* everything from --ctl on; each step is a no-op if it never ran */
+    ring_buffer__free(rb);
+    free(g_ro.heap);
+    rot_close();
+    mark_free();
+    ctl_free();
+    free(g_topo);
+    schedlab_bpf__destroy(skel);
+    return 5;
 }
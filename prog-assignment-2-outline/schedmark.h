@@ -0,0 +1,13 @@
+// schedlab/schedmark.h
+// SPDX-License-Identifier: MIT
+#ifndef SCHEDMARK_H
+#define SCHEDMARK_H
+
+/* Phase markers for schedlab. Link the workload with -lschedmark and call
+ * schedlab_mark("warmup"), schedlab_mark("steady"), ... at each phase
+ * boundary. The call is a no-op; a running `schedlab --mark-lib
+ * libschedmark.so` has a uprobe on it and splits its output there.
+ * Names longer than 31 bytes are cut. */
+void schedlab_mark(const char *phase);
+
+#endif /* SCHEDMARK_H */